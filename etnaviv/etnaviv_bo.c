@@ -28,7 +28,6 @@
 #include "etnaviv_drmif.h"
 
 drm_private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-drm_private void bo_del(struct etna_bo *bo);
 
 /* set buffer name, and add to table, call w/ table_lock held: */
 static void set_name(struct etna_bo *bo, uint32_t name)
@@ -69,7 +68,7 @@ static struct etna_bo *lookup_bo(void *tbl, uint32_t handle)
 		bo = etna_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		util_bo_cache_remove(&bo->cache_entry);
 	}
 
 	return bo;
@@ -96,7 +95,6 @@ static struct etna_bo *bo_from_handle(struct etna_device *dev,
 	bo->handle = handle;
 	bo->flags = flags;
 	atomic_set(&bo->refcnt, 1);
-	list_inithead(&bo->list);
 	/* add ourselves to the handle table: */
 	drmHashInsert(dev->handle_table, handle, bo);
 
@@ -322,6 +320,10 @@ drm_public void *etna_bo_map(struct etna_bo *bo)
 		}
 	}
 
+	/* the caller may be about to write through the mapping: */
+	if (bo->dev->capture)
+		bo->capture_gen = util_capture_next_generation(bo->dev->capture);
+
 	return bo->map;
 }
 
@@ -332,6 +334,9 @@ drm_public int etna_bo_cpu_prep(struct etna_bo *bo, uint32_t op)
 		.op = op,
 	};
 
+	if (bo->dev->capture && (op & DRM_ETNA_PREP_WRITE))
+		bo->capture_gen = util_capture_next_generation(bo->dev->capture);
+
 	get_abs_timeout(&req.timeout, 5000000000);
 
 	return drmCommandWrite(bo->dev->fd, DRM_ETNAVIV_GEM_CPU_PREP,
@@ -29,7 +29,10 @@
 #include "etnaviv_drmif.h"
 #include "etnaviv_priv.h"
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
+#define BO_TABLE_INIT_SIZE	64
+
+/* source of the stream seqnos bo2idx() tags bo's with: */
+static atomic_t stream_cnt = { 0 };
 
 static void *grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
 {
@@ -55,6 +58,10 @@ etna_cmd_stream_priv(struct etna_cmd_stream *stream)
     return (struct etna_cmd_stream_priv *)stream;
 }
 
+static void async_drain(struct etna_cmd_stream_priv *priv);
+static void async_wait_submitted(struct etna_cmd_stream_priv *priv);
+static void async_fini(struct etna_cmd_stream_priv *priv);
+
 drm_public struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe,
         uint32_t size,
 		void (*reset_notify)(struct etna_cmd_stream *stream, void *priv),
@@ -84,6 +91,7 @@ drm_public struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe,
 
 	stream->base.size = size;
 	stream->pipe = pipe;
+	stream->seqno = atomic_inc_return(&stream_cnt);
 	stream->reset_notify = reset_notify;
 	stream->reset_notify_priv = priv;
 
@@ -100,9 +108,13 @@ drm_public void etna_cmd_stream_del(struct etna_cmd_stream *stream)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
 
+	if (priv->async)
+		async_fini(priv);
+
 	free(stream->buffer);
 	free(priv->submit.relocs);
 	free(priv->submit.pmrs);
+	free(priv->bo_table);
 	free(priv);
 }
 
@@ -114,15 +126,28 @@ static void reset_buffer(struct etna_cmd_stream *stream)
 	priv->submit.nr_bos = 0;
 	priv->submit.nr_relocs = 0;
 	priv->submit.nr_pmrs = 0;
+	priv->submit.perf_session = NULL;
 	priv->nr_bos = 0;
 
+	/* stale bo tags are rejected by bo2idx() once nr_bos is zero, but the
+	 * bo_table has to be emptied:
+	 */
+	priv->seqno = atomic_inc_return(&stream_cnt);
+	if (priv->bo_table)
+		memset(priv->bo_table, 0,
+		       priv->bo_table_size * sizeof(priv->bo_table[0]));
+
 	if (priv->reset_notify)
 		priv->reset_notify(stream, priv->reset_notify_priv);
 }
 
 drm_public uint32_t etna_cmd_stream_timestamp(struct etna_cmd_stream *stream)
 {
-	return etna_cmd_stream_priv(stream)->last_timestamp;
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	async_wait_submitted(priv);
+
+	return priv->last_timestamp;
 }
 
 static uint32_t append_bo(struct etna_cmd_stream *stream, struct etna_bo *bo)
@@ -141,30 +166,88 @@ static uint32_t append_bo(struct etna_cmd_stream *stream, struct etna_bo *bo)
 	return idx;
 }
 
-/* add (if needed) bo, return idx: */
+static inline uint32_t bo_table_hash(struct etna_cmd_stream_priv *priv,
+		uint32_t handle)
+{
+	return (handle * 0x9e3779b1) & (priv->bo_table_size - 1);
+}
+
+/* find bo in the stream's bo_table, returning the slot it is in, or the
+ * empty slot it would go in:
+ */
+static uint32_t *bo_table_slot(struct etna_cmd_stream_priv *priv,
+		struct etna_bo *bo)
+{
+	uint32_t mask = priv->bo_table_size - 1;
+	uint32_t i = bo_table_hash(priv, bo->handle);
+
+	while (priv->bo_table[i] && priv->bos[priv->bo_table[i] - 1] != bo)
+		i = (i + 1) & mask;
+
+	return &priv->bo_table[i];
+}
+
+/* keep the bo_table at most half full, so that probe sequences stay short: */
+static int bo_table_reserve(struct etna_cmd_stream_priv *priv)
+{
+	uint32_t size = priv->bo_table_size;
+	uint32_t *table;
+
+	if (priv->bo_table && (priv->nr_bos + 1) * 2 <= size)
+		return 0;
+
+	size = size ? size * 2 : BO_TABLE_INIT_SIZE;
+	table = calloc(size, sizeof(*table));
+	if (!table) {
+		ERROR_MSG("allocation failed");
+		return -1;
+	}
+
+	free(priv->bo_table);
+	priv->bo_table = table;
+	priv->bo_table_size = size;
+
+	for (uint32_t i = 0; i < priv->nr_bos; i++)
+		*bo_table_slot(priv, priv->bos[i]) = i + 1;
+
+	return 0;
+}
+
+/* add (if needed) bo, return idx.  This takes no locks: the stream's own
+ * tables are only touched by the thread building it, and the bo's cached
+ * (stream, idx) tag is only trusted once the stream's bos table agrees.
+ */
 static uint32_t bo2idx(struct etna_cmd_stream *stream, struct etna_bo *bo,
 		uint32_t flags)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
-	uint32_t idx;
-
-	pthread_mutex_lock(&idx_lock);
-
-	if (bo->current_stream == stream) {
-		idx = bo->idx;
-	} else {
-		/* slow-path: */
-		for (idx = 0; idx < priv->nr_bos; idx++)
-			if (priv->bos[idx] == bo)
-				break;
-		if (idx == priv->nr_bos) {
-			/* not found */
-			idx = append_bo(stream, bo);
+	int seqno = atomic_read(&bo->current_stream_seqno);
+	uint32_t idx = atomic_read(&bo->idx);
+
+	if (seqno != priv->seqno || idx >= priv->nr_bos ||
+	    priv->bos[idx] != bo) {
+		uint32_t *slot;
+
+		if (bo_table_reserve(priv)) {
+			/* without a table, fall back to searching bos: */
+			for (idx = 0; idx < priv->nr_bos; idx++)
+				if (priv->bos[idx] == bo)
+					break;
+			if (idx == priv->nr_bos)
+				idx = append_bo(stream, bo);
+		} else {
+			slot = bo_table_slot(priv, bo);
+			if (*slot) {
+				idx = *slot - 1;
+			} else {
+				idx = append_bo(stream, bo);
+				*slot = idx + 1;
+			}
 		}
-		bo->current_stream = stream;
-		bo->idx = idx;
+
+		atomic_set(&bo->current_stream_seqno, priv->seqno);
+		atomic_set(&bo->idx, idx);
 	}
-	pthread_mutex_unlock(&idx_lock);
 
 	if (flags & ETNA_RELOC_READ)
 		priv->submit.bos[idx].flags |= ETNA_SUBMIT_BO_READ;
@@ -174,24 +257,75 @@ static uint32_t bo2idx(struct etna_cmd_stream *stream, struct etna_bo *bo,
 	return idx;
 }
 
-static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
-		  int *out_fence_fd)
+/* Only the contents of the bos the CPU has a mapping of are captured, the
+ * others are produced by the GPU.
+ */
+static void capture(struct etna_pipe *pipe, uint32_t *buffer, uint32_t offset,
+		struct etna_cmd_stream_submit *submit, struct etna_bo **bos)
 {
-	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
-	int ret, id = priv->pipe->id;
-	struct etna_gpu *gpu = priv->pipe->gpu;
+	struct util_capture_submit cap = {
+		.queue = pipe->id,
+		.nr_bos = submit->nr_bos,
+		.nr_cmds = 1,
+		.nr_relocs = submit->nr_relocs,
+	};
+	struct util_capture_cmd cmd = {
+		.bo_idx = UTIL_CAPTURE_NO_BO,
+		.size = offset * 4,
+		.data = buffer,
+	};
+	struct util_capture_bo *cap_bos;
+	struct util_capture_reloc *cap_relocs;
+
+	cap_bos = calloc(submit->nr_bos + 1, sizeof(*cap_bos));
+	cap_relocs = calloc(submit->nr_relocs + 1, sizeof(*cap_relocs));
+	if (!cap_bos || !cap_relocs)
+		goto out;
+
+	for (uint32_t i = 0; i < submit->nr_bos; i++) {
+		cap_bos[i].handle = submit->bos[i].handle;
+		cap_bos[i].flags = submit->bos[i].flags;
+		cap_bos[i].iova = submit->bos[i].presumed;
+		cap_bos[i].size = bos[i]->size;
+		cap_bos[i].generation = bos[i]->capture_gen;
+		cap_bos[i].map = bos[i]->map;
+	}
+
+	for (uint32_t i = 0; i < submit->nr_relocs; i++) {
+		cap_relocs[i].submit_offset = submit->relocs[i].submit_offset;
+		cap_relocs[i].reloc_idx = submit->relocs[i].reloc_idx;
+		cap_relocs[i].reloc_offset = submit->relocs[i].reloc_offset;
+		cap_relocs[i].flags = submit->relocs[i].flags;
+	}
+
+	cap.bos = cap_bos;
+	cap.cmds = &cmd;
+	cap.relocs = cap_relocs;
+	util_capture_submit(pipe->gpu->dev->capture, &cap);
+
+out:
+	free(cap_bos);
+	free(cap_relocs);
+}
+
+static int submit(struct etna_pipe *pipe, uint32_t *buffer, uint32_t offset,
+		struct etna_cmd_stream_submit *submit, struct etna_bo **bos,
+		int in_fence_fd, int *out_fence_fd, uint32_t *timestamp)
+{
+	int ret, id = pipe->id;
+	struct etna_gpu *gpu = pipe->gpu;
 
 	struct drm_etnaviv_gem_submit req = {
 		.pipe = gpu->core,
 		.exec_state = id,
-		.bos = VOID2U64(priv->submit.bos),
-		.nr_bos = priv->submit.nr_bos,
-		.relocs = VOID2U64(priv->submit.relocs),
-		.nr_relocs = priv->submit.nr_relocs,
-		.pmrs = VOID2U64(priv->submit.pmrs),
-		.nr_pmrs = priv->submit.nr_pmrs,
-		.stream = VOID2U64(stream->buffer),
-		.stream_size = stream->offset * 4, /* in bytes */
+		.bos = VOID2U64(submit->bos),
+		.nr_bos = submit->nr_bos,
+		.relocs = VOID2U64(submit->relocs),
+		.nr_relocs = submit->nr_relocs,
+		.pmrs = VOID2U64(submit->pmrs),
+		.nr_pmrs = submit->nr_pmrs,
+		.stream = VOID2U64(buffer),
+		.stream_size = offset * 4, /* in bytes */
 	};
 
 	if (in_fence_fd != -1) {
@@ -202,28 +336,240 @@ static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
 	if (out_fence_fd)
 		req.flags |= ETNA_SUBMIT_FENCE_FD_OUT;
 
+	if (gpu->dev->capture)
+		capture(pipe, buffer, offset, submit, bos);
+
 	ret = drmCommandWriteRead(gpu->dev->fd, DRM_ETNAVIV_GEM_SUBMIT,
 			&req, sizeof(req));
 
 	if (ret)
 		ERROR_MSG("submit failed: %d (%s)", ret, strerror(errno));
 	else
-		priv->last_timestamp = req.fence;
+		*timestamp = req.fence;
 
-	for (uint32_t i = 0; i < priv->nr_bos; i++) {
-		struct etna_bo *bo = priv->bos[i];
-
-		bo->current_stream = NULL;
-		etna_bo_del(bo);
-	}
+	if (submit->perf_session)
+		atomic_inc(&submit->perf_session->submitted);
 
 	if (out_fence_fd)
 		*out_fence_fd = req.fence_fd;
+
+	return ret;
+}
+
+static void *submit_thread(void *arg)
+{
+	struct etna_cmd_stream_priv *priv = arg;
+	struct etna_cmd_stream_async *async = priv->async;
+	uint32_t timestamp;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;) {
+		while (!async->pending && !async->stop)
+			pthread_cond_wait(&async->cond, &async->lock);
+		if (!async->pending)
+			break;
+
+		/* the stream doesn't touch the pending buffer until we're done: */
+		pthread_mutex_unlock(&async->lock);
+
+		timestamp = priv->last_timestamp;
+		submit(priv->pipe, async->buffer, async->offset, &async->submit,
+		       async->bos, -1, NULL, &timestamp);
+
+		/* the fence is known, don't keep etna_cmd_stream_timestamp()
+		 * waiting for the bo's to be released:
+		 */
+		pthread_mutex_lock(&async->lock);
+		priv->last_timestamp = timestamp;
+		async->submitted++;
+		pthread_cond_broadcast(&async->cond);
+		pthread_mutex_unlock(&async->lock);
+
+		for (uint32_t i = 0; i < async->nr_bos; i++)
+			etna_bo_del(async->bos[i]);
+
+		pthread_mutex_lock(&async->lock);
+		async->pending = 0;
+		pthread_cond_broadcast(&async->cond);
+	}
+	pthread_mutex_unlock(&async->lock);
+
+	return NULL;
+}
+
+/* wait for the submit thread to be done with the previous flush, if any: */
+static void async_drain(struct etna_cmd_stream_priv *priv)
+{
+	struct etna_cmd_stream_async *async = priv->async;
+
+	if (!async)
+		return;
+
+	pthread_mutex_lock(&async->lock);
+	while (async->pending)
+		pthread_cond_wait(&async->cond, &async->lock);
+	pthread_mutex_unlock(&async->lock);
+}
+
+/* wait for the submit ioctl of the last flush, but not for the submit
+ * thread to be done with it:
+ */
+static void async_wait_submitted(struct etna_cmd_stream_priv *priv)
+{
+	struct etna_cmd_stream_async *async = priv->async;
+
+	if (!async)
+		return;
+
+	pthread_mutex_lock(&async->lock);
+	while (async->submitted != async->queued)
+		pthread_cond_wait(&async->cond, &async->lock);
+	pthread_mutex_unlock(&async->lock);
+}
+
+/* hand the stream's buffer and tables to the submit thread, and carry on
+ * with the ones of the previous flush:
+ */
+static void async_flush(struct etna_cmd_stream *stream)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	struct etna_cmd_stream_async *async = priv->async;
+	struct etna_cmd_stream_submit submit;
+	struct etna_bo **bos;
+	uint32_t *buffer, max_bos;
+
+	pthread_mutex_lock(&async->lock);
+	while (async->pending)
+		pthread_cond_wait(&async->cond, &async->lock);
+
+	buffer = async->buffer;
+	async->buffer = stream->buffer;
+	async->offset = stream->offset;
+	stream->buffer = buffer;
+
+	submit = async->submit;
+	async->submit = priv->submit;
+	priv->submit = submit;
+
+	bos = async->bos;
+	max_bos = async->max_bos;
+	async->bos = priv->bos;
+	async->nr_bos = priv->nr_bos;
+	async->max_bos = priv->max_bos;
+	priv->bos = bos;
+	priv->max_bos = max_bos;
+
+	async->pending = 1;
+	async->queued++;
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+}
+
+static void async_fini(struct etna_cmd_stream_priv *priv)
+{
+	struct etna_cmd_stream_async *async = priv->async;
+
+	pthread_mutex_lock(&async->lock);
+	async->stop = 1;
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+	pthread_join(async->thread, NULL);
+
+	pthread_cond_destroy(&async->cond);
+	pthread_mutex_destroy(&async->lock);
+	free(async->buffer);
+	free(async->submit.bos);
+	free(async->submit.relocs);
+	free(async->submit.pmrs);
+	free(async->bos);
+	free(async);
+	priv->async = NULL;
+}
+
+/**
+ * Switches the stream to asynchronous submits: etna_cmd_stream_flush() then
+ * hands the commands to a submit thread, which also drops the references to
+ * the bo's they use, and returns as soon as the previous flush of the
+ * stream has been submitted.  The stream's buffer is double-buffered for
+ * that, so stream->buffer changes on every flush.
+ *
+ * etna_cmd_stream_timestamp() only waits for the submit ioctl of the last
+ * flush, which is where the kernel assigns its fence, and not for the bo's
+ * to be released.  etna_cmd_stream_flush2() and etna_cmd_stream_finish()
+ * wait for the submit thread to be done, and always submit synchronously.
+ */
+drm_public int etna_cmd_stream_enable_async(struct etna_cmd_stream *stream)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	struct etna_cmd_stream_async *async;
+
+	if (priv->async)
+		return 0;
+
+	async = calloc(1, sizeof(*async));
+	if (!async) {
+		ERROR_MSG("allocation failed");
+		return -ENOMEM;
+	}
+
+	async->buffer = malloc(stream->size * sizeof(uint32_t));
+	if (!async->buffer) {
+		ERROR_MSG("allocation failed");
+		free(async);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->cond, NULL);
+
+	priv->async = async;
+	if (pthread_create(&async->thread, NULL, submit_thread, priv)) {
+		ERROR_MSG("failed to create the submit thread");
+		pthread_cond_destroy(&async->cond);
+		pthread_mutex_destroy(&async->lock);
+		free(async->buffer);
+		free(async);
+		priv->async = NULL;
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
+		  int *out_fence_fd)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	/* keep submits in order: */
+	async_drain(priv);
+
+	submit(priv->pipe, stream->buffer, stream->offset, &priv->submit,
+	       priv->bos, in_fence_fd, out_fence_fd, &priv->last_timestamp);
+
+	for (uint32_t i = 0; i < priv->nr_bos; i++)
+		etna_bo_del(priv->bos[i]);
+}
+
+/* add the perf requests of the stream's sampling session, if any: */
+static void sample(struct etna_cmd_stream *stream)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	if (!priv->perf_session)
+		return;
+
+	etna_perfmon_session_sample(priv->perf_session, stream);
+	priv->submit.perf_session = priv->perf_session;
 }
 
 drm_public void etna_cmd_stream_flush(struct etna_cmd_stream *stream)
 {
-	flush(stream, -1, NULL);
+	sample(stream);
+	if (etna_cmd_stream_priv(stream)->async)
+		async_flush(stream);
+	else
+		flush(stream, -1, NULL);
 	reset_buffer(stream);
 }
 
@@ -231,6 +577,7 @@ drm_public void etna_cmd_stream_flush2(struct etna_cmd_stream *stream,
 									   int in_fence_fd,
 									   int *out_fence_fd)
 {
+	sample(stream);
 	flush(stream, in_fence_fd, out_fence_fd);
 	reset_buffer(stream);
 }
@@ -239,6 +586,7 @@ drm_public void etna_cmd_stream_finish(struct etna_cmd_stream *stream)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
 
+	sample(stream);
 	flush(stream, -1, NULL);
 	etna_pipe_wait(priv->pipe, priv->last_timestamp, 5000);
 	reset_buffer(stream);
@@ -277,3 +625,18 @@ drm_public void etna_cmd_stream_perf(struct etna_cmd_stream *stream, const struc
 	pmr->domain = p->signal->domain->id;
 	pmr->signal = p->signal->signal;
 }
+
+/**
+ * Attaches a sampling session to the stream, or detaches it with NULL.  A
+ * session can only be attached to one stream at a time.
+ */
+drm_public void etna_cmd_stream_set_perfmon_session(struct etna_cmd_stream *stream,
+		struct etna_perfmon_session *session)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	/* so that the previous session can be deleted once detached: */
+	async_drain(priv);
+
+	priv->perf_session = session;
+}
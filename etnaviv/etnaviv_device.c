@@ -53,6 +53,7 @@ drm_public struct etna_device *etna_device_new(int fd)
 	dev->handle_table = drmHashCreate();
 	dev->name_table = drmHashCreate();
 	etna_bo_cache_init(&dev->bo_cache);
+	dev->capture = util_capture_open_env("ETNA_CAPTURE", "etnaviv");
 
 	return dev;
 }
@@ -81,7 +82,8 @@ drm_public struct etna_device *etna_device_ref(struct etna_device *dev)
 
 static void etna_device_del_impl(struct etna_device *dev)
 {
-	etna_bo_cache_cleanup(&dev->bo_cache, 0);
+	util_bo_cache_fini(&dev->bo_cache);
+	util_capture_close(dev->capture);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
 
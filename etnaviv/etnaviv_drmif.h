@@ -36,6 +36,7 @@ struct etna_gpu;
 struct etna_device;
 struct etna_cmd_stream;
 struct etna_perfmon;
+struct etna_perfmon_session;
 struct etna_perfmon_domain;
 struct etna_perfmon_signal;
 
@@ -146,6 +147,7 @@ void etna_cmd_stream_flush(struct etna_cmd_stream *stream);
 void etna_cmd_stream_flush2(struct etna_cmd_stream *stream, int in_fence_fd,
 			    int *out_fence_fd);
 void etna_cmd_stream_finish(struct etna_cmd_stream *stream);
+int etna_cmd_stream_enable_async(struct etna_cmd_stream *stream);
 
 static inline uint32_t etna_cmd_stream_avail(struct etna_cmd_stream *stream)
 {
@@ -199,6 +201,22 @@ void etna_perfmon_del(struct etna_perfmon *perfmon);
 struct etna_perfmon_domain *etna_perfmon_get_dom_by_name(struct etna_perfmon *pm, const char *name);
 struct etna_perfmon_signal *etna_perfmon_get_sig_by_name(struct etna_perfmon_domain *dom, const char *name);
 
+/* Sampling sessions: once attached to a stream, every flush samples the
+ * signals before and after the submit, and etna_perfmon_session_read()
+ * returns their deltas for the submits the GPU is done with, nr_signals
+ * per submit, oldest first.  If samples aren't read back before depth more
+ * submits are made, the oldest ones are lost.
+ */
+struct etna_perfmon_session *etna_perfmon_session_new(struct etna_perfmon *pm,
+		struct etna_perfmon_signal **signals, uint32_t nr_signals,
+		uint32_t depth);
+void etna_perfmon_session_del(struct etna_perfmon_session *session);
+int etna_perfmon_session_read(struct etna_perfmon_session *session,
+		uint32_t *deltas, uint32_t max_samples);
+uint32_t etna_perfmon_session_lost(struct etna_perfmon_session *session);
+void etna_cmd_stream_set_perfmon_session(struct etna_cmd_stream *stream,
+		struct etna_perfmon_session *session);
+
 struct etna_perf {
 #define ETNA_PM_PROCESS_PRE             0x0001
 #define ETNA_PM_PROCESS_POST            0x0002
@@ -183,3 +183,156 @@ drm_public struct etna_perfmon_signal *etna_perfmon_get_sig_by_name(struct etna_
 
 	return NULL;
 }
+
+/* never 0, which is what a result bo holds until its submit is done */
+static inline uint32_t session_sequence(uint32_t n)
+{
+	return n | 0x80000000;
+}
+
+static inline uint32_t session_bo_size(struct etna_perfmon_session *session)
+{
+	return (1 + 2 * session->nr_signals) * sizeof(uint32_t);
+}
+
+drm_public struct etna_perfmon_session *
+etna_perfmon_session_new(struct etna_perfmon *pm,
+		struct etna_perfmon_signal **signals, uint32_t nr_signals,
+		uint32_t depth)
+{
+	struct etna_device *dev = pm->pipe->gpu->dev;
+	struct etna_perfmon_session *session;
+
+	if (!nr_signals || !depth) {
+		ERROR_MSG("invalid session of %u signals, %u deep",
+			  nr_signals, depth);
+		return NULL;
+	}
+
+	session = calloc(1, sizeof(*session));
+	if (!session) {
+		ERROR_MSG("allocation failed");
+		return NULL;
+	}
+
+	session->nr_signals = nr_signals;
+	session->depth = depth;
+	session->signals = malloc(nr_signals * sizeof(*signals));
+	session->bos = calloc(depth, sizeof(*session->bos));
+	if (!session->signals || !session->bos) {
+		ERROR_MSG("allocation failed");
+		goto fail;
+	}
+	memcpy(session->signals, signals, nr_signals * sizeof(*signals));
+
+	for (uint32_t i = 0; i < depth; i++) {
+		session->bos[i] = etna_bo_new(dev, session_bo_size(session),
+					      ETNA_BO_UNCACHED);
+		if (!session->bos[i] || !etna_bo_map(session->bos[i]))
+			goto fail;
+	}
+
+	return session;
+
+fail:
+	etna_perfmon_session_del(session);
+	return NULL;
+}
+
+/**
+ * The session must have been detached from its stream first.  Submits that
+ * are still in flight keep their result bo's alive.
+ */
+drm_public void etna_perfmon_session_del(struct etna_perfmon_session *session)
+{
+	if (!session)
+		return;
+
+	for (uint32_t i = 0; session->bos && i < session->depth; i++)
+		if (session->bos[i])
+			etna_bo_del(session->bos[i]);
+	free(session->bos);
+	free(session->signals);
+	free(session);
+}
+
+/* called by the stream right before it submits: */
+drm_private void etna_perfmon_session_sample(struct etna_perfmon_session *session,
+		struct etna_cmd_stream *stream)
+{
+	uint32_t sequence = session_sequence(session->head);
+	struct etna_bo *bo = session->bos[session->head % session->depth];
+
+	/* the ring is full: the oldest samples are dropped */
+	if (session->head - session->tail == session->depth) {
+		session->tail++;
+		session->lost++;
+	}
+
+	memset(etna_bo_map(bo), 0, session_bo_size(session));
+
+	for (uint32_t i = 0; i < session->nr_signals; i++) {
+		struct etna_perf pre = {
+			.flags = ETNA_PM_PROCESS_PRE,
+			.sequence = sequence,
+			.signal = session->signals[i],
+			.bo = bo,
+			.offset = (1 + i) * sizeof(uint32_t),
+		};
+		struct etna_perf post = pre;
+
+		post.flags = ETNA_PM_PROCESS_POST;
+		post.offset += session->nr_signals * sizeof(uint32_t);
+
+		etna_cmd_stream_perf(stream, &pre);
+		etna_cmd_stream_perf(stream, &post);
+	}
+
+	session->head++;
+}
+
+/**
+ * Copies the counter deltas of up to max_samples submits into deltas, and
+ * returns how many there were.  Doesn't block: the submits the GPU is still
+ * busy with are left for the next call.
+ */
+drm_public int etna_perfmon_session_read(struct etna_perfmon_session *session,
+		uint32_t *deltas, uint32_t max_samples)
+{
+	uint32_t submitted = atomic_read(&session->submitted);
+	uint32_t n = 0;
+
+	while (n < max_samples && session->tail != session->head) {
+		struct etna_bo *bo = session->bos[session->tail % session->depth];
+		const uint32_t *map = etna_bo_map(bo);
+		const uint32_t *pre = map + 1;
+		const uint32_t *post = pre + session->nr_signals;
+
+		if (map[0] != session_sequence(session->tail)) {
+			/* either the GPU isn't done yet, or the submit
+			 * failed and the bo will never be written:
+			 */
+			if ((int32_t)(submitted - session->tail) <= 0 ||
+			    etna_bo_cpu_prep(bo, ETNA_PREP_READ | ETNA_PREP_NOSYNC))
+				break;
+			etna_bo_cpu_fini(bo);
+			session->tail++;
+			session->lost++;
+			continue;
+		}
+
+		for (uint32_t i = 0; i < session->nr_signals; i++)
+			*deltas++ = post[i] - pre[i];
+
+		session->tail++;
+		n++;
+	}
+
+	return n;
+}
+
+/* number of samples dropped because the ring was full or the submit failed */
+drm_public uint32_t etna_perfmon_session_lost(struct etna_perfmon_session *session)
+{
+	return session->lost;
+}
@@ -42,22 +42,13 @@
 #include "xf86drm.h"
 #include "xf86atomic.h"
 
+#include "util_bo_cache.h"
 #include "util_double_list.h"
+#include "util_submit_capture.h"
 
 #include "etnaviv_drmif.h"
 #include "etnaviv_drm.h"
 
-struct etna_bo_bucket {
-	uint32_t size;
-	struct list_head list;
-};
-
-struct etna_bo_cache {
-	struct etna_bo_bucket cache_bucket[14 * 4];
-	unsigned num_buckets;
-	time_t time;
-};
-
 struct etna_device {
 	int fd;
 	atomic_t refcnt;
@@ -73,18 +64,21 @@ struct etna_device {
 	 */
 	void *handle_table, *name_table;
 
-	struct etna_bo_cache bo_cache;
+	struct util_bo_cache bo_cache;
+
+	/* submits are captured here if $ETNA_CAPTURE is set: */
+	struct util_capture *capture;
 
 	int closefd;        /* call close(fd) upon destruction */
 };
 
-drm_private void etna_bo_cache_init(struct etna_bo_cache *cache);
-drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time);
-drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache,
+drm_private void etna_bo_cache_init(struct util_bo_cache *cache);
+drm_private struct etna_bo *etna_bo_cache_alloc(struct util_bo_cache *cache,
 		uint32_t *size, uint32_t flags);
-drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *bo);
+drm_private int etna_bo_cache_free(struct util_bo_cache *cache, struct etna_bo *bo);
 
 /* for where @table_lock is already held: */
+drm_private void bo_del(struct etna_bo *bo);
 drm_private void etna_device_del_locked(struct etna_device *dev);
 
 /* a GEM buffer object allocated from the DRM device */
@@ -99,18 +93,20 @@ struct etna_bo {
 	atomic_t        refcnt;
 
 	/* in the common case, a bo won't be referenced by more than a single
-	 * command stream.  So to avoid looping over all the bo's in the
-	 * reloc table to find the idx of a bo that might already be in the
-	 * table, we cache the idx in the bo.  But in order to detect the
-	 * slow-path where bo is ref'd in multiple streams, we also must track
-	 * the current_stream for which the idx is valid.  See bo2idx().
+	 * command stream.  So to avoid looking up the idx of a bo that might
+	 * already be in the reloc table, we cache the idx in the bo, tagged
+	 * with the seqno of the stream it is valid for.  Several streams may
+	 * race to update the tag, so it is only a hint, which bo2idx() checks
+	 * against the stream's own bos table.
 	 */
-	struct etna_cmd_stream *current_stream;
-	uint32_t idx;
+	atomic_t current_stream_seqno;
+	atomic_t idx;
 
 	int reuse;
-	struct list_head list;   /* bucket-list entry */
-	time_t free_time;        /* time when added to bucket-list */
+	struct util_bo_cache_entry cache_entry;
+
+	/* changed whenever the CPU may write the contents, when capturing: */
+	uint32_t capture_gen;
 };
 
 struct etna_gpu {
@@ -125,34 +121,73 @@ struct etna_pipe {
 	struct etna_gpu *gpu;
 };
 
+/* submit ioctl related tables: */
+struct etna_cmd_stream_submit {
+	/* bo's table: */
+	struct drm_etnaviv_gem_submit_bo *bos;
+	uint32_t nr_bos, max_bos;
+
+	/* reloc's table: */
+	struct drm_etnaviv_gem_submit_reloc *relocs;
+	uint32_t nr_relocs, max_relocs;
+
+	/* perf's table: */
+	struct drm_etnaviv_gem_submit_pmr *pmrs;
+	uint32_t nr_pmrs, max_pmrs;
+
+	/* session sampled by this submit, if any: */
+	struct etna_perfmon_session *perf_session;
+};
+
+/* In async mode, a flush swaps the stream's buffer and tables with these
+ * and lets the submit thread pass them to the kernel, so that the next
+ * submit can be built in the meantime.  Everything but the thread itself
+ * is protected by the lock.  pending stays set until the thread is done
+ * with the buffer and tables, which is after it counted the flush as
+ * submitted.
+ */
+struct etna_cmd_stream_async {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int pending, stop;
+	uint32_t queued, submitted;
+
+	uint32_t *buffer;
+	uint32_t offset;
+	struct etna_cmd_stream_submit submit;
+	struct etna_bo **bos;
+	uint32_t nr_bos, max_bos;
+};
+
 struct etna_cmd_stream_priv {
 	struct etna_cmd_stream base;
 	struct etna_pipe *pipe;
 
 	uint32_t last_timestamp;
 
-	/* submit ioctl related tables: */
-	struct {
-		/* bo's table: */
-		struct drm_etnaviv_gem_submit_bo *bos;
-		uint32_t nr_bos, max_bos;
-
-		/* reloc's table: */
-		struct drm_etnaviv_gem_submit_reloc *relocs;
-		uint32_t nr_relocs, max_relocs;
-
-		/* perf's table: */
-		struct drm_etnaviv_gem_submit_pmr *pmrs;
-		uint32_t nr_pmrs, max_pmrs;
-	} submit;
+	struct etna_cmd_stream_submit submit;
 
 	/* should have matching entries in submit.bos: */
 	struct etna_bo **bos;
 	uint32_t nr_bos, max_bos;
 
+	/* changes on every flush, to invalidate the idx cached in the bo's: */
+	int seqno;
+
+	/* open-addressed hash of bos, by handle, storing idx + 1: */
+	uint32_t *bo_table;
+	uint32_t bo_table_size;
+
 	/* notify callback if buffer reset happened */
 	void (*reset_notify)(struct etna_cmd_stream *stream, void *priv);
 	void *reset_notify_priv;
+
+	/* NULL unless etna_cmd_stream_enable_async() was called: */
+	struct etna_cmd_stream_async *async;
+
+	/* sampled on every flush: */
+	struct etna_perfmon_session *perf_session;
 };
 
 struct etna_perfmon {
@@ -176,6 +211,30 @@ struct etna_perfmon_signal
 	char name[64];
 };
 
+/* Every submit of the stream a session is attached to samples its signals
+ * into the next result bo of the ring, which holds the sequence number
+ * the kernel writes after the POST samples, then the PRE samples, then the
+ * POST samples.  head and tail count the samples taken and read.
+ */
+struct etna_perfmon_session
+{
+	struct etna_perfmon_signal **signals;
+	uint32_t nr_signals;
+
+	struct etna_bo **bos;
+	uint32_t depth;
+
+	uint32_t head, tail;
+	/* samples whose submit ioctl was issued, bumped by the submit thread
+	 * of async streams:
+	 */
+	atomic_t submitted;
+	uint32_t lost;
+};
+
+drm_private void etna_perfmon_session_sample(struct etna_perfmon_session *session,
+		struct etna_cmd_stream *stream);
+
 #define ALIGN(v,a) (((v) + (a) - 1) & ~((a) - 1))
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
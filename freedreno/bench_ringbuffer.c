@@ -0,0 +1,952 @@
+/*
+ * Copyright (C) 2012 Rob Clark <robclark@freedesktop.org>
+ * Copyright (C) 2013 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmarks for the msm ringbuffer, run against a mock msm ioctl backend so
+ * that they measure libdrm_freedreno and not the kernel.
+ *
+ * The device fd is an unlinked temporary file, so that BOs can be mapped
+ * through it like through a real device, while ioctl() is replaced for the
+ * whole process to answer the msm ioctls issued on it.  It has to be
+ * exported for libdrm.so to bind to it, hence drm_public.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "xf86atomic.h"
+#include "freedreno_drmif.h"
+#include "freedreno_ringbuffer.h"
+#include "msm_drm.h"
+
+#define MOCK_GPU_ID	530
+#define MOCK_FILE_SIZE	(1 << 30)
+#define MOCK_MAX_HANDLES	(1 << 16)
+#define MOCK_MAX_QUEUES	16
+#define MOCK_RELOC_TABLES	4096
+
+/* emitted right before a reloc, with the handle of its BO in the low bits */
+#define MOCK_RELOC_TAG	0xbe110000
+
+static int mock_fd = -1;
+static const uint8_t *mock_map;
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t mock_handle;
+static uint64_t mock_offset;
+static uint64_t mock_offsets[MOCK_MAX_HANDLES];
+static atomic_t mock_fence = { 0 };
+static atomic_t mock_submit_bos = { 0 };
+static atomic_t mock_queue = { 0 };
+static uint32_t mock_retired[MOCK_MAX_QUEUES];
+static atomic_t mock_waits = { 0 };
+static atomic_t mock_cpu_preps = { 0 };
+static atomic_t mock_relocs_checked = { 0 };
+
+/*
+ * The last reloc's table handed in for each stateobj cmd.  If the next
+ * submit hands in the same table with the same contents, libdrm kept it
+ * from the previous submit rather than rebuilding it.
+ */
+static struct {
+	uint32_t handle, offset;
+	const void *relocs;
+	uint32_t nr_relocs, hash;
+} mock_reloc_tables[MOCK_RELOC_TABLES];
+static atomic_t mock_stateobj_relocs = { 0 };
+static atomic_t mock_stateobj_relocs_kept = { 0 };
+
+static int
+mock_gem_new(struct drm_msm_gem_new *req)
+{
+	uint64_t size = (req->size + 4095) & ~4095ull;
+
+	pthread_mutex_lock(&mock_lock);
+	if (mock_handle + 1 == MOCK_MAX_HANDLES ||
+	    mock_offset + size > MOCK_FILE_SIZE) {
+		pthread_mutex_unlock(&mock_lock);
+		errno = ENOMEM;
+		return -1;
+	}
+	req->handle = ++mock_handle;
+	mock_offsets[req->handle] = mock_offset;
+	mock_offset += size;
+	pthread_mutex_unlock(&mock_lock);
+
+	return 0;
+}
+
+static uint32_t
+mock_hash(const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	uint32_t hash = 2166136261u;
+
+	while (size--)
+		hash = (hash ^ *p++) * 16777619u;
+
+	return hash;
+}
+
+static void
+mock_track_relocs(struct drm_msm_gem_submit_cmd *cmd, uint32_t handle)
+{
+	const void *relocs = (void *)(uintptr_t)cmd->relocs;
+	uint32_t hash = mock_hash(relocs, cmd->nr_relocs *
+				  sizeof(struct drm_msm_gem_submit_reloc));
+	uint32_t slot = (handle * 2654435761u ^ cmd->submit_offset) %
+			MOCK_RELOC_TABLES;
+
+	atomic_inc(&mock_stateobj_relocs);
+
+	pthread_mutex_lock(&mock_lock);
+	if (mock_reloc_tables[slot].handle == handle &&
+	    mock_reloc_tables[slot].offset == cmd->submit_offset &&
+	    mock_reloc_tables[slot].relocs == relocs &&
+	    mock_reloc_tables[slot].nr_relocs == cmd->nr_relocs &&
+	    mock_reloc_tables[slot].hash == hash) {
+		atomic_inc(&mock_stateobj_relocs_kept);
+	} else {
+		mock_reloc_tables[slot].handle = handle;
+		mock_reloc_tables[slot].offset = cmd->submit_offset;
+		mock_reloc_tables[slot].relocs = relocs;
+		mock_reloc_tables[slot].nr_relocs = cmd->nr_relocs;
+		mock_reloc_tables[slot].hash = hash;
+	}
+	pthread_mutex_unlock(&mock_lock);
+}
+
+/*
+ * Checks what a kernel would reject: out of range or duplicate BOs, and
+ * that every reloc preceded by a MOCK_RELOC_TAG points at the BO whose
+ * handle is in the tag.
+ */
+static int
+mock_gem_submit(struct drm_msm_gem_submit *req)
+{
+	struct drm_msm_gem_submit_bo *bos = (void *)(uintptr_t)req->bos;
+	struct drm_msm_gem_submit_cmd *cmds = (void *)(uintptr_t)req->cmds;
+	uint8_t seen[MOCK_MAX_HANDLES / 8] = { 0 };
+	uint32_t i, j;
+
+	for (i = 0; i < req->nr_bos; i++) {
+		uint32_t handle = bos[i].handle;
+
+		if (!handle || handle >= MOCK_MAX_HANDLES ||
+		    seen[handle / 8] & (1 << handle % 8))
+			errx(1, "bad BO %u in submit", handle);
+		seen[handle / 8] |= 1 << handle % 8;
+	}
+
+	for (i = 0; i < req->nr_cmds; i++) {
+		struct drm_msm_gem_submit_reloc *relocs =
+			(void *)(uintptr_t)cmds[i].relocs;
+
+		const uint32_t *stream;
+
+		if (cmds[i].submit_idx >= req->nr_bos)
+			errx(1, "bad cmd BO index %u", cmds[i].submit_idx);
+		stream = (const uint32_t *)(mock_map +
+			mock_offsets[bos[cmds[i].submit_idx].handle]);
+
+		for (j = 0; j < cmds[i].nr_relocs; j++) {
+			uint32_t offset = relocs[j].submit_offset / 4;
+			uint32_t handle;
+
+			if (relocs[j].reloc_idx >= req->nr_bos)
+				errx(1, "bad reloc BO index %u",
+				     relocs[j].reloc_idx);
+
+			/* the high half of a 64b reloc follows the low one */
+			if (relocs[j].shift < 0 || offset == 0 ||
+			    (stream[offset - 1] & 0xffff0000) != MOCK_RELOC_TAG)
+				continue;
+
+			handle = stream[offset - 1] & 0xffff;
+			if (bos[relocs[j].reloc_idx].handle != handle)
+				errx(1, "reloc to BO %u resolved to BO %u", handle,
+				     bos[relocs[j].reloc_idx].handle);
+			atomic_inc(&mock_relocs_checked);
+		}
+
+		if (cmds[i].type == MSM_SUBMIT_CMD_IB_TARGET_BUF &&
+		    cmds[i].nr_relocs)
+			mock_track_relocs(&cmds[i],
+					  bos[cmds[i].submit_idx].handle);
+	}
+
+	atomic_add(&mock_submit_bos, req->nr_bos);
+	req->fence = atomic_inc_return(&mock_fence);
+	return 0;
+}
+
+/*
+ * The GPU only makes progress when waited on: a wait that can block retires
+ * everything up to its fence, one that times out immediately polls.
+ */
+static int
+mock_wait_fence(struct drm_msm_wait_fence *req)
+{
+	struct timespec now;
+	int ret = 0;
+
+	if (req->queueid >= MOCK_MAX_QUEUES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	atomic_inc(&mock_waits);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&mock_lock);
+	if ((int32_t)(req->fence - mock_retired[req->queueid]) > 0) {
+		if (req->timeout.tv_sec * 1000000000ll + req->timeout.tv_nsec >
+		    now.tv_sec * 1000000000ll + now.tv_nsec) {
+			mock_retired[req->queueid] = req->fence;
+		} else {
+			errno = ETIMEDOUT;
+			ret = -1;
+		}
+	}
+	pthread_mutex_unlock(&mock_lock);
+
+	return ret;
+}
+
+/* whether the mock GPU retired @fence, on whichever queue it was on: */
+static bool
+mock_fence_retired(uint32_t fence)
+{
+	bool retired = false;
+	int i;
+
+	pthread_mutex_lock(&mock_lock);
+	for (i = 0; i < MOCK_MAX_QUEUES; i++)
+		retired |= (int32_t)(fence - mock_retired[i]) <= 0;
+	pthread_mutex_unlock(&mock_lock);
+
+	return retired;
+}
+
+drm_public int
+ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd != mock_fd) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	switch (request) {
+	case DRM_IOCTL_VERSION: {
+		drm_version_t *version = arg;
+
+		version->version_major = 1;
+		version->version_minor = 3;
+		version->version_patchlevel = 0;
+		version->name_len = 3;
+		version->date_len = 1;
+		version->desc_len = 3;
+		if (version->name)
+			memcpy(version->name, "msm", 3);
+		if (version->date)
+			memcpy(version->date, "0", 1);
+		if (version->desc)
+			memcpy(version->desc, "msm", 3);
+		return 0;
+	}
+	case DRM_IOCTL_MSM_GET_PARAM: {
+		struct drm_msm_param *param = arg;
+
+		switch (param->param) {
+		case MSM_PARAM_GPU_ID:
+			param->value = MOCK_GPU_ID;
+			return 0;
+		case MSM_PARAM_GMEM_SIZE:
+			param->value = 1 << 20;
+			return 0;
+		case MSM_PARAM_CHIP_ID:
+			param->value = 0x05030000;
+			return 0;
+		case MSM_PARAM_NR_RINGS:
+			param->value = 1;
+			return 0;
+		default:
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	case DRM_IOCTL_MSM_GEM_NEW:
+		return mock_gem_new(arg);
+	case DRM_IOCTL_MSM_GEM_INFO: {
+		struct drm_msm_gem_info *info = arg;
+
+		if (!info->handle || info->handle >= MOCK_MAX_HANDLES) {
+			errno = EINVAL;
+			return -1;
+		}
+		pthread_mutex_lock(&mock_lock);
+		info->offset = mock_offsets[info->handle];
+		pthread_mutex_unlock(&mock_lock);
+		if (info->flags & MSM_INFO_IOVA)
+			info->offset += 0x100000000ull;
+		return 0;
+	}
+	case DRM_IOCTL_MSM_GEM_MADVISE: {
+		struct drm_msm_gem_madvise *madv = arg;
+
+		madv->retained = 1;
+		return 0;
+	}
+	case DRM_IOCTL_MSM_GEM_SUBMIT:
+		return mock_gem_submit(arg);
+	case DRM_IOCTL_MSM_SUBMITQUEUE_NEW: {
+		struct drm_msm_submitqueue *queue = arg;
+
+		queue->id = atomic_inc_return(&mock_queue) % MOCK_MAX_QUEUES;
+		return 0;
+	}
+	case DRM_IOCTL_MSM_WAIT_FENCE:
+		return mock_wait_fence(arg);
+	case DRM_IOCTL_MSM_GEM_CPU_PREP:
+		atomic_inc(&mock_cpu_preps);
+		return 0;
+	case DRM_IOCTL_MSM_GEM_CPU_FINI:
+	case DRM_IOCTL_MSM_SUBMITQUEUE_CLOSE:
+	case DRM_IOCTL_GEM_CLOSE:
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static struct fd_device *
+create_device(void)
+{
+	struct fd_device *dev;
+	FILE *file;
+
+	file = tmpfile();
+	if (!file || ftruncate(fileno(file), MOCK_FILE_SIZE))
+		err(1, "failed to create the mock device");
+	mock_fd = fileno(file);
+	mock_map = mmap(NULL, MOCK_FILE_SIZE, PROT_READ, MAP_SHARED, mock_fd, 0);
+	if (mock_map == MAP_FAILED)
+		err(1, "failed to map the mock device");
+
+	dev = fd_device_new(mock_fd);
+	if (!dev)
+		errx(1, "failed to create the msm device");
+
+	return dev;
+}
+
+/* emits a reloc to @bo, tagged for mock_gem_submit() to check */
+static void
+emit_tagged_reloc(struct fd_ringbuffer *ring, struct fd_bo *bo)
+{
+	fd_ringbuffer_emit(ring, MOCK_RELOC_TAG | fd_bo_handle(bo));
+	fd_ringbuffer_reloc2(ring, &(struct fd_reloc){
+		.bo = bo,
+		.flags = FD_RELOC_READ,
+	});
+}
+
+/*
+ * reloc-emit: every thread builds and flushes rings on its own pipe, each
+ * with @relocs relocations to a mix of BOs private to the thread and BOs
+ * shared by all of them, as happens with several contexts sampling the same
+ * textures.
+ */
+#define RELOC_EMIT_BOS		64
+
+struct reloc_emit_thread {
+	pthread_t thread;
+	struct fd_device *dev;
+	struct fd_bo **shared;
+	int submits, relocs;
+};
+
+static void *
+reloc_emit_thread(void *data)
+{
+	struct reloc_emit_thread *t = data;
+	struct fd_bo *bos[RELOC_EMIT_BOS];
+	struct fd_ringbuffer *ring;
+	struct fd_pipe *pipe;
+	int i, j;
+
+	pipe = fd_pipe_new(t->dev, FD_PIPE_3D);
+	if (!pipe)
+		errx(1, "failed to create pipe");
+	for (i = 0; i < RELOC_EMIT_BOS; i++) {
+		bos[i] = fd_bo_new(t->dev, 4096, 0);
+		if (!bos[i])
+			errx(1, "allocation failed");
+	}
+
+	for (i = 0; i < t->submits; i++) {
+		ring = fd_ringbuffer_new(pipe, t->relocs * 3 * 4);
+		if (!ring)
+			errx(1, "failed to create ringbuffer");
+		for (j = 0; j < t->relocs; j++) {
+			struct fd_bo *bo = j % 2 ? t->shared[j / 2 % RELOC_EMIT_BOS]
+						 : bos[j / 2 % RELOC_EMIT_BOS];
+
+			emit_tagged_reloc(ring, bo);
+		}
+		if (fd_ringbuffer_flush(ring))
+			errx(1, "submit failed");
+		fd_ringbuffer_del(ring);
+	}
+
+	for (i = 0; i < RELOC_EMIT_BOS; i++)
+		fd_bo_del(bos[i]);
+	fd_pipe_del(pipe);
+
+	return NULL;
+}
+
+static void
+bench_reloc_emit(int num_threads, int submits, int relocs)
+{
+	struct reloc_emit_thread *threads;
+	struct fd_bo *shared[RELOC_EMIT_BOS];
+	struct fd_device *dev = create_device();
+	double start, elapsed;
+	long ops, checked;
+	int i;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads)
+		errx(1, "out of memory");
+	for (i = 0; i < RELOC_EMIT_BOS; i++) {
+		shared[i] = fd_bo_new(dev, 4096, 0);
+		if (!shared[i])
+			errx(1, "allocation failed");
+	}
+
+	checked = atomic_read(&mock_relocs_checked);
+	start = get_time();
+	for (i = 0; i < num_threads; i++) {
+		threads[i].dev = dev;
+		threads[i].shared = shared;
+		threads[i].submits = submits;
+		threads[i].relocs = relocs;
+		if (pthread_create(&threads[i].thread, NULL, reloc_emit_thread,
+				   &threads[i]))
+			errx(1, "failed to create thread");
+	}
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	elapsed = get_time() - start;
+
+	ops = (long)num_threads * submits * relocs;
+	checked = atomic_read(&mock_relocs_checked) - checked;
+	if (checked != ops)
+		errx(1, "%ld of %ld relocs checked", checked, ops);
+	printf("reloc-emit: %d threads, %ld relocs in %.3fs: %.2f Mrelocs/s\n",
+	       num_threads, ops, elapsed, ops / elapsed / 1e6);
+
+	for (i = 0; i < RELOC_EMIT_BOS; i++)
+		fd_bo_del(shared[i]);
+	fd_device_del(dev);
+	free(threads);
+}
+
+/*
+ * stateobj: a pool of small CSO stateobjs, each pointing at a few textures,
+ * of which every submit references the same @per_submit, and replaces a
+ * few, as happens when a driver draws the same frame again with a handful of
+ * new states.
+ *
+ * stateobj-shared: @threads threads, each with its own pipe, make @submits
+ * submits of the same @per_submit stateobjs out of a pool shared by all of
+ * them, as happens with several contexts sharing CSOs.
+ */
+#define STATEOBJ_POOL		256
+#define STATEOBJ_REPLACED	8
+#define STATEOBJ_TEXTURES	16
+#define STATEOBJ_RELOCS		4
+
+static struct fd_ringbuffer *
+stateobj_new(struct fd_pipe *pipe, struct fd_bo **textures, int i)
+{
+	uint32_t size = (i % 8 + 2) * 32;
+	struct fd_ringbuffer *ring;
+	int j;
+
+	ring = fd_ringbuffer_new_flags(pipe, size, FD_RINGBUFFER_OBJECT);
+	if (!ring)
+		errx(1, "failed to create stateobj");
+	for (j = 0; j < STATEOBJ_RELOCS; j++)
+		emit_tagged_reloc(ring, textures[(i + j * 5) % STATEOBJ_TEXTURES]);
+	while (ring->cur < ring->end)
+		fd_ringbuffer_emit(ring, i);
+
+	return ring;
+}
+
+static void
+stateobj_submit(struct fd_pipe *pipe, struct fd_ringbuffer **pool,
+		int per_submit)
+{
+	struct fd_ringbuffer *ring;
+	int i;
+
+	ring = fd_ringbuffer_new(pipe, per_submit * 2 * 4);
+	if (!ring)
+		errx(1, "failed to create ringbuffer");
+	for (i = 0; i < per_submit; i++) {
+		fd_ringbuffer_emit_reloc_ring_full(ring,
+			pool[i * 13 % STATEOBJ_POOL], 0);
+	}
+	if (fd_ringbuffer_flush(ring))
+		errx(1, "submit failed");
+	fd_ringbuffer_del(ring);
+}
+
+static void
+stateobj_report(const char *name, long submits, int per_submit,
+		int checked, int tables, int kept)
+{
+	checked = atomic_read(&mock_relocs_checked) - checked;
+	tables = atomic_read(&mock_stateobj_relocs) - tables;
+	kept = atomic_read(&mock_stateobj_relocs_kept) - kept;
+
+	if (checked != submits * per_submit * STATEOBJ_RELOCS)
+		errx(1, "%d of %ld relocs checked", checked,
+		     submits * per_submit * STATEOBJ_RELOCS);
+	printf("%s: %d of %d reloc's tables kept from the previous submit "
+	       "(%.1f%%)\n", name, kept, tables, kept * 100.0 / tables);
+}
+
+static void
+bench_stateobj(int submits, int per_submit)
+{
+	struct fd_ringbuffer *pool[STATEOBJ_POOL];
+	struct fd_bo *textures[STATEOBJ_TEXTURES];
+	struct fd_device *dev = create_device();
+	struct fd_pipe *pipe;
+	int handles, bos, checked, tables, kept, i, j;
+	double start, elapsed;
+
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	if (!pipe)
+		errx(1, "failed to create pipe");
+
+	for (i = 0; i < STATEOBJ_TEXTURES; i++) {
+		textures[i] = fd_bo_new(dev, 4096, 0);
+		if (!textures[i])
+			errx(1, "allocation failed");
+	}
+
+	handles = mock_handle;
+	bos = atomic_read(&mock_submit_bos);
+	checked = atomic_read(&mock_relocs_checked);
+	tables = atomic_read(&mock_stateobj_relocs);
+	kept = atomic_read(&mock_stateobj_relocs_kept);
+	start = get_time();
+	for (i = 0; i < STATEOBJ_POOL; i++)
+		pool[i] = stateobj_new(pipe, textures, i);
+
+	for (i = 0; i < submits; i++) {
+		stateobj_submit(pipe, pool, per_submit);
+
+		for (j = 0; j < STATEOBJ_REPLACED; j++) {
+			int k = (i * STATEOBJ_REPLACED + j) % STATEOBJ_POOL;
+
+			fd_ringbuffer_del(pool[k]);
+			pool[k] = stateobj_new(pipe, textures, k);
+		}
+	}
+	elapsed = get_time() - start;
+	handles = mock_handle - handles;
+	bos = atomic_read(&mock_submit_bos) - bos;
+
+	printf("stateobj: %d submits of %d stateobjs in %.3fs: %.2f us/submit\n",
+	       submits, per_submit, elapsed, elapsed * 1e6 / submits);
+	printf("stateobj: %d GEM objects created, %.1f BOs per submit\n",
+	       handles, (double)bos / submits);
+	stateobj_report("stateobj", submits, per_submit, checked, tables, kept);
+
+	for (i = 0; i < STATEOBJ_POOL; i++)
+		fd_ringbuffer_del(pool[i]);
+	for (i = 0; i < STATEOBJ_TEXTURES; i++)
+		fd_bo_del(textures[i]);
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+}
+
+struct stateobj_thread {
+	pthread_t thread;
+	struct fd_device *dev;
+	struct fd_ringbuffer **pool;
+	int submits, per_submit;
+};
+
+static void *
+stateobj_thread(void *data)
+{
+	struct stateobj_thread *t = data;
+	struct fd_pipe *pipe;
+	int i;
+
+	pipe = fd_pipe_new(t->dev, FD_PIPE_3D);
+	if (!pipe)
+		errx(1, "failed to create pipe");
+	for (i = 0; i < t->submits; i++)
+		stateobj_submit(pipe, t->pool, t->per_submit);
+	fd_pipe_del(pipe);
+
+	return NULL;
+}
+
+static void
+bench_stateobj_shared(int num_threads, int submits, int per_submit)
+{
+	struct fd_ringbuffer *pool[STATEOBJ_POOL];
+	struct fd_bo *textures[STATEOBJ_TEXTURES];
+	struct stateobj_thread *threads;
+	struct fd_device *dev = create_device();
+	struct fd_pipe *pipe;
+	int checked, tables, kept, i;
+	double start, elapsed;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads)
+		errx(1, "out of memory");
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	if (!pipe)
+		errx(1, "failed to create pipe");
+
+	for (i = 0; i < STATEOBJ_TEXTURES; i++) {
+		textures[i] = fd_bo_new(dev, 4096, 0);
+		if (!textures[i])
+			errx(1, "allocation failed");
+	}
+	for (i = 0; i < STATEOBJ_POOL; i++)
+		pool[i] = stateobj_new(pipe, textures, i);
+
+	checked = atomic_read(&mock_relocs_checked);
+	tables = atomic_read(&mock_stateobj_relocs);
+	kept = atomic_read(&mock_stateobj_relocs_kept);
+	start = get_time();
+	for (i = 0; i < num_threads; i++) {
+		threads[i].dev = dev;
+		threads[i].pool = pool;
+		threads[i].submits = submits;
+		threads[i].per_submit = per_submit;
+		if (pthread_create(&threads[i].thread, NULL, stateobj_thread,
+				   &threads[i]))
+			errx(1, "failed to create thread");
+	}
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	elapsed = get_time() - start;
+
+	printf("stateobj-shared: %d threads, %d submits of %d stateobjs in "
+	       "%.3fs: %.2f us/submit\n", num_threads, submits, per_submit,
+	       elapsed, elapsed * 1e6 / ((double)num_threads * submits));
+	stateobj_report("stateobj-shared", (long)num_threads * submits,
+			per_submit, checked, tables, kept);
+
+	for (i = 0; i < STATEOBJ_POOL; i++)
+		fd_ringbuffer_del(pool[i]);
+	for (i = 0; i < STATEOBJ_TEXTURES; i++)
+		fd_bo_del(textures[i]);
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+	free(threads);
+}
+
+/*
+ * fence-wait: every frame makes @submits submits on each of a 3D and a
+ * compute pipe, then waits for all of their fences, either one at a time,
+ * or with a single fd_pipe_wait_fences(), for all or any of them.
+ *
+ * Fences start past 2^31, so that those of a fresh pipe are checked not to
+ * be taken for retired before any was waited for.
+ */
+#define FENCE_WAIT_PIPES	2
+
+static void
+bench_fence_wait(int frames, int submits)
+{
+	static const char *modes[] = { "each", "all", "any" };
+	struct fd_device *dev = create_device();
+	struct fd_pipe *pipes[FENCE_WAIT_PIPES];
+	struct fd_pipe_fence *fences;
+	int count = FENCE_WAIT_PIPES * submits;
+	double start, elapsed;
+	int mode, waits, i, j, k, n;
+
+	fences = calloc(count, sizeof(*fences));
+	if (!fences)
+		errx(1, "out of memory");
+	atomic_set(&mock_fence, 0x80000000);
+	for (i = 0; i < MOCK_MAX_QUEUES; i++)
+		mock_retired[i] = 0x80000000;
+	for (i = 0; i < FENCE_WAIT_PIPES; i++) {
+		pipes[i] = fd_pipe_new(dev, FD_PIPE_3D);
+		if (!pipes[i])
+			errx(1, "failed to create pipe");
+	}
+
+	for (mode = 0; mode < 3; mode++) {
+		waits = atomic_read(&mock_waits);
+		start = get_time();
+		for (i = 0; i < frames; i++) {
+			n = 0;
+			for (j = 0; j < FENCE_WAIT_PIPES; j++) {
+				for (k = 0; k < submits; k++) {
+					struct fd_ringbuffer *ring;
+
+					ring = fd_ringbuffer_new(pipes[j], 0x1000);
+					if (!ring)
+						errx(1, "failed to create ringbuffer");
+					fd_ringbuffer_emit(ring, 0);
+					if (fd_ringbuffer_flush(ring))
+						errx(1, "submit failed");
+					fences[n].pipe = pipes[j];
+					fences[n].timestamp = fd_ringbuffer_timestamp(ring);
+					n++;
+					fd_ringbuffer_del(ring);
+				}
+			}
+
+			if (mode == 0) {
+				for (j = 0; j < count; j++) {
+					if (fd_pipe_wait(fences[j].pipe,
+							 fences[j].timestamp))
+						errx(1, "wait failed");
+				}
+				continue;
+			}
+
+			if (fd_pipe_wait_fences(fences, count,
+						mode == 2 ? FD_WAIT_ANY : 0, ~0ull))
+				errx(1, "wait failed");
+			for (j = 0, n = 0; j < count; j++) {
+				if (fences[j].signaled &&
+				    !mock_fence_retired(fences[j].timestamp))
+					errx(1, "fence %u signaled before it retired",
+					     fences[j].timestamp);
+				n += fences[j].signaled;
+			}
+			if (n == 0 || (mode == 1 && n != count))
+				errx(1, "%d of %d fences signaled", n, count);
+		}
+		elapsed = get_time() - start;
+		waits = atomic_read(&mock_waits) - waits;
+
+		printf("fence-wait-%s: %d frames of %d fences in %.3fs: "
+		       "%.2f us/frame, %.1f wait ioctls per frame\n",
+		       modes[mode], frames, count, elapsed,
+		       elapsed * 1e6 / frames, (double)waits / frames);
+	}
+
+	for (i = 0; i < FENCE_WAIT_PIPES; i++)
+		fd_pipe_del(pipes[i]);
+	fd_device_del(dev);
+	free(fences);
+}
+
+/*
+ * ring-pool: every frame fills @streaming streaming stateobjs, which share
+ * 32k ring BOs, emits them in a ring and flushes it, then waits for the
+ * frame submitted @inflight frames earlier.  Run without the pipe's ring
+ * pool, leaving ring BOs to the ring cache, then with pools of a few
+ * depths.  Then rings of more sizes than the pool has buckets for are each
+ * allocated twice, and the second one must come from the pool.
+ */
+#define RING_POOL_STREAMING_SIZE	0x800
+#define RING_POOL_RING_SIZES		16
+
+static void
+bench_ring_pool(int frames, int streaming, int inflight)
+{
+	static const uint32_t depths[] = { 0, 4, 16 };
+	struct fd_device *dev = create_device();
+	uint32_t *fences;
+	int d, i, j;
+
+	fences = calloc(inflight, sizeof(*fences));
+	if (!fences)
+		errx(1, "out of memory");
+
+	for (d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); d++) {
+		struct fd_ring_pool_stats stats;
+		int handles, waits, preps;
+		struct fd_pipe *pipe;
+		double start, elapsed;
+
+		pipe = fd_pipe_new(dev, FD_PIPE_3D);
+		if (!pipe)
+			errx(1, "failed to create pipe");
+		fd_pipe_set_ring_pool_depth(pipe, depths[d]);
+
+		handles = mock_handle;
+		waits = atomic_read(&mock_waits);
+		preps = atomic_read(&mock_cpu_preps);
+		start = get_time();
+		for (i = 0; i < frames; i++) {
+			struct fd_ringbuffer *ring;
+
+			ring = fd_ringbuffer_new(pipe, 0x1000);
+			if (!ring)
+				errx(1, "failed to create ringbuffer");
+			for (j = 0; j < streaming; j++) {
+				struct fd_ringbuffer *obj;
+
+				obj = fd_ringbuffer_new_flags(pipe,
+					RING_POOL_STREAMING_SIZE,
+					FD_RINGBUFFER_OBJECT |
+					FD_RINGBUFFER_STREAMING);
+				if (!obj)
+					errx(1, "failed to create stateobj");
+				while (obj->cur < obj->end)
+					fd_ringbuffer_emit(obj, j);
+				fd_ringbuffer_emit_reloc_ring_full(ring, obj, 0);
+				fd_ringbuffer_del(obj);
+			}
+			if (fd_ringbuffer_flush(ring))
+				errx(1, "submit failed");
+			fences[i % inflight] = fd_ringbuffer_timestamp(ring);
+			fd_ringbuffer_del(ring);
+
+			if (i + 1 >= inflight &&
+			    fd_pipe_wait(pipe, fences[(i + 1) % inflight]))
+				errx(1, "wait failed");
+		}
+		elapsed = get_time() - start;
+		handles = mock_handle - handles;
+		waits = atomic_read(&mock_waits) - waits;
+		preps = atomic_read(&mock_cpu_preps) - preps;
+		fd_pipe_get_ring_pool_stats(pipe, &stats);
+
+		printf("ring-pool-%u: %d frames of %d streaming stateobjs in "
+		       "%.3fs: %.2f us/frame\n", depths[d], frames, streaming,
+		       elapsed, elapsed * 1e6 / frames);
+		printf("ring-pool-%u: %d GEM objects created, %.2f cpu-prep and "
+		       "%.2f wait ioctls per frame\n", depths[d], handles,
+		       (double)preps / frames, (double)waits / frames);
+		printf("ring-pool-%u: %" PRIu64 " allocs, %" PRIu64 " reused, "
+		       "%" PRIu64 " stalls, %" PRIu64 " released\n", depths[d],
+		       stats.allocs, stats.reused, stats.stalls, stats.released);
+
+		for (j = 0; depths[d] && j < RING_POOL_RING_SIZES; j++) {
+			uint64_t reused = stats.reused;
+
+			for (i = 0; i < 2; i++) {
+				struct fd_ringbuffer *ring;
+
+				ring = fd_ringbuffer_new(pipe, (j + 16) * 0x1000);
+				if (!ring)
+					errx(1, "failed to create ringbuffer");
+				fd_ringbuffer_del(ring);
+			}
+			fd_pipe_get_ring_pool_stats(pipe, &stats);
+			if (stats.reused != reused + 1)
+				errx(1, "ring of size 0x%x not reused",
+				     (j + 16) * 0x1000);
+		}
+
+		fd_pipe_del(pipe);
+	}
+
+	fd_device_del(dev);
+	free(fences);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage:\n");
+	fprintf(stderr, "  bench_ringbuffer reloc-emit [threads] [submits] [relocs]\n");
+	fprintf(stderr, "  bench_ringbuffer stateobj [submits] [stateobjs per submit]\n");
+	fprintf(stderr, "  bench_ringbuffer stateobj-shared [threads] [submits] [stateobjs per submit]\n");
+	fprintf(stderr, "  bench_ringbuffer fence-wait [frames] [submits per pipe]\n");
+	fprintf(stderr, "  bench_ringbuffer ring-pool [frames] [streaming stateobjs per frame] [frames in flight]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *name = argc > 1 ? argv[1] : "reloc-emit";
+
+	if (strcmp(name, "reloc-emit") == 0) {
+		bench_reloc_emit(argc > 2 ? atoi(argv[2]) : 4,
+				 argc > 3 ? atoi(argv[3]) : 2000,
+				 argc > 4 ? atoi(argv[4]) : 512);
+	} else if (strcmp(name, "stateobj") == 0) {
+		bench_stateobj(argc > 2 ? atoi(argv[2]) : 2000,
+			       argc > 3 ? atoi(argv[3]) : 64);
+	} else if (strcmp(name, "stateobj-shared") == 0) {
+		bench_stateobj_shared(argc > 2 ? atoi(argv[2]) : 4,
+				      argc > 3 ? atoi(argv[3]) : 2000,
+				      argc > 4 ? atoi(argv[4]) : 64);
+	} else if (strcmp(name, "fence-wait") == 0) {
+		bench_fence_wait(argc > 2 ? atoi(argv[2]) : 10000,
+				 argc > 3 ? atoi(argv[3]) : 4);
+	} else if (strcmp(name, "ring-pool") == 0) {
+		bench_ring_pool(argc > 2 ? atoi(argv[2]) : 10000,
+				argc > 3 ? atoi(argv[3]) : 64,
+				argc > 4 ? atoi(argv[4]) : 3);
+	} else {
+		usage();
+	}
+
+	return 0;
+}
@@ -49,7 +49,7 @@ static struct fd_bo * lookup_bo(void *tbl, uint32_t key)
 		bo = fd_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		util_bo_cache_remove(&bo->cache_entry);
 	}
 	return bo;
 }
@@ -72,7 +72,6 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 	bo->size = size;
 	bo->handle = handle;
 	atomic_set(&bo->refcnt, 1);
-	list_inithead(&bo->list);
 	/* add ourself into the handle table: */
 	drmHashInsert(dev->handle_table, handle, bo);
 	return bo;
@@ -80,15 +79,17 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 
 static struct fd_bo *
 bo_new(struct fd_device *dev, uint32_t size, uint32_t flags,
-		struct fd_bo_cache *cache)
+		struct util_bo_cache *cache)
 {
 	struct fd_bo *bo = NULL;
 	uint32_t handle;
 	int ret;
 
-	bo = fd_bo_cache_alloc(cache, &size, flags);
-	if (bo)
-		return bo;
+	if (cache) {
+		bo = fd_bo_cache_alloc(cache, &size, flags);
+		if (bo)
+			return bo;
+	}
 
 	ret = dev->funcs->bo_new_handle(dev, size, flags, &handle);
 	if (ret)
@@ -118,10 +119,27 @@ fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
  * to re-use cmdstream bo's for cmdstream and not unrelated purposes.
  */
 drm_private struct fd_bo *
-fd_bo_new_ring(struct fd_device *dev, uint32_t size, uint32_t flags)
+fd_bo_new_ring(struct fd_pipe *pipe, uint32_t size, uint32_t flags)
 {
-	struct fd_bo *bo = bo_new(dev, size, flags, &dev->ring_cache);
+	struct fd_device *dev = pipe->dev;
+	struct fd_bo *bo;
+	int pooled;
+
+	/* preferably from the pipe's own pool, which knows which of its bo's
+	 * the GPU is done with from the fences they were submitted with:
+	 */
+	size = ALIGN(size, 4096);
+	bo = fd_ring_pool_get(pipe, size, &pooled);
 	if (bo)
+		return bo;
+
+	bo = bo_new(dev, size, flags, pooled ? NULL : &dev->ring_cache);
+	if (!bo)
+		return NULL;
+
+	if (pooled)
+		fd_ring_pool_add(pipe, bo);
+	else
 		bo->bo_reuse = RING_CACHE;
 	return bo;
 }
@@ -241,6 +259,8 @@ drm_public void fd_bo_del(struct fd_bo *bo)
 
 	if ((bo->bo_reuse == BO_CACHE) && (fd_bo_cache_free(&dev->bo_cache, bo) == 0))
 		goto out;
+	if ((bo->bo_reuse == RING_POOL) && (fd_ring_pool_put(bo) == 0))
+		goto out;
 	if ((bo->bo_reuse == RING_CACHE) && (fd_bo_cache_free(&dev->ring_cache, bo) == 0))
 		goto out;
 
@@ -343,12 +363,17 @@ drm_public void * fd_bo_map(struct fd_bo *bo)
 			bo->map = NULL;
 		}
 	}
+	/* the caller may be about to write through the mapping: */
+	if (bo->dev->capture)
+		bo->capture_gen = util_capture_next_generation(bo->dev->capture);
 	return bo->map;
 }
 
 /* a bit odd to take the pipe as an arg, but it's a, umm, quirk of kgsl.. */
 drm_public int fd_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op)
 {
+	if (bo->dev->capture && (op & DRM_FREEDRENO_PREP_WRITE))
+		bo->capture_gen = util_capture_next_generation(bo->dev->capture);
 	return bo->funcs->cpu_prep(bo, pipe, op);
 }
 
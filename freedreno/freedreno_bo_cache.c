@@ -32,189 +32,115 @@
 drm_private void bo_del(struct fd_bo *bo);
 drm_private extern pthread_mutex_t table_lock;
 
-static void
-add_bucket(struct fd_bo_cache *cache, int size)
+static inline struct fd_bo * to_fd_bo(struct util_bo_cache_entry *entry)
 {
-	unsigned int i = cache->num_buckets;
-
-	assert(i < ARRAY_SIZE(cache->cache_bucket));
-
-	list_inithead(&cache->cache_bucket[i].list);
-	cache->cache_bucket[i].size = size;
-	cache->num_buckets++;
+	return (struct fd_bo *)((char *)entry - offsetof(struct fd_bo, cache_entry));
 }
 
-/**
- * @coarse: if true, only power-of-two bucket sizes, otherwise
- *    fill in for a bit smoother size curve..
- */
-drm_private void
-fd_bo_cache_init(struct fd_bo_cache *cache, int coarse)
+static bool cache_is_idle(struct util_bo_cache_entry *entry)
 {
-	unsigned long size, cache_max_size = 64 * 1024 * 1024;
-
-	/* OK, so power of two buckets was too wasteful of memory.
-	 * Give 3 other sizes between each power of two, to hopefully
-	 * cover things accurately enough.  (The alternative is
-	 * probably to just go for exact matching of sizes, and assume
-	 * that for things like composited window resize the tiled
-	 * width/height alignment and rounding of sizes to pages will
-	 * get us useful cache hit rates anyway)
-	 */
-	add_bucket(cache, 4096);
-	add_bucket(cache, 4096 * 2);
-	if (!coarse)
-		add_bucket(cache, 4096 * 3);
-
-	/* Initialize the linked lists for BO reuse cache. */
-	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
-		add_bucket(cache, size);
-		if (!coarse) {
-			add_bucket(cache, size + size * 1 / 4);
-			add_bucket(cache, size + size * 2 / 4);
-			add_bucket(cache, size + size * 3 / 4);
-		}
-	}
+	return fd_bo_cpu_prep(to_fd_bo(entry), NULL,
+			DRM_FREEDRENO_PREP_READ |
+			DRM_FREEDRENO_PREP_WRITE |
+			DRM_FREEDRENO_PREP_NOSYNC) == 0;
 }
 
-/* Frees older cached buffers.  Called under table_lock */
-drm_private void
-fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
+static bool cache_madvise(struct util_bo_cache_entry *entry, bool willneed)
 {
-	int i;
-
-	if (cache->time == time)
-		return;
+	struct fd_bo *bo = to_fd_bo(entry);
 
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		struct fd_bo *bo;
-
-		while (!LIST_IS_EMPTY(&bucket->list)) {
-			bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
-
-			/* keep things in cache for at least 1 second: */
-			if (time && ((time - bo->free_time) <= 1))
-				break;
-
-			VG_BO_OBTAIN(bo);
-			list_del(&bo->list);
-			bo_del(bo);
-		}
+	/* kgsl, and msm on older kernels, can't tell us if the pages of a
+	 * purgeable bo are still around, so only trust the WILLNEED answer:
+	 */
+	if (!willneed) {
+		bo->funcs->madvise(bo, FALSE);
+		return true;
 	}
 
-	cache->time = time;
+	return bo->funcs->madvise(bo, TRUE) > 0;
 }
 
-static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
+/* Called under table_lock */
+static void cache_evict(struct util_bo_cache_entry *entry)
 {
-	int i;
+	struct fd_bo *bo = to_fd_bo(entry);
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
-	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
-	}
-
-	return NULL;
+	VG_BO_OBTAIN(bo);
+	bo_del(bo);
 }
 
-static int is_idle(struct fd_bo *bo)
+static const struct util_bo_cache_funcs cache_funcs = {
+	.is_idle = cache_is_idle,
+	.madvise = cache_madvise,
+	.evict = cache_evict,
+};
+
+/**
+ * @coarse: if true, only power-of-two bucket sizes, otherwise
+ *    fill in for a bit smoother size curve..
+ */
+drm_private void
+fd_bo_cache_init(struct util_bo_cache *cache, int coarse)
 {
-	return fd_bo_cpu_prep(bo, NULL,
-			DRM_FREEDRENO_PREP_READ |
-			DRM_FREEDRENO_PREP_WRITE |
-			DRM_FREEDRENO_PREP_NOSYNC) == 0;
+	util_bo_cache_init(cache, coarse, &cache_funcs);
 }
 
-static struct fd_bo *find_in_bucket(struct fd_bo_bucket *bucket, uint32_t flags)
+/* NOTE: size is potentially rounded up to bucket size: */
+drm_private struct fd_bo *
+fd_bo_cache_alloc(struct util_bo_cache *cache, uint32_t *size, uint32_t flags)
 {
-	struct fd_bo *bo = NULL;
+	struct util_bo_cache_entry *entry;
+	unsigned long bucket_size;
+	struct fd_bo *bo;
+
+	*size = ALIGN(*size, 4096);
+	bucket_size = util_bo_cache_bucket_size(cache, *size);
+	if (!bucket_size)
+		return NULL;
+	*size = bucket_size;
 
 	/* TODO .. if we had an ALLOC_FOR_RENDER flag like intel, we could
 	 * skip the busy check.. if it is only going to be a render target
-	 * then we probably don't need to stall..
+	 * then we probably don't need to stall, and could take the MRU bo
+	 * which is likely still in the GPU cache..
 	 *
-	 * NOTE that intel takes ALLOC_FOR_RENDER bo's from the list tail
-	 * (MRU, since likely to be in GPU cache), rather than head (LRU)..
+	 * TODO check for compatible flags?
 	 */
 	pthread_mutex_lock(&table_lock);
-	if (!LIST_IS_EMPTY(&bucket->list)) {
-		bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
-		/* TODO check for compatible flags? */
-		if (is_idle(bo)) {
-			list_del(&bo->list);
-		} else {
-			bo = NULL;
-		}
-	}
+	entry = util_bo_cache_get(cache, *size, 0, false);
 	pthread_mutex_unlock(&table_lock);
 
-	return bo;
-}
-
-/* NOTE: size is potentially rounded up to bucket size: */
-drm_private struct fd_bo *
-fd_bo_cache_alloc(struct fd_bo_cache *cache, uint32_t *size, uint32_t flags)
-{
-	struct fd_bo *bo = NULL;
-	struct fd_bo_bucket *bucket;
-
-	*size = ALIGN(*size, 4096);
-	bucket = get_bucket(cache, *size);
-
-	/* see if we can be green and recycle: */
-retry:
-	if (bucket) {
-		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
-		if (bo) {
-			VG_BO_OBTAIN(bo);
-			if (bo->funcs->madvise(bo, TRUE) <= 0) {
-				/* we've lost the backing pages, delete and try again: */
-				pthread_mutex_lock(&table_lock);
-				bo_del(bo);
-				pthread_mutex_unlock(&table_lock);
-				goto retry;
-			}
-			atomic_set(&bo->refcnt, 1);
-			fd_device_ref(bo->dev);
-			return bo;
-		}
-	}
+	if (!entry)
+		return NULL;
 
-	return NULL;
+	bo = to_fd_bo(entry);
+	VG_BO_OBTAIN(bo);
+	atomic_set(&bo->refcnt, 1);
+	fd_device_ref(bo->dev);
+	return bo;
 }
 
+/* Called under table_lock */
 drm_private int
-fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
+fd_bo_cache_free(struct util_bo_cache *cache, struct fd_bo *bo)
 {
-	struct fd_bo_bucket *bucket = get_bucket(cache, bo->size);
+	struct fd_device *dev = bo->dev;
+	struct timespec time;
 
 	/* see if we can be green and recycle: */
-	if (bucket) {
-		struct timespec time;
-
-		bo->funcs->madvise(bo, FALSE);
+	if (!util_bo_cache_bucket_size(cache, bo->size))
+		return -1;
 
-		clock_gettime(CLOCK_MONOTONIC, &time);
+	clock_gettime(CLOCK_MONOTONIC, &time);
 
-		bo->free_time = time.tv_sec;
-		VG_BO_RELEASE(bo);
-		list_addtail(&bo->list, &bucket->list);
-		fd_bo_cache_cleanup(cache, time.tv_sec);
+	VG_BO_RELEASE(bo);
+	util_bo_cache_put(cache, &bo->cache_entry, bo->size, 0, time.tv_sec);
+	util_bo_cache_cleanup(cache, time.tv_sec);
 
-		/* bo's in the bucket cache don't have a ref and
-		 * don't hold a ref to the dev:
-		 */
-		fd_device_del_locked(bo->dev);
-
-		return 0;
-	}
+	/* bo's in the bucket cache don't have a ref and
+	 * don't hold a ref to the dev:
+	 */
+	fd_device_del_locked(dev);
 
-	return -1;
+	return 0;
 }
@@ -61,6 +61,7 @@ drm_public struct fd_device * fd_device_new(int fd)
 
 		dev = msm_device_new(fd);
 		dev->version = version->version_minor;
+		dev->capture = util_capture_open_env("FD_CAPTURE", "msm");
 #if HAVE_FREEDRENO_KGSL
 	} else if (!strcmp(version->name, "kgsl")) {
 		DEBUG_MSG("kgsl DRM device");
@@ -110,7 +111,9 @@ drm_public struct fd_device * fd_device_ref(struct fd_device *dev)
 static void fd_device_del_impl(struct fd_device *dev)
 {
 	int close_fd = dev->closefd ? dev->fd : -1;
-	fd_bo_cache_cleanup(&dev->bo_cache, 0);
+	util_bo_cache_fini(&dev->bo_cache);
+	util_bo_cache_fini(&dev->ring_cache);
+	util_capture_close(dev->capture);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
 	dev->funcs->destroy(dev);
@@ -113,6 +113,29 @@ int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp);
 int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout);
 
+struct fd_pipe_fence {
+	struct fd_pipe *pipe;
+	uint32_t timestamp;
+	int signaled;		/* out */
+};
+
+#define FD_WAIT_ANY		0x0001	/* default is to wait for all fences */
+
+/* timeout in nanosec, 0 to poll */
+int fd_pipe_wait_fences(struct fd_pipe_fence *fences, uint32_t count,
+		uint32_t flags, uint64_t timeout);
+
+struct fd_ring_pool_stats {
+	uint64_t allocs;	/* cmdstream bo's asked for */
+	uint64_t reused;	/* ... served from the pool */
+	uint64_t stalls;	/* ... that had to wait for the GPU first */
+	uint64_t released;	/* idle bo's beyond the depth that were let go */
+};
+
+void fd_pipe_set_ring_pool_depth(struct fd_pipe *pipe, uint32_t depth);
+void fd_pipe_get_ring_pool_stats(struct fd_pipe *pipe,
+		struct fd_ring_pool_stats *stats);
+
 
 /* buffer-object functions:
  */
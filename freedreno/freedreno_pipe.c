@@ -58,6 +58,9 @@ fd_pipe_new2(struct fd_device *dev, enum fd_pipe_id id, uint32_t prio)
 	pipe->dev = dev;
 	pipe->id = id;
 	atomic_set(&pipe->refcnt, 1);
+	atomic_set(&pipe->retired_timestamp, 0);
+	atomic_set(&pipe->retired_valid, 0);
+	pipe->ring_pool = fd_ring_pool_new(pipe);
 
 	fd_pipe_get_param(pipe, FD_GPU_ID, &val);
 	pipe->gpu_id = val;
@@ -81,6 +84,7 @@ drm_public void fd_pipe_del(struct fd_pipe *pipe)
 {
 	if (!atomic_dec_and_test(&pipe->refcnt))
 		return;
+	fd_ring_pool_fini(pipe->ring_pool);
 	pipe->funcs->destroy(pipe);
 }
 
@@ -95,8 +99,185 @@ drm_public int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
 	return fd_pipe_wait_timeout(pipe, timestamp, ~0);
 }
 
+static void pipe_retire(struct fd_pipe *pipe, uint32_t timestamp)
+{
+	uint32_t old;
+
+	/* nothing to compare with until then, as the first fence of the pipe
+	 * can be anything.  Racing with another first wait can at worst leave
+	 * the older of the two timestamps:
+	 */
+	if (!atomic_read(&pipe->retired_valid)) {
+		atomic_set(&pipe->retired_timestamp, timestamp);
+		atomic_cmpxchg(&pipe->retired_valid, 0, 1);
+		return;
+	}
+
+	old = atomic_read(&pipe->retired_timestamp);
+	while (!timestamp_retired(timestamp, old)) {
+		uint32_t cur = atomic_cmpxchg(&pipe->retired_timestamp,
+					      old, timestamp);
+		if (cur == old)
+			break;
+		old = cur;
+	}
+}
+
 drm_public int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout)
 {
-	return pipe->funcs->wait(pipe, timestamp, timeout);
+	int ret = pipe->funcs->wait(pipe, timestamp, timeout);
+
+	if (!ret)
+		pipe_retire(pipe, timestamp);
+
+	return ret;
+}
+
+static int pipe_wait(struct fd_pipe *pipe, uint32_t timestamp, uint64_t timeout)
+{
+	if (fd_pipe_retired(pipe, timestamp))
+		return 0;
+
+	return fd_pipe_wait_timeout(pipe, timestamp, timeout);
+}
+
+/* marks the fences known to have retired, returns true once enough have: */
+static int fences_signaled(struct fd_pipe_fence *fences, uint32_t count,
+		int any)
+{
+	uint32_t signaled = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		struct fd_pipe_fence *f = &fences[i];
+
+		if (!f->signaled)
+			f->signaled = fd_pipe_retired(f->pipe, f->timestamp);
+		signaled += f->signaled;
+	}
+
+	return any ? signaled > 0 : signaled == count;
+}
+
+/* if fences[i] is the first pending fence on its pipe, returns the
+ * timestamp to wait for on that pipe: the oldest pending one when waiting
+ * for any fence, the latest otherwise, as a pipe retires them in order.
+ */
+static int pipe_target(struct fd_pipe_fence *fences, uint32_t count,
+		uint32_t i, int any, uint32_t *target)
+{
+	struct fd_pipe *pipe = fences[i].pipe;
+
+	if (fences[i].signaled)
+		return 0;
+	for (uint32_t j = 0; j < i; j++)
+		if (fences[j].pipe == pipe && !fences[j].signaled)
+			return 0;
+
+	*target = fences[i].timestamp;
+	for (uint32_t j = i + 1; j < count; j++) {
+		if (fences[j].pipe != pipe || fences[j].signaled)
+			continue;
+		if (timestamp_retired(fences[j].timestamp, *target) == !any)
+			continue;
+		*target = fences[j].timestamp;
+	}
+
+	return 1;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/* time left until deadline, 0 meaning none: */
+static uint64_t time_left(uint64_t deadline)
+{
+	uint64_t now;
+
+	if (!deadline)
+		return ~0ull;
+
+	now = get_time_ns();
+	return now < deadline ? deadline - now : 0;
+}
+
+/**
+ * Waits for all of the fences, or any of them with FD_WAIT_ANY, which may
+ * be on different pipes.  Fences are first polled without blocking, one
+ * per pipe, then at most one blocking wait is issued per pipe: for the
+ * latest timestamp on it, or the oldest one with FD_WAIT_ANY.  Waiting for
+ * any fence on several pipes is done in growing time slices on each pipe
+ * in turn, as the kernel can't wait on several of them at once.
+ *
+ * Sets the signaled field of the fences known to have retired, and returns
+ * 0 once the wait is satisfied, or an error such as -ETIMEDOUT.
+ */
+drm_public int fd_pipe_wait_fences(struct fd_pipe_fence *fences, uint32_t count,
+		uint32_t flags, uint64_t timeout)
+{
+	int any = flags & FD_WAIT_ANY;
+	uint64_t deadline = 0, slice = 100000;
+	uint32_t i, target, nr_pipes = 0;
+	int ret;
+
+	if (!count)
+		return 0;
+
+	if (timeout != ~0ull)
+		deadline = get_time_ns() + MIN2(timeout, ~0ull >> 2);
+
+	for (i = 0; i < count; i++)
+		fences[i].signaled = 0;
+
+	if (fences_signaled(fences, count, any))
+		return 0;
+
+	/* cheap pass: */
+	for (i = 0; i < count; i++) {
+		if (!pipe_target(fences, count, i, any, &target))
+			continue;
+		pipe_wait(fences[i].pipe, target, 0);
+		nr_pipes++;
+	}
+
+	if (fences_signaled(fences, count, any))
+		return 0;
+	if (!timeout)
+		return -ETIMEDOUT;
+
+	if (!any || nr_pipes == 1) {
+		for (i = 0; i < count; i++) {
+			if (!pipe_target(fences, count, i, any, &target))
+				continue;
+			ret = pipe_wait(fences[i].pipe, target,
+					time_left(deadline));
+			if (ret)
+				return ret;
+			if (fences_signaled(fences, count, any))
+				return 0;
+		}
+		return fences_signaled(fences, count, any) ? 0 : -ETIMEDOUT;
+	}
+
+	for (;;) {
+		for (i = 0; i < count; i++) {
+			uint64_t left = time_left(deadline);
+
+			if (!left)
+				return -ETIMEDOUT;
+			if (!pipe_target(fences, count, i, any, &target))
+				continue;
+			ret = pipe_wait(fences[i].pipe, target, MIN2(slice, left));
+			if (!ret && fences_signaled(fences, count, any))
+				return 0;
+			if (ret && ret != -ETIMEDOUT && ret != -EBUSY)
+				return ret;
+		}
+		slice = MIN2(slice * 2, 10000000);
+	}
 }
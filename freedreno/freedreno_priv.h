@@ -44,8 +44,10 @@
 #include "xf86drm.h"
 #include "xf86atomic.h"
 
+#include "util_bo_cache.h"
 #include "util_double_list.h"
 #include "util_math.h"
+#include "util_submit_capture.h"
 
 #include "freedreno_drmif.h"
 #include "freedreno_ringbuffer.h"
@@ -68,17 +70,6 @@ struct fd_device_funcs {
 	void (*destroy)(struct fd_device *dev);
 };
 
-struct fd_bo_bucket {
-	uint32_t size;
-	struct list_head list;
-};
-
-struct fd_bo_cache {
-	struct fd_bo_bucket cache_bucket[14 * 4];
-	int num_buckets;
-	time_t time;
-};
-
 struct fd_device {
 	int fd;
 	enum fd_version version;
@@ -97,8 +88,11 @@ struct fd_device {
 
 	const struct fd_device_funcs *funcs;
 
-	struct fd_bo_cache bo_cache;
-	struct fd_bo_cache ring_cache;
+	struct util_bo_cache bo_cache;
+	struct util_bo_cache ring_cache;
+
+	/* submits are captured here if $FD_CAPTURE is set: */
+	struct util_capture *capture;
 
 	int closefd;        /* call close(fd) upon destruction */
 
@@ -106,11 +100,10 @@ struct fd_device {
 	int bo_size;
 };
 
-drm_private void fd_bo_cache_init(struct fd_bo_cache *cache, int coarse);
-drm_private void fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time);
-drm_private struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache,
+drm_private void fd_bo_cache_init(struct util_bo_cache *cache, int coarse);
+drm_private struct fd_bo * fd_bo_cache_alloc(struct util_bo_cache *cache,
 		uint32_t *size, uint32_t flags);
-drm_private int fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo);
+drm_private int fd_bo_cache_free(struct util_bo_cache *cache, struct fd_bo *bo);
 
 /* for where @table_lock is already held: */
 drm_private void fd_device_del_locked(struct fd_device *dev);
@@ -128,9 +121,28 @@ struct fd_pipe {
 	enum fd_pipe_id id;
 	uint32_t gpu_id;
 	atomic_t refcnt;
+	/* latest timestamp known to have retired, saves waits on older ones.
+	 * Only valid once retired_valid is set, by the first successful wait:
+	 */
+	atomic_t retired_timestamp;
+	atomic_t retired_valid;
+	/* recycles the cmdstream bo's of the pipe's rings: */
+	struct fd_ring_pool *ring_pool;
 	const struct fd_pipe_funcs *funcs;
 };
 
+/* timestamps wrap around: */
+static inline int timestamp_retired(uint32_t timestamp, uint32_t retired)
+{
+	return (int32_t)(timestamp - retired) <= 0;
+}
+
+static inline int fd_pipe_retired(struct fd_pipe *pipe, uint32_t timestamp)
+{
+	return atomic_read(&pipe->retired_valid) &&
+		timestamp_retired(timestamp, atomic_read(&pipe->retired_timestamp));
+}
+
 struct fd_ringbuffer_funcs {
 	void * (*hostptr)(struct fd_ringbuffer *ring);
 	int (*flush)(struct fd_ringbuffer *ring, uint32_t *last_start,
@@ -167,15 +179,48 @@ struct fd_bo {
 		NO_CACHE = 0,
 		BO_CACHE = 1,
 		RING_CACHE = 2,
+		RING_POOL = 3,
 	} bo_reuse;
 
-	struct list_head list;   /* bucket-list entry */
-	time_t free_time;        /* time when added to bucket-list */
+	struct util_bo_cache_entry cache_entry;
+
+	/* for RING_POOL bo's, the pool of the pipe they were allocated for,
+	 * and the last fence of that pipe they were submitted with, if they
+	 * were since they left the pool:
+	 */
+	struct fd_ring_pool *ring_pool;
+	struct list_head ring_pool_link;
+	uint32_t ring_timestamp;
+	int ring_submitted;
+	int ring_foreign;	/* also submitted on another pipe */
+
+	/* changed whenever the CPU may write the contents, when capturing: */
+	uint32_t capture_gen;
 };
 
-drm_private struct fd_bo *fd_bo_new_ring(struct fd_device *dev,
+drm_private struct fd_bo *fd_bo_new_ring(struct fd_pipe *pipe,
 		uint32_t size, uint32_t flags);
 
+drm_private struct fd_ring_pool *fd_ring_pool_new(struct fd_pipe *pipe);
+drm_private void fd_ring_pool_fini(struct fd_ring_pool *pool);
+drm_private struct fd_bo *fd_ring_pool_get(struct fd_pipe *pipe,
+		uint32_t size, int *pooled);
+drm_private void fd_ring_pool_add(struct fd_pipe *pipe, struct fd_bo *bo);
+drm_private int fd_ring_pool_put(struct fd_bo *bo);
+
+/* records that a ring bo is used by a submit on @pipe: */
+static inline void fd_bo_ring_submitted(struct fd_bo *bo,
+		struct fd_pipe *pipe, uint32_t timestamp)
+{
+	if (bo->bo_reuse != RING_POOL)
+		return;
+	if (bo->ring_pool == pipe->ring_pool) {
+		bo->ring_timestamp = timestamp;
+		bo->ring_submitted = 1;
+	} else
+		bo->ring_foreign = 1;
+}
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define enable_debug 0  /* TODO make dynamic */
@@ -226,7 +271,7 @@ static inline void VG_BO_FREE(struct fd_bo *bo)
  * doesn't attribute ownership to the first one to allocate the recycled
  * bo.
  *
- * Note that the list_head in fd_bo is used to track the buffers in cache
+ * Note that the cache_entry in fd_bo is used to track the buffers in cache
  * so disable error reporting on the range while they are in cache so
  * valgrind doesn't squawk about list traversal.
  *
@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Per-pipe pool of cmdstream bo's.
+ *
+ * Every submit stamps the ring bo's it uses with its fence, so a bo given
+ * back to the pool is known to be idle once the pipe has retired that
+ * fence.  That's checked against the pipe's latest retired fence, or with
+ * a single fence poll, instead of a DRM_MSM_GEM_CPU_PREP per bo as the
+ * ring cache does.  Bo's are kept per exact size, so the few sizes rings
+ * use don't get rounded up to a power of two either.  There are buckets
+ * for a few sizes at a time: when a new size shows up and they are all
+ * taken, the least recently used bucket whose bo's are all idle is freed
+ * and given to it.
+ *
+ * Up to depth idle bo's of each size are kept.  When the oldest one is
+ * still busy, a new bo is allocated as long as there are fewer than depth
+ * of that size around, otherwise the pipe stalls until the oldest retires.
+ *
+ * The pool is refcounted by the pipe and by the bo's it handed out, so
+ * that rings outliving their pipe can still give their bo's back: they then
+ * go to the ring cache.  Everything else is protected by table_lock.
+ */
+
+#include "freedreno_drmif.h"
+#include "freedreno_priv.h"
+
+drm_private void bo_del(struct fd_bo *bo);
+drm_private extern pthread_mutex_t table_lock;
+
+#define RING_POOL_SIZES		8
+#define RING_POOL_DEFAULT_DEPTH	16
+
+struct fd_ring_pool_bucket {
+	uint32_t size;
+	/* when a bo of this size was last asked for: */
+	uint32_t last_use;
+	/* bo's of this size handed out or idle: */
+	uint32_t count;
+	/* idle bo's, oldest first: */
+	struct list_head idle;
+	uint32_t nr_idle;
+};
+
+struct fd_ring_pool {
+	atomic_t refcnt;
+	/* NULL once the pipe is gone: */
+	struct fd_pipe *pipe;
+	uint32_t depth;
+	uint32_t uses;
+	struct fd_ring_pool_bucket buckets[RING_POOL_SIZES];
+	struct fd_ring_pool_stats stats;
+};
+
+drm_private struct fd_ring_pool *
+fd_ring_pool_new(struct fd_pipe *pipe)
+{
+	struct fd_ring_pool *pool = calloc(1, sizeof(*pool));
+	unsigned i;
+
+	if (!pool)
+		return NULL;
+
+	atomic_set(&pool->refcnt, 1);
+	pool->pipe = pipe;
+	pool->depth = RING_POOL_DEFAULT_DEPTH;
+	for (i = 0; i < RING_POOL_SIZES; i++)
+		list_inithead(&pool->buckets[i].idle);
+
+	return pool;
+}
+
+static void ring_pool_unref(struct fd_ring_pool *pool)
+{
+	if (atomic_dec_and_test(&pool->refcnt))
+		free(pool);
+}
+
+/* Called under table_lock */
+static void trim_bucket(struct fd_ring_pool *pool,
+		struct fd_ring_pool_bucket *b, uint32_t depth)
+{
+	while (b->nr_idle > depth) {
+		struct fd_bo *bo = LIST_FIRST_ENTRY(&b->idle,
+				struct fd_bo, ring_pool_link);
+
+		list_del(&bo->ring_pool_link);
+		b->nr_idle--;
+		b->count--;
+		pool->stats.released++;
+		VG_BO_OBTAIN(bo);
+		bo_del(bo);
+	}
+}
+
+/* Called under table_lock */
+static void trim(struct fd_ring_pool *pool, uint32_t depth)
+{
+	unsigned i;
+
+	for (i = 0; i < RING_POOL_SIZES; i++)
+		trim_bucket(pool, &pool->buckets[i], depth);
+}
+
+/* frees the idle bo's, the pipe is going away: */
+drm_private void
+fd_ring_pool_fini(struct fd_ring_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&table_lock);
+	trim(pool, 0);
+	pool->pipe = NULL;
+	pthread_mutex_unlock(&table_lock);
+
+	ring_pool_unref(pool);
+}
+
+/* Called under table_lock.  Unless @claim is set, only returns a bucket
+ * the size already has.
+ */
+static struct fd_ring_pool_bucket *
+get_bucket(struct fd_ring_pool *pool, uint32_t size, int claim)
+{
+	struct fd_ring_pool_bucket *lru = NULL;
+	unsigned i;
+
+	for (i = 0; i < RING_POOL_SIZES; i++) {
+		struct fd_ring_pool_bucket *b = &pool->buckets[i];
+
+		if (b->size == size)
+			return b;
+	}
+	if (!claim)
+		return NULL;
+
+	/* buckets that never had any bo or none left are the first to go: */
+	for (i = 0; i < RING_POOL_SIZES; i++) {
+		struct fd_ring_pool_bucket *b = &pool->buckets[i];
+
+		if (!b->count) {
+			lru = b;
+			break;
+		}
+		if (b->nr_idle < b->count)
+			continue;
+		if (!lru || (int32_t)(b->last_use - lru->last_use) < 0)
+			lru = b;
+	}
+	if (!lru)
+		return NULL;
+
+	trim_bucket(pool, lru, 0);
+	lru->size = size;
+
+	return lru;
+}
+
+/* Called under table_lock: the bo goes to the ring cache, which checks
+ * it is idle, if its size is one of the cache's buckets:
+ */
+static void to_ring_cache(struct fd_bo *bo)
+{
+	bo->ring_pool = NULL;
+	if (util_bo_cache_bucket_size(&bo->dev->ring_cache, bo->size) == bo->size)
+		bo->bo_reuse = RING_CACHE;
+	else
+		bo->bo_reuse = NO_CACHE;
+}
+
+/**
+ * Returns an idle ring bo of @size from the pipe's pool, or NULL.  Then,
+ * @pooled tells whether the new bo should be handed to fd_ring_pool_add().
+ */
+drm_private struct fd_bo *
+fd_ring_pool_get(struct fd_pipe *pipe, uint32_t size, int *pooled)
+{
+	struct fd_ring_pool *pool = pipe->ring_pool;
+	struct fd_ring_pool_bucket *b;
+	struct fd_bo *bo;
+	int busy;
+
+	*pooled = 0;
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_lock(&table_lock);
+	b = pool->depth ? get_bucket(pool, size, 1) : NULL;
+	if (!b) {
+		pthread_mutex_unlock(&table_lock);
+		return NULL;
+	}
+	*pooled = 1;
+	b->last_use = ++pool->uses;
+	pool->stats.allocs++;
+
+	if (LIST_IS_EMPTY(&b->idle)) {
+		pthread_mutex_unlock(&table_lock);
+		return NULL;
+	}
+
+	bo = LIST_FIRST_ENTRY(&b->idle, struct fd_bo, ring_pool_link);
+	list_del(&bo->ring_pool_link);
+	b->nr_idle--;
+	busy = bo->ring_submitted && !fd_pipe_retired(pipe, bo->ring_timestamp);
+	if (!busy)
+		pool->stats.reused++;
+	pthread_mutex_unlock(&table_lock);
+
+	if (busy) {
+		/* poll the fence, which also tells us about the bo's after it: */
+		busy = fd_pipe_wait_timeout(pipe, bo->ring_timestamp, 0);
+
+		pthread_mutex_lock(&table_lock);
+		if (busy && b->count < pool->depth) {
+			list_add(&bo->ring_pool_link, &b->idle);
+			b->nr_idle++;
+			pthread_mutex_unlock(&table_lock);
+			return NULL;
+		}
+		if (busy)
+			pool->stats.stalls++;
+		pool->stats.reused++;
+		pthread_mutex_unlock(&table_lock);
+
+		if (busy)
+			fd_pipe_wait(pipe, bo->ring_timestamp);
+	}
+
+	VG_BO_OBTAIN(bo);
+	atomic_set(&bo->refcnt, 1);
+	fd_device_ref(bo->dev);
+	atomic_inc(&pool->refcnt);
+	bo->ring_submitted = 0;
+	bo->ring_foreign = 0;
+
+	return bo;
+}
+
+/* hands a newly allocated ring bo over to the pipe's pool: */
+drm_private void
+fd_ring_pool_add(struct fd_pipe *pipe, struct fd_bo *bo)
+{
+	struct fd_ring_pool *pool = pipe->ring_pool;
+	struct fd_ring_pool_bucket *b;
+
+	/* the bucket may have gone to another size since fd_ring_pool_get(): */
+	pthread_mutex_lock(&table_lock);
+	b = get_bucket(pool, bo->size, 1);
+	if (!b) {
+		to_ring_cache(bo);
+		pthread_mutex_unlock(&table_lock);
+		return;
+	}
+	b->count++;
+	pthread_mutex_unlock(&table_lock);
+
+	atomic_inc(&pool->refcnt);
+	bo->ring_pool = pool;
+	bo->ring_submitted = 0;
+	bo->ring_foreign = 0;
+	bo->bo_reuse = RING_POOL;
+}
+
+/* Called under table_lock, returns 0 if the bo was put back in its pool */
+drm_private int
+fd_ring_pool_put(struct fd_bo *bo)
+{
+	struct fd_ring_pool *pool = bo->ring_pool;
+	struct fd_ring_pool_bucket *b = get_bucket(pool, bo->size, 0);
+	struct fd_device *dev = bo->dev;
+
+	/* bo's that were submitted on other pipes, or that the pool has no
+	 * room for, go to the ring cache, which checks they are idle, if
+	 * their size is one of its buckets:
+	 */
+	if (!pool->pipe || bo->ring_foreign || b->nr_idle >= pool->depth) {
+		b->count--;
+		if (pool->pipe)
+			pool->stats.released++;
+		to_ring_cache(bo);
+		ring_pool_unref(pool);
+		return -1;
+	}
+
+	VG_BO_RELEASE(bo);
+	list_addtail(&bo->ring_pool_link, &b->idle);
+	b->nr_idle++;
+	ring_pool_unref(pool);
+
+	/* bo's in the pool don't have a ref and don't hold a ref to the dev: */
+	fd_device_del_locked(dev);
+
+	return 0;
+}
+
+/**
+ * Sets how many idle cmdstream bo's of each size the pipe keeps for reuse,
+ * and how many of each it allocates before waiting for the GPU to be done
+ * with one.  0 disables the pool, leaving cmdstream bo's to the device's
+ * ring cache.
+ */
+drm_public void
+fd_pipe_set_ring_pool_depth(struct fd_pipe *pipe, uint32_t depth)
+{
+	struct fd_ring_pool *pool = pipe->ring_pool;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&table_lock);
+	pool->depth = depth;
+	trim(pool, depth);
+	pthread_mutex_unlock(&table_lock);
+}
+
+drm_public void
+fd_pipe_get_ring_pool_stats(struct fd_pipe *pipe,
+		struct fd_ring_pool_stats *stats)
+{
+	struct fd_ring_pool *pool = pipe->ring_pool;
+
+	if (!pool) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+
+	pthread_mutex_lock(&table_lock);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&table_lock);
+}
@@ -65,8 +65,20 @@ static int kgsl_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp,
 			.timestamp = timestamp,
 			.timeout   = 5000,
 	};
+	uint32_t retired;
 	int ret;
 
+	/* poll: */
+	if (!timeout) {
+		ret = kgsl_pipe_timestamp(kgsl_pipe, &retired);
+		if (ret)
+			return ret;
+		if ((int32_t)(timestamp - retired) > 0)
+			return -ETIMEDOUT;
+		kgsl_pipe_process_pending(kgsl_pipe, timestamp);
+		return 0;
+	}
+
 	do {
 		ret = ioctl(kgsl_pipe->fd, IOCTL_KGSL_DEVICE_WAITTIMESTAMP, &req);
 	} while ((ret == -1) && ((errno == EINTR) || (errno == EAGAIN)));
@@ -89,7 +89,9 @@ static int msm_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp,
 
 	ret = drmCommandWrite(dev->fd, DRM_MSM_WAIT_FENCE, &req, sizeof(req));
 	if (ret) {
-		ERROR_MSG("wait-fence failed! %d (%s)", ret, strerror(errno));
+		/* timing out is up to the caller to report: */
+		if (ret != -ETIMEDOUT && ret != -EBUSY)
+			ERROR_MSG("wait-fence failed! %d (%s)", ret, strerror(errno));
 		return ret;
 	}
 
@@ -144,6 +146,11 @@ static void msm_pipe_destroy(struct fd_pipe *pipe)
 		msm_pipe->suballoc_ring = NULL;
 	}
 
+	if (msm_pipe->slab_bo) {
+		fd_bo_del(msm_pipe->slab_bo);
+		msm_pipe->slab_bo = NULL;
+	}
+
 	free(msm_pipe);
 }
 
@@ -39,8 +39,7 @@
 
 struct msm_device {
 	struct fd_device base;
-	struct fd_bo_cache ring_cache;
-	unsigned ring_cnt;
+	atomic_t ring_cnt;
 };
 
 static inline struct msm_device * to_msm_device(struct fd_device *x)
@@ -68,6 +67,19 @@ struct msm_pipe {
 	 * so we can reclaim extra space at it's end.
 	 */
 	struct fd_ringbuffer *suballoc_ring;
+
+	/* Small non-streaming stateobj's are packed into page sized bo's
+	 * instead, with space handed out from slab_offset up.  Each stateobj
+	 * holds a reference to the slab bo, and the pipe holds one more until
+	 * the slab is full, so a slab goes back to the ring pool once the
+	 * pipe has moved on and the last stateobj in it is deleted.
+	 *
+	 * Space is never reused within a slab, since the GPU may still be
+	 * reading a deleted stateobj; the ring pool does not hand out the bo
+	 * again until its last submit has retired.
+	 */
+	struct fd_bo *slab_bo;
+	unsigned slab_offset;
 };
 
 static inline struct msm_pipe * to_msm_pipe(struct fd_pipe *x)
@@ -87,10 +99,12 @@ struct msm_bo {
 	uint64_t presumed;
 	/* to avoid excess hashtable lookups, cache the ring this bo was
 	 * last emitted on (since that will probably also be the next ring
-	 * it is emitted on)
+	 * it is emitted on).  Rings on other threads may overwrite this at
+	 * any time, so it is only a hint, checked against the ring's own bos
+	 * table before use.
 	 */
-	unsigned current_ring_seqno;
-	uint32_t idx;
+	atomic_t current_ring_seqno;
+	atomic_t idx;
 };
 
 static inline struct msm_bo * to_msm_bo(struct fd_bo *x)
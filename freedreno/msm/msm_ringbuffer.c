@@ -45,6 +45,18 @@ struct msm_cmd {
 	/* reloc's table: */
 	DECLARE_ARRAY(struct drm_msm_gem_submit_reloc, relocs);
 
+	/* for stateobj's, the reloc's table remapped to the bos table of the
+	 * submit it was last flushed in, along with the idx in that table of
+	 * each of the stateobj's own bos.  The same stateobj can be flushed
+	 * by parent rb's on several threads at once, so these belong to the
+	 * submit whose parent rb seqno is in submit_owner, from the time it
+	 * remaps the relocs until its submit ioctl returns.  Zero if no submit
+	 * owns them.
+	 */
+	DECLARE_ARRAY(struct drm_msm_gem_submit_reloc, submit_relocs);
+	DECLARE_ARRAY(uint32_t, submit_bo_idx);
+	atomic_t submit_owner;
+
 	uint32_t size;
 
 	/* has cmd already been added to parent rb's submit.cmds table? */
@@ -92,8 +104,18 @@ struct msm_ringbuffer {
 
 	unsigned seqno;
 
-	/* maps fd_bo to idx: */
-	void *bo_table;
+	/* remapped stateobj reloc's tables for this submit that couldn't use
+	 * the stateobj's own, because another submit owned it.  Only in parent
+	 * ringbuffer, freed after the submit ioctl:
+	 */
+	DECLARE_ARRAY(struct drm_msm_gem_submit_reloc *, private_relocs);
+
+	/* maps fd_bo to idx, open addressed by bo handle.  Each slot is
+	 * idx + 1 in bos, or 0 if empty.  Only ever touched by the thread
+	 * building the ring, so it needs no locking:
+	 */
+	uint32_t *bo_table;
+	uint32_t bo_table_size;
 
 	/* maps msm_cmd to drm_msm_gem_submit_cmd in parent rb.  Each rb has a
 	 * list of msm_cmd's which correspond to each chunk of cmdstream in
@@ -115,7 +137,10 @@ static inline struct msm_ringbuffer * to_msm_ringbuffer(struct fd_ringbuffer *x)
 
 #define INIT_SIZE 0x1000
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SLAB_SIZE 0x1000
+#define SLAB_MAX_OBJECT_SIZE (SLAB_SIZE / 4)
+
+#define BO_TABLE_INIT_SIZE 64
 
 static struct msm_cmd *current_cmd(struct fd_ringbuffer *ring)
 {
@@ -130,9 +155,39 @@ static void ring_cmd_del(struct msm_cmd *cmd)
 	list_del(&cmd->list);
 	to_msm_ringbuffer(cmd->ring)->cmd_count--;
 	free(cmd->relocs);
+	free(cmd->submit_relocs);
+	free(cmd->submit_bo_idx);
 	free(cmd);
 }
 
+/* allocate space for a small non-streaming stateobj from the pipe's slab,
+ * returning a reference to the slab bo:
+ */
+static struct fd_bo * slab_alloc(struct fd_pipe *pipe, uint32_t size,
+		unsigned *offset)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	unsigned slab_offset = ALIGN(msm_pipe->slab_offset, 0x10);
+
+	if (!msm_pipe->slab_bo || (slab_offset + size) > msm_pipe->slab_bo->size) {
+		struct fd_bo *slab_bo = fd_bo_new_ring(pipe, SLAB_SIZE, 0);
+
+		if (!slab_bo)
+			return NULL;
+
+		if (msm_pipe->slab_bo)
+			fd_bo_del(msm_pipe->slab_bo);
+
+		msm_pipe->slab_bo = slab_bo;
+		slab_offset = 0;
+	}
+
+	*offset = slab_offset;
+	msm_pipe->slab_offset = slab_offset + size;
+
+	return fd_bo_ref(msm_pipe->slab_bo);
+}
+
 static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 		enum fd_ringbuffer_flags flags)
 {
@@ -144,9 +199,6 @@ static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 
 	cmd->ring = ring;
 
-	/* TODO separate suballoc buffer for small non-streaming state, using
-	 * smaller page-sized backing bo's.
-	 */
 	if (flags & FD_RINGBUFFER_STREAMING) {
 		struct msm_pipe *msm_pipe = to_msm_pipe(ring->pipe);
 		unsigned suballoc_offset = 0;
@@ -171,7 +223,7 @@ static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 		}
 
 		if (!suballoc_bo) {
-			cmd->ring_bo = fd_bo_new_ring(ring->pipe->dev, 0x8000, 0);
+			cmd->ring_bo = fd_bo_new_ring(ring->pipe, 0x8000, 0);
 			msm_ring->offset = 0;
 		} else {
 			cmd->ring_bo = fd_bo_ref(suballoc_bo);
@@ -182,8 +234,11 @@ static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 			fd_ringbuffer_del(msm_pipe->suballoc_ring);
 
 		msm_pipe->suballoc_ring = fd_ringbuffer_ref(ring);
+	} else if ((flags & FD_RINGBUFFER_OBJECT) &&
+			(size <= SLAB_MAX_OBJECT_SIZE)) {
+		cmd->ring_bo = slab_alloc(ring->pipe, size, &msm_ring->offset);
 	} else {
-		cmd->ring_bo = fd_bo_new_ring(ring->pipe->dev, size, 0);
+		cmd->ring_bo = fd_bo_new_ring(ring->pipe, size, 0);
 	}
 	if (!cmd->ring_bo)
 		goto fail;
@@ -215,33 +270,92 @@ static uint32_t append_bo(struct fd_ringbuffer *ring, struct fd_bo *bo)
 	return idx;
 }
 
-/* add (if needed) bo, return idx: */
+static inline uint32_t bo_table_hash(struct msm_ringbuffer *msm_ring,
+		uint32_t handle)
+{
+	return (handle * 0x9e3779b1) & (msm_ring->bo_table_size - 1);
+}
+
+/* find bo in the ring's bo_table, returning the slot it is in, or the empty
+ * slot it would go in:
+ */
+static uint32_t * bo_table_slot(struct msm_ringbuffer *msm_ring,
+		struct fd_bo *bo)
+{
+	uint32_t mask = msm_ring->bo_table_size - 1;
+	uint32_t i = bo_table_hash(msm_ring, bo->handle);
+
+	while (msm_ring->bo_table[i] &&
+			msm_ring->bos[msm_ring->bo_table[i] - 1] != bo)
+		i = (i + 1) & mask;
+
+	return &msm_ring->bo_table[i];
+}
+
+/* keep the bo_table at most half full, so that probe sequences stay short: */
+static int bo_table_reserve(struct msm_ringbuffer *msm_ring)
+{
+	uint32_t size = msm_ring->bo_table_size;
+	uint32_t *table;
+	unsigned i;
+
+	if (msm_ring->bo_table && (msm_ring->nr_bos + 1) * 2 <= size)
+		return 0;
+
+	size = size ? size * 2 : BO_TABLE_INIT_SIZE;
+	table = calloc(size, sizeof(*table));
+	if (!table) {
+		ERROR_MSG("allocation failed");
+		return -1;
+	}
+
+	free(msm_ring->bo_table);
+	msm_ring->bo_table = table;
+	msm_ring->bo_table_size = size;
+
+	for (i = 0; i < msm_ring->nr_bos; i++)
+		*bo_table_slot(msm_ring, msm_ring->bos[i]) = i + 1;
+
+	return 0;
+}
+
+/* add (if needed) bo, return idx.  This runs for every reloc, on as many
+ * threads as there are rings being built, so it takes no locks: the ring's
+ * own tables are only touched by the thread building it, and the bo's cached
+ * (ring, idx) tag is only trusted once the ring's bos table agrees with it.
+ */
 static uint32_t bo2idx(struct fd_ringbuffer *ring, struct fd_bo *bo, uint32_t flags)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	struct msm_bo *msm_bo = to_msm_bo(bo);
-	uint32_t idx;
-	pthread_mutex_lock(&idx_lock);
-	if (msm_bo->current_ring_seqno == msm_ring->seqno) {
-		idx = msm_bo->idx;
-	} else {
-		void *val;
-
-		if (!msm_ring->bo_table)
-			msm_ring->bo_table = drmHashCreate();
-
-		if (!drmHashLookup(msm_ring->bo_table, bo->handle, &val)) {
-			/* found */
-			idx = (uint32_t)(uintptr_t)val;
+	unsigned seqno = atomic_read(&msm_bo->current_ring_seqno);
+	uint32_t idx = atomic_read(&msm_bo->idx);
+
+	if (seqno != msm_ring->seqno || idx >= msm_ring->nr_bos ||
+			msm_ring->bos[idx] != bo) {
+		uint32_t *slot;
+
+		if (bo_table_reserve(msm_ring)) {
+			/* without a table, fall back to searching bos: */
+			for (idx = 0; idx < msm_ring->nr_bos; idx++)
+				if (msm_ring->bos[idx] == bo)
+					break;
+			if (idx == msm_ring->nr_bos)
+				idx = append_bo(ring, bo);
 		} else {
-			idx = append_bo(ring, bo);
-			val = (void *)(uintptr_t)idx;
-			drmHashInsert(msm_ring->bo_table, bo->handle, val);
+			slot = bo_table_slot(msm_ring, bo);
+			if (*slot) {
+				idx = *slot - 1;
+			} else {
+				idx = append_bo(ring, bo);
+				*slot = idx + 1;
+			}
 		}
-		msm_bo->current_ring_seqno = msm_ring->seqno;
-		msm_bo->idx = idx;
+
+		atomic_set(&msm_bo->current_ring_seqno, msm_ring->seqno);
+		atomic_set(&msm_bo->idx, idx);
 	}
-	pthread_mutex_unlock(&idx_lock);
+
 	if (flags & FD_RELOC_READ)
 		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_READ;
 	if (flags & FD_RELOC_WRITE)
@@ -333,11 +447,9 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	unsigned i;
 
 	for (i = 0; i < msm_ring->nr_bos; i++) {
-		struct msm_bo *msm_bo = to_msm_bo(msm_ring->bos[i]);
-		if (!msm_bo)
+		if (!msm_ring->bos[i])
 			continue;
-		msm_bo->current_ring_seqno = 0;
-		fd_bo_del(&msm_bo->base);
+		fd_bo_del(msm_ring->bos[i]);
 	}
 
 	for (i = 0; i < msm_ring->nr_cmds; i++) {
@@ -350,14 +462,26 @@ static void flush_reset(struct fd_ringbuffer *ring)
 			fd_ringbuffer_del(msm_cmd->ring);
 	}
 
+	for (i = 0; i < msm_ring->nr_private_relocs; i++)
+		free(msm_ring->private_relocs[i]);
+	msm_ring->nr_private_relocs = 0;
+
 	msm_ring->submit.nr_cmds = 0;
 	msm_ring->submit.nr_bos = 0;
 	msm_ring->nr_cmds = 0;
 	msm_ring->nr_bos = 0;
 
+	/* the next submit gets a new seqno, so that neither bo tags nor
+	 * stateobj reloc's table ownership carry over from this one:
+	 */
+	msm_ring->seqno = atomic_inc_return(&to_msm_device(ring->pipe->dev)->ring_cnt);
+
+	/* stale bo tags are rejected by bo2idx() once nr_bos is zero, but the
+	 * bo_table has to be emptied:
+	 */
 	if (msm_ring->bo_table) {
-		drmHashDestroy(msm_ring->bo_table);
-		msm_ring->bo_table = NULL;
+		memset(msm_ring->bo_table, 0,
+				msm_ring->bo_table_size * sizeof(msm_ring->bo_table[0]));
 	}
 
 	if (msm_ring->cmd_table) {
@@ -370,6 +494,7 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	} else {
 		/* in old mode, just reset the # of relocs: */
 		current_cmd(ring)->nr_relocs = 0;
+		current_cmd(ring)->nr_submit_relocs = 0;
 	}
 }
 
@@ -414,42 +539,174 @@ static void dump_submit(struct msm_ringbuffer *msm_ring)
 	}
 }
 
+/* Only the contents of the bos the CPU has a mapping of are captured, the
+ * others are produced by the GPU.  The cmdstream bos always are, and as
+ * ring bos keep being written through the same mapping, they are copied
+ * every time.
+ */
+static void capture_submit(struct msm_ringbuffer *msm_ring, uint32_t queue)
+{
+	struct fd_device *dev = msm_ring->base.pipe->dev;
+	struct util_capture_submit cap = {
+		.queue = queue,
+		.nr_bos = msm_ring->submit.nr_bos,
+		.nr_cmds = msm_ring->submit.nr_cmds,
+	};
+	struct util_capture_bo *bos;
+	struct util_capture_cmd *cmds;
+	struct util_capture_reloc *relocs;
+	uint32_t i, j, n = 0;
+
+	for (i = 0; i < msm_ring->submit.nr_cmds; i++)
+		cap.nr_relocs += msm_ring->submit.cmds[i].nr_relocs;
+
+	bos = calloc(cap.nr_bos + 1, sizeof(*bos));
+	cmds = calloc(cap.nr_cmds + 1, sizeof(*cmds));
+	relocs = calloc(cap.nr_relocs + 1, sizeof(*relocs));
+	if (!bos || !cmds || !relocs)
+		goto out;
+
+	for (i = 0; i < msm_ring->submit.nr_bos; i++) {
+		struct drm_msm_gem_submit_bo *submit_bo = &msm_ring->submit.bos[i];
+		struct fd_bo *bo = msm_ring->bos[i];
+
+		bos[i].handle = submit_bo->handle;
+		bos[i].flags = submit_bo->flags;
+		bos[i].iova = submit_bo->presumed;
+		bos[i].size = bo->size;
+		if (bo->bo_reuse != RING_CACHE && bo->bo_reuse != RING_POOL)
+			bos[i].generation = bo->capture_gen;
+		bos[i].map = bo->map;
+	}
+
+	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
+		struct drm_msm_gem_submit_cmd *cmd = &msm_ring->submit.cmds[i];
+		struct drm_msm_gem_submit_reloc *r = U642VOID(cmd->relocs);
+
+		cmds[i].type = cmd->type;
+		cmds[i].bo_idx = cmd->submit_idx;
+		cmds[i].offset = cmd->submit_offset;
+		cmds[i].size = cmd->size;
+		if (!bos[cmd->submit_idx].map)
+			bos[cmd->submit_idx].map = fd_bo_map(msm_ring->bos[cmd->submit_idx]);
+
+		for (j = 0; j < cmd->nr_relocs; j++, n++) {
+			relocs[n].cmd_idx = i;
+			relocs[n].submit_offset = r[j].submit_offset;
+			relocs[n].reloc_idx = r[j].reloc_idx;
+			relocs[n].or = r[j].or;
+			relocs[n].shift = r[j].shift;
+			relocs[n].reloc_offset = r[j].reloc_offset;
+		}
+	}
+
+	cap.bos = bos;
+	cap.cmds = cmds;
+	cap.relocs = relocs;
+	util_capture_submit(dev->capture, &cap);
+
+out:
+	free(bos);
+	free(cmds);
+	free(relocs);
+}
+
+/* add the stateobj's i'th bo to the parent's submit bos table: */
+static uint32_t stateobj_bo2idx(struct fd_ringbuffer *parent,
+		struct msm_ringbuffer *msm_ring, unsigned i)
+{
+	unsigned flags = 0;
+
+	if (msm_ring->submit.bos[i].flags & MSM_SUBMIT_BO_READ)
+		flags |= FD_RELOC_READ;
+	if (msm_ring->submit.bos[i].flags & MSM_SUBMIT_BO_WRITE)
+		flags |= FD_RELOC_WRITE;
+
+	return bo2idx(parent, msm_ring->bos[i], flags);
+}
+
 static struct drm_msm_gem_submit_reloc *
 handle_stateobj_relocs(struct fd_ringbuffer *parent, struct fd_ringbuffer *stateobj,
-		struct drm_msm_gem_submit_reloc *orig_relocs, unsigned nr_relocs)
+		struct msm_cmd *cmd)
 {
+	struct msm_ringbuffer *msm_parent = to_msm_ringbuffer(parent);
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(stateobj);
-	struct drm_msm_gem_submit_reloc *relocs = malloc(nr_relocs * sizeof(*relocs));
+	struct drm_msm_gem_submit_reloc *relocs;
+	int changed = FALSE;
 	unsigned i;
 
-	for (i = 0; i < nr_relocs; i++) {
-		unsigned idx = orig_relocs[i].reloc_idx;
-		struct fd_bo *bo = msm_ring->bos[idx];
-		unsigned flags = 0;
+	if (atomic_read(&cmd->submit_owner) == (int)msm_parent->seqno)
+		return cmd->submit_relocs;
 
-		if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_READ)
-			flags |= FD_RELOC_READ;
-		if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_WRITE)
-			flags |= FD_RELOC_WRITE;
+	if (!msm_parent->seqno ||
+			atomic_cmpxchg(&cmd->submit_owner, 0, msm_parent->seqno) != 0) {
+		/* another submit is using the stateobj's reloc's table, so
+		 * remap into a private one:
+		 */
+		uint32_t *bo_idx = malloc(msm_ring->nr_bos * sizeof(*bo_idx));
+
+		for (i = 0; i < msm_ring->nr_bos; i++)
+			bo_idx[i] = stateobj_bo2idx(parent, msm_ring, i);
 
-		relocs[i] = orig_relocs[i];
-		relocs[i].reloc_idx = bo2idx(parent, bo, flags);
+		relocs = malloc(cmd->nr_relocs * sizeof(*relocs));
+		for (i = 0; i < cmd->nr_relocs; i++) {
+			relocs[i] = cmd->relocs[i];
+			relocs[i].reloc_idx = bo_idx[cmd->relocs[i].reloc_idx];
+		}
+		free(bo_idx);
+
+		i = APPEND(msm_parent, private_relocs);
+		msm_parent->private_relocs[i] = relocs;
+
+		goto fixup_cmds;
+	}
+
+	/* add the stateobj's bos to the submit's bos table, once per bo rather
+	 * than once per reloc, and see if they got the same idx as in the
+	 * last submit:
+	 */
+	for (i = 0; i < msm_ring->nr_bos; i++) {
+		uint32_t idx = stateobj_bo2idx(parent, msm_ring, i);
+
+		if (i == cmd->nr_submit_bo_idx) {
+			APPEND(cmd, submit_bo_idx);
+			changed = TRUE;
+		} else if (cmd->submit_bo_idx[i] != idx) {
+			changed = TRUE;
+		}
+		cmd->submit_bo_idx[i] = idx;
+	}
+
+	/* if they all did, the reloc's table from the last submit is still good: */
+	if (changed || (cmd->nr_submit_relocs != cmd->nr_relocs)) {
+		cmd->nr_submit_relocs = 0;
+		for (i = 0; i < cmd->nr_relocs; i++) {
+			uint32_t n = APPEND(cmd, submit_relocs);
+
+			cmd->submit_relocs[n] = cmd->relocs[i];
+			cmd->submit_relocs[n].reloc_idx =
+					cmd->submit_bo_idx[cmd->relocs[i].reloc_idx];
+		}
 	}
 
+	relocs = cmd->submit_relocs;
+
+fixup_cmds:
 	/* stateobj rb's could have reloc's to other stateobj rb's which didn't
 	 * get propagated to the parent rb at _emit_reloc_ring() time (because
 	 * the parent wasn't known then), so fix that up now:
 	 */
 	for (i = 0; i < msm_ring->nr_cmds; i++) {
 		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
-		struct drm_msm_gem_submit_cmd *cmd = &msm_ring->submit.cmds[i];
+		struct drm_msm_gem_submit_cmd *submit_cmd = &msm_ring->submit.cmds[i];
 
 		if (msm_ring->cmds[i]->ring == stateobj)
 			continue;
 
 		assert(msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT);
 
-		if (get_cmd(parent, msm_cmd, cmd->submit_offset, cmd->size, cmd->type)) {
+		if (get_cmd(parent, msm_cmd, submit_cmd->submit_offset,
+				submit_cmd->size, submit_cmd->type)) {
 			fd_ringbuffer_ref(msm_cmd->ring);
 		}
 	}
@@ -495,10 +752,8 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 		 * bos to the global table and construct new relocs table with
 		 * corresponding reloc_idx
 		 */
-		if (msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT) {
-			relocs = handle_stateobj_relocs(ring, msm_cmd->ring,
-					relocs, nr_relocs);
-		}
+		if (msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT)
+			relocs = handle_stateobj_relocs(ring, msm_cmd->ring, msm_cmd);
 
 		cmd = &msm_ring->submit.cmds[i];
 		cmd->relocs = VOID2U64(relocs);
@@ -513,8 +768,13 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 
 	DEBUG_MSG("nr_cmds=%u, nr_bos=%u", req.nr_cmds, req.nr_bos);
 
+	if (ring->pipe->dev->capture)
+		capture_submit(msm_ring, msm_pipe->queue_id);
+
 	ret = drmCommandWriteRead(ring->pipe->dev->fd, DRM_MSM_GEM_SUBMIT,
 			&req, sizeof(req));
+
+
 	if (ret) {
 		ERROR_MSG("submit failed: %d (%s)", ret, strerror(errno));
 		dump_submit(msm_ring);
@@ -523,6 +783,7 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 		for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
 			struct msm_cmd *msm_cmd = msm_ring->cmds[i];
 			msm_cmd->ring->last_timestamp = req.fence;
+			fd_bo_ring_submitted(msm_cmd->ring_bo, ring->pipe, req.fence);
 		}
 
 		if (out_fence_fd) {
@@ -530,13 +791,14 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 		}
 	}
 
-	/* free dynamically constructed stateobj relocs tables: */
+	/* done with the stateobj reloc's tables this submit owned, hand them
+	 * back:
+	 */
 	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
-		struct drm_msm_gem_submit_cmd *cmd = &msm_ring->submit.cmds[i];
 		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
-		if (msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT) {
-			free(U642VOID(cmd->relocs));
-		}
+
+		if (msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT)
+			atomic_cmpxchg(&msm_cmd->submit_owner, msm_ring->seqno, 0);
 	}
 
 	flush_reset(ring);
@@ -671,10 +933,12 @@ static void msm_ringbuffer_destroy(struct fd_ringbuffer *ring)
 	flush_reset(ring);
 	delete_cmds(msm_ring);
 
+	free(msm_ring->bo_table);
 	free(msm_ring->submit.cmds);
 	free(msm_ring->submit.bos);
 	free(msm_ring->bos);
 	free(msm_ring->cmds);
+	free(msm_ring->private_relocs);
 	free(msm_ring);
 }
 
@@ -708,7 +972,7 @@ drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 	}
 
 	list_inithead(&msm_ring->cmd_list);
-	msm_ring->seqno = ++to_msm_device(pipe->dev)->ring_cnt;
+	msm_ring->seqno = atomic_inc_return(&to_msm_device(pipe->dev)->ring_cnt);
 
 	ring = &msm_ring->base;
 	atomic_set(&ring->refcnt, 1);
@@ -35,49 +35,69 @@ towrite = sys.argv[2]
 fm_re = {
     'intel': r'^#define I915_FORMAT_MOD_(\w+)',
     'others': r'^#define DRM_FORMAT_MOD_((?:ARM|SAMSUNG|QCOM|VIVANTE|NVIDIA|BROADCOM|ALLWINNER)\w+)\s',
-    'vendors': r'^#define DRM_FORMAT_MOD_VENDOR_(\w+)'
+    'vendors': r'^#define DRM_FORMAT_MOD_VENDOR_(\w+)\s+(\w+)'
 }
 
-def print_fm_intel(f, f_mod):
-    f.write('    {{ DRM_MODIFIER_INTEL({}, {}) }},\n'.format(f_mod, f_mod))
-
-# generic write func
-def print_fm(f, vendor, mod, f_name):
-    f.write('    {{ DRM_MODIFIER({}, {}, {}) }},\n'.format(vendor, mod, f_name))
-
 with open(filename, "r") as f:
     data = f.read()
     for k, v in fm_re.items():
         fm_re[k] = re.findall(v, data, flags=re.M)
 
+# Group the modifiers by vendor, in vendor id order, so that lookups only have
+# to scan the entries of the modifier's vendor.
+vendor_ids = {name: int(value, 0) for (name, value) in fm_re['vendors']}
+modifiers = {name: [] for name in vendor_ids}
+modifiers['NONE'] += [
+    'DRM_MODIFIER_INVALID(NONE, INVALID_MODIFIER)',
+    'DRM_MODIFIER_LINEAR(NONE, LINEAR)',
+]
+
+for entry in fm_re['intel']:
+    modifiers['INTEL'].append('DRM_MODIFIER_INTEL({}, {})'.format(entry, entry))
+
+for entry in fm_re['others']:
+    (vendor, mod) = entry.split('_', 1)
+    if vendor == 'ARM' and (mod == 'TYPE_AFBC' or mod == 'TYPE_MISC'):
+        continue
+    modifiers[vendor].append('DRM_MODIFIER({}, {}, {})'.format(vendor, mod, mod))
+
+vendors = sorted(vendor_ids, key=lambda name: vendor_ids[name])
+
 with open(towrite, "w") as f:
     f.write('''\
 /* AUTOMATICALLY GENERATED by gen_table_fourcc.py. You should modify
    that script instead of adding here entries manually! */
 static const struct drmFormatModifierInfo drm_format_modifier_table[] = {
 ''')
-    f.write('    { DRM_MODIFIER_INVALID(NONE, INVALID_MODIFIER) },\n')
-    f.write('    { DRM_MODIFIER_LINEAR(NONE, LINEAR) },\n')
 
-    for entry in fm_re['intel']:
-        print_fm_intel(f, entry)
+    for vendor in vendors:
+        for entry in modifiers[vendor]:
+            f.write('    {{ {} }},\n'.format(entry))
+
+    f.write('''\
+};
+''')
+
+    f.write('''\
+static const struct drmFormatModifierRange drm_format_modifier_vendor_ranges[] = {
+''')
 
-    for entry in fm_re['others']:
-        (vendor, mod) = entry.split('_', 1)
-        if vendor == 'ARM' and (mod == 'TYPE_AFBC' or mod == 'TYPE_MISC'):
-            continue
-        print_fm(f, vendor, mod, mod)
+    first = 0
+    for vendor in vendors:
+        f.write('    [DRM_FORMAT_MOD_VENDOR_{}] = {{ {}, {} }},\n'.format(
+                vendor, first, len(modifiers[vendor])))
+        first += len(modifiers[vendor])
 
     f.write('''\
 };
 ''')
 
     f.write('''\
-static const struct drmFormatModifierVendorInfo drm_format_modifier_vendor_table[] = {
+static const char *const drm_format_modifier_vendor_names[] = {
 ''')
 
-    for entry in fm_re['vendors']:
-        f.write("    {{ DRM_FORMAT_MOD_VENDOR_{}, \"{}\" }},\n".format(entry, entry))
+    for vendor in vendors:
+        f.write("    [DRM_FORMAT_MOD_VENDOR_{}] = \"{}\",\n".format(vendor, vendor))
 
     f.write('''\
 };
@@ -0,0 +1,456 @@
+/*
+ * Copyright © 2007 Red Hat Inc.
+ * Copyright © 2007-2012 Intel Corporation
+ * Copyright 2006 Tungsten Graphics, Inc., Bismarck, ND., USA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmarks for the GEM buffer manager, run against a mock i915 ioctl
+ * backend so that they measure libdrm_intel and not the kernel.
+ *
+ * The mock replaces ioctl() for the whole process: every DRM ioctl issued by
+ * libdrm is answered here, and counted.  It has to be exported for libdrm.so
+ * to bind to it, hence drm_public.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "libdrm_macros.h"
+#include "xf86atomic.h"
+#include "intel_bufmgr.h"
+#include "i915_drm.h"
+
+#define MOCK_FD		1000
+#define MOCK_DEVID	0x1912	/* SKL GT2 */
+
+static atomic_t mock_handle = { 0 };
+static atomic_t mock_ioctls = { 0 };
+static atomic_t mock_pwrites = { 0 };
+static atomic_t mock_mmaps = { 0 };
+static atomic_t mock_set_domains = { 0 };
+static bool mock_busy;
+
+drm_public int
+ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd != MOCK_FD) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	atomic_inc(&mock_ioctls);
+
+	switch (request) {
+	case DRM_IOCTL_I915_GETPARAM: {
+		drm_i915_getparam_t *gp = arg;
+
+		switch (gp->param) {
+		case I915_PARAM_CHIPSET_ID:
+			*gp->value = MOCK_DEVID;
+			return 0;
+		case I915_PARAM_HAS_EXECBUF2:
+		case I915_PARAM_HAS_LLC:
+		case I915_PARAM_HAS_WAIT_TIMEOUT:
+		case I915_PARAM_HAS_EXEC_SOFTPIN:
+			*gp->value = 1;
+			return 0;
+		default:
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	case DRM_IOCTL_I915_GEM_GET_APERTURE: {
+		struct drm_i915_gem_get_aperture *aperture = arg;
+
+		aperture->aper_size = 4ull << 30;
+		aperture->aper_available_size = 4ull << 30;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_CREATE: {
+		struct drm_i915_gem_create *create = arg;
+
+		create->handle = atomic_inc_return(&mock_handle);
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_MADVISE: {
+		struct drm_i915_gem_madvise *madv = arg;
+
+		madv->retained = 1;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_BUSY: {
+		struct drm_i915_gem_busy *busy = arg;
+
+		busy->busy = mock_busy;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_GET_CACHING: {
+		struct drm_i915_gem_caching *caching = arg;
+
+		caching->caching = I915_CACHING_CACHED;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_MMAP: {
+		struct drm_i915_gem_mmap *mmap_arg = arg;
+		void *map;
+
+		map = mmap(NULL, mmap_arg->size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map == MAP_FAILED)
+			return -1;
+		mmap_arg->addr_ptr = (uintptr_t)map;
+		atomic_inc(&mock_mmaps);
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_PWRITE:
+		atomic_inc(&mock_pwrites);
+		return 0;
+	case DRM_IOCTL_I915_GEM_SET_DOMAIN:
+		atomic_inc(&mock_set_domains);
+		return 0;
+	case DRM_IOCTL_I915_GEM_SW_FINISH:
+	case DRM_IOCTL_I915_GEM_SET_TILING:
+	case DRM_IOCTL_I915_GEM_GET_TILING:
+	case DRM_IOCTL_GEM_CLOSE:
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static drm_intel_bufmgr *
+create_bufmgr(void)
+{
+	drm_intel_bufmgr *bufmgr;
+
+	bufmgr = drm_intel_bufmgr_gem_init(MOCK_FD, 4096);
+	if (!bufmgr)
+		errx(1, "failed to create the GEM buffer manager");
+	drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+
+	return bufmgr;
+}
+
+/*
+ * bo-cache: every thread allocates a small working set of BOs of mixed
+ * sizes, frees it, and starts over, which is what a driver streaming vertex
+ * and constant buffers does.
+ */
+#define BO_CACHE_WORKING_SET	8
+
+struct bo_cache_thread {
+	pthread_t thread;
+	drm_intel_bufmgr *bufmgr;
+	int iterations;
+	unsigned int seed;
+};
+
+static void *
+bo_cache_thread(void *data)
+{
+	struct bo_cache_thread *t = data;
+	drm_intel_bo *bos[BO_CACHE_WORKING_SET];
+	int i, j;
+
+	for (i = 0; i < t->iterations; i++) {
+		for (j = 0; j < BO_CACHE_WORKING_SET; j++) {
+			unsigned long size = 4096 << (rand_r(&t->seed) % 6);
+
+			bos[j] = drm_intel_bo_alloc(t->bufmgr, "bench", size, 0);
+			if (!bos[j])
+				errx(1, "allocation failed");
+		}
+		for (j = 0; j < BO_CACHE_WORKING_SET; j++)
+			drm_intel_bo_unreference(bos[j]);
+	}
+
+	return NULL;
+}
+
+static void
+bench_bo_cache(int num_threads, int iterations)
+{
+	struct bo_cache_thread *threads;
+	struct drm_intel_bo_cache_stats stats;
+	drm_intel_bufmgr *bufmgr = create_bufmgr();
+	double start, elapsed;
+	int ioctls, ops, i;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads)
+		errx(1, "out of memory");
+
+	ioctls = atomic_read(&mock_ioctls);
+	start = get_time();
+	for (i = 0; i < num_threads; i++) {
+		threads[i].bufmgr = bufmgr;
+		threads[i].iterations = iterations;
+		threads[i].seed = i;
+		if (pthread_create(&threads[i].thread, NULL, bo_cache_thread,
+				   &threads[i]))
+			errx(1, "failed to create thread");
+	}
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	elapsed = get_time() - start;
+	ioctls = atomic_read(&mock_ioctls) - ioctls;
+
+	ops = num_threads * iterations * BO_CACHE_WORKING_SET;
+	printf("bo-cache: %d threads, %d alloc/free pairs in %.3fs: "
+	       "%.2f Mops/s, %.2f ioctls per pair\n",
+	       num_threads, ops, elapsed, ops / elapsed / 1e6,
+	       (double)ioctls / ops);
+
+	drm_intel_bufmgr_gem_get_bo_cache_stats(bufmgr, &stats);
+	printf("bo-cache: %" PRIu64 " hits, %" PRIu64 " misses, "
+	       "%" PRIu64 " bytes cached\n",
+	       stats.hits, stats.misses, stats.bytes_cached);
+
+	drm_intel_bufmgr_destroy(bufmgr);
+	free(threads);
+}
+
+/*
+ * reloc-dag: a batch pointing at @depth layers of @width BOs, each BO
+ * pointing at every BO of the next layer, as happens with instanced state
+ * that shares most of its indirect state.  The query looks for a BO that
+ * isn't in the tree, so every query has to walk all of it.
+ */
+static void
+bench_reloc_dag(int width, int depth, int iterations)
+{
+	drm_intel_bufmgr *bufmgr = create_bufmgr();
+	drm_intel_bo **bos, *batch, *other, *unused;
+	double start, elapsed;
+	int i, j, k, found = 0;
+
+	bos = calloc(width * depth, sizeof(*bos));
+	if (!bos)
+		errx(1, "out of memory");
+
+	batch = drm_intel_bo_alloc(bufmgr, "batch", 4096, 0);
+	other = drm_intel_bo_alloc(bufmgr, "other", 4096, 0);
+	unused = drm_intel_bo_alloc(bufmgr, "unused", 4096, 0);
+	for (i = 0; i < width * depth; i++)
+		bos[i] = drm_intel_bo_alloc(bufmgr, "state", 4096, 0);
+	if (!batch || !other || !unused)
+		errx(1, "allocation failed");
+
+	/* Make "unused" a relocation target, so the lookup can't be skipped */
+	drm_intel_bo_emit_reloc(other, 0, unused, 0,
+				I915_GEM_DOMAIN_RENDER, 0);
+
+	for (i = depth - 1; i >= 0; i--) {
+		for (j = 0; j < width; j++) {
+			drm_intel_bo *bo = bos[i * width + j];
+
+			for (k = 0; k < width && i + 1 < depth; k++) {
+				drm_intel_bo_emit_reloc(bo, 4 * k,
+							bos[(i + 1) * width + k],
+							0, I915_GEM_DOMAIN_RENDER,
+							0);
+			}
+		}
+	}
+	for (j = 0; j < width; j++)
+		drm_intel_bo_emit_reloc(batch, 4 * j, bos[j], 0,
+					I915_GEM_DOMAIN_RENDER, 0);
+
+	start = get_time();
+	for (i = 0; i < iterations; i++)
+		found += drm_intel_bo_references(batch, unused);
+	elapsed = get_time() - start;
+	if (found)
+		errx(1, "unexpected reference to an unused BO");
+
+	printf("reloc-dag: %dx%d BOs, %d queries in %.3fs: %.2f us/query\n",
+	       width, depth, iterations, elapsed, elapsed * 1e6 / iterations);
+
+	drm_intel_bo_unreference(batch);
+	drm_intel_bo_unreference(other);
+	drm_intel_bo_unreference(unused);
+	for (i = 0; i < width * depth; i++)
+		drm_intel_bo_unreference(bos[i]);
+	drm_intel_bufmgr_destroy(bufmgr);
+	free(bos);
+}
+
+/*
+ * upload: drm_intel_bo_subdata() of @size bytes, first with the default
+ * upload map size, then with mappings enabled from 4 KiB, to an idle and to
+ * a busy BO.  Checks the path each one takes, and that uploads through a
+ * mapping leave the BO unmapped, so that it goes back to the BO cache.
+ */
+static void
+check_upload(drm_intel_bufmgr *bufmgr, const char *what, drm_intel_bo *bo,
+	     const void *data, unsigned long size, int iterations,
+	     int pwrites, int mmaps, int set_domains)
+{
+	double start, elapsed;
+	int p, m, d, i;
+
+	p = atomic_read(&mock_pwrites);
+	m = atomic_read(&mock_mmaps);
+	d = atomic_read(&mock_set_domains);
+	start = get_time();
+	for (i = 0; i < iterations; i++) {
+		if (drm_intel_bo_subdata(bo, 0, size, data))
+			errx(1, "%s: upload failed", what);
+	}
+	elapsed = get_time() - start;
+	p = atomic_read(&mock_pwrites) - p;
+	m = atomic_read(&mock_mmaps) - m;
+	d = atomic_read(&mock_set_domains) - d;
+
+	printf("upload: %s: %d x %lu bytes in %.3fs, "
+	       "%d pwrites, %d mmaps, %d set-domains\n",
+	       what, iterations, size, elapsed, p, m, d);
+	if (p != pwrites || m != mmaps || d != set_domains)
+		errx(1, "%s: expected %d pwrites, %d mmaps, %d set-domains",
+		     what, pwrites, mmaps, set_domains);
+}
+
+static void
+bench_upload(unsigned long size, int iterations)
+{
+	drm_intel_bufmgr *bufmgr = create_bufmgr();
+	struct drm_intel_upload_stats upload_stats;
+	struct drm_intel_bo_cache_stats stats;
+	drm_intel_bo *bo, *mapped, *busy;
+	uint64_t hits;
+	void *data;
+
+	data = calloc(1, size);
+	if (!data)
+		errx(1, "out of memory");
+
+	drm_intel_bufmgr_gem_enable_upload_stats(bufmgr);
+
+	/* The default stays pwrite, even when the BO is mapped already */
+	mapped = drm_intel_bo_alloc(bufmgr, "mapped", size, 0);
+	if (!mapped || !drm_intel_gem_bo_map__wc(mapped))
+		errx(1, "allocation failed");
+	check_upload(bufmgr, "default", mapped, data, size, iterations,
+		     iterations, 0, 0);
+
+	drm_intel_bufmgr_gem_set_upload_map_size(bufmgr, 4096);
+	check_upload(bufmgr, "mapped", mapped, data, size, iterations,
+		     0, 0, iterations);
+
+	/* The mapping is created once and kept by the VMA cache */
+	bo = drm_intel_bo_alloc(bufmgr, "upload", size, 0);
+	if (!bo)
+		errx(1, "allocation failed");
+	check_upload(bufmgr, "idle", bo, data, size, iterations,
+		     0, 1, iterations);
+
+	/* A BO that was seen idle stays so until its next execbuffer */
+	busy = drm_intel_bo_alloc(bufmgr, "busy", size, 0);
+	if (!busy)
+		errx(1, "allocation failed");
+	mock_busy = true;
+	check_upload(bufmgr, "busy", busy, data, size, iterations,
+		     iterations, 0, 0);
+	mock_busy = false;
+
+	drm_intel_bufmgr_gem_get_upload_stats(bufmgr, &upload_stats);
+	if (upload_stats.count[DRM_INTEL_UPLOAD_PWRITE] != 2u * iterations ||
+	    upload_stats.count[DRM_INTEL_UPLOAD_WC_MMAP] != (unsigned)iterations ||
+	    upload_stats.count[DRM_INTEL_UPLOAD_CPU_MMAP] != (unsigned)iterations ||
+	    upload_stats.bytes[DRM_INTEL_UPLOAD_PWRITE] != 2ull * iterations * size)
+		errx(1, "unexpected upload stats");
+
+	drm_intel_bufmgr_gem_get_bo_cache_stats(bufmgr, &stats);
+	hits = stats.hits;
+	drm_intel_bo_unreference(bo);
+	bo = drm_intel_bo_alloc(bufmgr, "upload", size, 0);
+	drm_intel_bufmgr_gem_get_bo_cache_stats(bufmgr, &stats);
+	if (stats.hits != hits + 1)
+		errx(1, "uploaded BO didn't go back to the BO cache");
+
+	drm_intel_bo_unreference(bo);
+	drm_intel_bo_unreference(busy);
+	drm_intel_bo_unreference(mapped);
+	drm_intel_bufmgr_destroy(bufmgr);
+	free(data);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage:\n");
+	fprintf(stderr, "  bench_bufmgr_gem bo-cache [threads] [iterations]\n");
+	fprintf(stderr, "  bench_bufmgr_gem reloc-dag [width] [depth] [iterations]\n");
+	fprintf(stderr, "  bench_bufmgr_gem upload [size] [iterations]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *name = argc > 1 ? argv[1] : "bo-cache";
+
+	if (strcmp(name, "bo-cache") == 0) {
+		bench_bo_cache(argc > 2 ? atoi(argv[2]) : 4,
+			       argc > 3 ? atoi(argv[3]) : 100000);
+	} else if (strcmp(name, "reloc-dag") == 0) {
+		bench_reloc_dag(argc > 2 ? atoi(argv[2]) : 4,
+				argc > 3 ? atoi(argv[3]) : 10,
+				argc > 4 ? atoi(argv[4]) : 100);
+	} else if (strcmp(name, "upload") == 0) {
+		bench_upload(argc > 2 ? strtoul(argv[2], NULL, 0) : 65536,
+			     argc > 3 ? atoi(argv[3]) : 1000);
+	} else {
+		usage();
+	}
+
+	return 0;
+}
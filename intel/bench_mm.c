@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 1999 Wittawat Yamwong
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Replays an allocation trace against the heap manager used for the fake
+ * buffer manager's aperture, and reports its speed and how fragmented the
+ * heap gets.
+ *
+ * A trace is a list of lines, either "a <id> <size> <align2>" to allocate
+ * or "f <id>" to free what was allocated as <id>.  Without a trace file, two
+ * are made up for a 64MB aperture:
+ *
+ * - random: BOs of 4KB to 2MB, some of them 64KB aligned, kept to about 90%
+ *   of the aperture.
+ * - holes: the last 16 of a stream of 64KB to 448KB BOs are kept in the
+ *   first quarter of the aperture, while the rest of it has been left as 4KB
+ *   holes between 4KB BOs, freed after the first quarter.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <time.h>
+
+#include "mm.h"
+
+#define HEAP_SIZE	(64 << 20)
+
+struct trace_op {
+	bool alloc;
+	int id;
+	int size;
+	int align2;
+};
+
+struct trace {
+	struct trace_op *ops;
+	int num_ops, max_ops;
+	int num_ids;
+};
+
+static struct trace_op *
+trace_add(struct trace *trace)
+{
+	if (trace->num_ops == trace->max_ops) {
+		trace->max_ops = trace->max_ops ? trace->max_ops * 2 : 1024;
+		trace->ops = realloc(trace->ops,
+				     trace->max_ops * sizeof(*trace->ops));
+		if (!trace->ops)
+			errx(1, "out of memory");
+	}
+
+	/* ops are frees unless set up otherwise */
+	memset(&trace->ops[trace->num_ops], 0, sizeof(*trace->ops));
+	return &trace->ops[trace->num_ops++];
+}
+
+static void
+trace_generate(struct trace *trace, int num_ops)
+{
+	unsigned int seed = 1;
+	int *live, num_live = 0;
+	long live_bytes = 0;
+	int *sizes;
+
+	live = calloc(num_ops, sizeof(*live));
+	sizes = calloc(num_ops, sizeof(*sizes));
+	if (!live || !sizes)
+		errx(1, "out of memory");
+
+	while (trace->num_ops < num_ops) {
+		struct trace_op *op;
+		bool alloc;
+
+		alloc = num_live == 0 ||
+			(live_bytes < HEAP_SIZE / 10 * 9 && rand_r(&seed) % 2);
+
+		op = trace_add(trace);
+		op->alloc = alloc;
+		if (alloc) {
+			int pages = 1 << (rand_r(&seed) % 10);
+
+			pages += rand_r(&seed) % pages;
+			op->id = trace->num_ids++;
+			op->size = pages * 4096;
+			op->align2 = rand_r(&seed) % 8 ? 12 : 16;
+
+			sizes[op->id] = op->size;
+			live[num_live++] = op->id;
+			live_bytes += op->size;
+		} else {
+			int i = rand_r(&seed) % num_live;
+
+			op->id = live[i];
+			live[i] = live[--num_live];
+			live_bytes -= sizes[op->id];
+		}
+	}
+
+	free(live);
+	free(sizes);
+}
+
+static void
+trace_generate_holes(struct trace *trace, int num_ops)
+{
+	struct trace_op *op;
+	int first, i;
+
+	op = trace_add(trace);
+	op->alloc = true;
+	op->id = trace->num_ids++;
+	op->size = HEAP_SIZE / 4;
+	op->align2 = 12;
+	for (i = 0; i < HEAP_SIZE / 4 * 3 / 4096; i++) {
+		op = trace_add(trace);
+		op->alloc = true;
+		op->id = trace->num_ids++;
+		op->size = 4096;
+		op->align2 = 12;
+	}
+
+	op = trace_add(trace);
+	op->id = 0;
+	for (i = 1; i < trace->num_ids; i += 2) {
+		op = trace_add(trace);
+		op->id = i;
+	}
+
+	first = trace->num_ids;
+	while (trace->num_ops < num_ops) {
+		op = trace_add(trace);
+		op->alloc = true;
+		op->id = trace->num_ids++;
+		op->size = (op->id % 7 + 1) * 64 * 1024;
+		op->align2 = 12;
+
+		if (op->id - first >= 16) {
+			op = trace_add(trace);
+			op->id = trace->num_ids - 1 - 16;
+		}
+	}
+}
+
+static void
+trace_read(struct trace *trace, const char *filename)
+{
+	char line[128];
+	FILE *file;
+
+	file = fopen(filename, "r");
+	if (!file)
+		errx(1, "couldn't open `%s'", filename);
+
+	while (fgets(line, sizeof(line), file)) {
+		struct trace_op op = { 0 };
+
+		if (sscanf(line, "a %d %d %d", &op.id, &op.size,
+			   &op.align2) == 3)
+			op.alloc = true;
+		else if (sscanf(line, "f %d", &op.id) != 1)
+			continue;
+		if (op.id < 0)
+			errx(1, "bad id in `%s'", line);
+
+		*trace_add(trace) = op;
+		if (op.id >= trace->num_ids)
+			trace->num_ids = op.id + 1;
+	}
+
+	fclose(file);
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* 1 - largest free block / free space: 0 is a single free block */
+static double
+fragmentation(struct mem_block *heap)
+{
+	struct mem_block *p;
+	long free_bytes = 0, largest = 0;
+
+	for (p = heap->next; p != heap; p = p->next) {
+		if (!p->free)
+			continue;
+		free_bytes += p->size;
+		if (p->size > largest)
+			largest = p->size;
+	}
+
+	return free_bytes ? 1.0 - (double)largest / free_bytes : 0.0;
+}
+
+static int
+compare_ofs(const void *a, const void *b)
+{
+	const struct mem_block *pa = *(struct mem_block * const *)a;
+	const struct mem_block *pb = *(struct mem_block * const *)b;
+
+	return pa->ofs < pb->ofs ? -1 : pa->ofs > pb->ofs;
+}
+
+/*
+ * Checks that the live allocations are allocated and never overlap, and
+ * that the heap's free lists agree with its block list.
+ */
+static void
+check(const char *name, struct mem_block *heap, struct mem_block **blocks,
+      int num_ids, struct mem_block **sorted)
+{
+	int i, n = 0;
+
+	for (i = 0; i < num_ids; i++) {
+		if (!blocks[i])
+			continue;
+		if (blocks[i]->free)
+			errx(1, "%s: allocation %d is free", name, i);
+		sorted[n++] = blocks[i];
+	}
+
+	qsort(sorted, n, sizeof(*sorted), compare_ofs);
+	for (i = 1; i < n; i++) {
+		if (sorted[i - 1]->ofs + sorted[i - 1]->size > sorted[i]->ofs)
+			errx(1, "%s: allocations at 0x%x and 0x%x overlap",
+			     name, sorted[i - 1]->ofs, sorted[i]->ofs);
+	}
+
+	if (mmCheckHeap(heap))
+		errx(1, "%s: free lists don't match the heap", name);
+}
+
+static void
+replay(const char *name, const struct trace *trace)
+{
+	struct mem_block **blocks, **sorted, *heap;
+	int failed = 0, samples = 0, allocs = 0, i;
+	double elapsed, frag = 0.0, max_frag = 0.0;
+
+	blocks = calloc(trace->num_ids, sizeof(*blocks));
+	sorted = calloc(trace->num_ids, sizeof(*sorted));
+	heap = mmInit(0, HEAP_SIZE);
+	if (!blocks || !sorted || !heap)
+		errx(1, "out of memory");
+
+	/* Timed replay */
+	elapsed = get_time();
+	for (i = 0; i < trace->num_ops; i++) {
+		const struct trace_op *op = &trace->ops[i];
+
+		if (op->alloc) {
+			blocks[op->id] = mmAllocMem(heap, op->size,
+						    op->align2, 0);
+		} else {
+			mmFreeMem(blocks[op->id]);
+			blocks[op->id] = NULL;
+		}
+	}
+	elapsed = get_time() - elapsed;
+
+	for (i = 0; i < trace->num_ids; i++) {
+		mmFreeMem(blocks[i]);
+		blocks[i] = NULL;
+	}
+
+	/* Untimed replay, sampling the fragmentation and checking the heap as
+	 * it goes
+	 */
+	for (i = 0; i < trace->num_ops; i++) {
+		const struct trace_op *op = &trace->ops[i];
+
+		if (op->alloc) {
+			blocks[op->id] = mmAllocMem(heap, op->size,
+						    op->align2, 0);
+			allocs++;
+			if (!blocks[op->id])
+				failed++;
+		} else {
+			mmFreeMem(blocks[op->id]);
+			blocks[op->id] = NULL;
+		}
+
+		if (i % 1024 == 0) {
+			double f = fragmentation(heap);
+
+			frag += f;
+			if (f > max_frag)
+				max_frag = f;
+			samples++;
+
+			check(name, heap, blocks, trace->num_ids, sorted);
+		}
+	}
+	check(name, heap, blocks, trace->num_ids, sorted);
+
+	printf("%s: %d ops in %.3fs: %.2f Mops/s\n",
+	       name, trace->num_ops, elapsed, trace->num_ops / elapsed / 1e6);
+	printf("%s: %d of %d allocations failed, fragmentation %.1f%% "
+	       "average, %.1f%% worst\n",
+	       name, failed, allocs, 100.0 * frag / samples, 100.0 * max_frag);
+
+	for (i = 0; i < trace->num_ids; i++)
+		mmFreeMem(blocks[i]);
+	mmDestroy(heap);
+	free(blocks);
+	free(sorted);
+}
+
+static void
+run(const char *name)
+{
+	struct trace trace = { 0 };
+
+	if (strcmp(name, "random") == 0)
+		trace_generate(&trace, 1000000);
+	else if (strcmp(name, "holes") == 0)
+		trace_generate_holes(&trace, 200000);
+	else
+		trace_read(&trace, name);
+
+	replay(name, &trace);
+
+	free(trace.ops);
+}
+
+int
+main(int argc, char **argv)
+{
+	int i;
+
+	if (argc == 1) {
+		run("random");
+		run("holes");
+	}
+	for (i = 1; i < argc; i++)
+		run(argv[i]);
+
+	return 0;
+}
@@ -178,8 +178,54 @@ drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						unsigned int handle);
 void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
+void drm_intel_bufmgr_gem_enable_fast_relocs(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+void drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					      uint64_t limit);
+
+struct drm_intel_bo_cache_stats {
+	/** Size of the BOs sitting in the cache */
+	uint64_t bytes_cached;
+	/** Allocations served from the cache */
+	uint64_t hits;
+	/** Allocations that needed a new BO */
+	uint64_t misses;
+	/** Cached BOs whose pages had been reclaimed by the kernel */
+	uint64_t purged;
+	/** Cached BOs released to honour the cache size limit */
+	uint64_t evicted;
+};
+
+void drm_intel_bufmgr_gem_set_bo_cache_size(drm_intel_bufmgr *bufmgr,
+					    uint64_t max_bytes);
+void drm_intel_bufmgr_gem_trim_bo_cache(drm_intel_bufmgr *bufmgr,
+					uint64_t max_bytes);
+void drm_intel_bufmgr_gem_get_bo_cache_stats(drm_intel_bufmgr *bufmgr,
+					     struct drm_intel_bo_cache_stats *stats);
+
+enum drm_intel_upload_path {
+	DRM_INTEL_UPLOAD_PWRITE,
+	DRM_INTEL_UPLOAD_CPU_MMAP,
+	DRM_INTEL_UPLOAD_WC_MMAP,
+	DRM_INTEL_UPLOAD_NUM_PATHS
+};
+
+/**
+ * drm_intel_bo_subdata() uploads, by path taken, once enabled with
+ * drm_intel_bufmgr_gem_enable_upload_stats()
+ */
+struct drm_intel_upload_stats {
+	uint64_t count[DRM_INTEL_UPLOAD_NUM_PATHS];
+	uint64_t bytes[DRM_INTEL_UPLOAD_NUM_PATHS];
+};
+
+void drm_intel_bufmgr_gem_set_upload_map_size(drm_intel_bufmgr *bufmgr,
+					      unsigned long size);
+int drm_intel_bufmgr_gem_calibrate_upload(drm_intel_bufmgr *bufmgr);
+void drm_intel_bufmgr_gem_enable_upload_stats(drm_intel_bufmgr *bufmgr);
+void drm_intel_bufmgr_gem_get_upload_stats(drm_intel_bufmgr *bufmgr,
+					   struct drm_intel_upload_stats *stats);
 int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
@@ -276,6 +322,54 @@ void drm_intel_decode_set_dump_past_end(struct drm_intel_decode *ctx,
 void drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 				    uint32_t head, uint32_t tail);
 void drm_intel_decode_set_output_file(struct drm_intel_decode *ctx, FILE *out);
+void drm_intel_decode_set_threads(struct drm_intel_decode *ctx,
+				  int num_threads);
+
+enum drm_intel_decode_field_type {
+	DRM_INTEL_DECODE_FIELD_STRING,
+	DRM_INTEL_DECODE_FIELD_INT,
+	DRM_INTEL_DECODE_FIELD_FLOAT,
+};
+
+/** A field decoded from a packet, as it appears in the text output */
+struct drm_intel_decode_field {
+	/** DWORD of the packet it was decoded from */
+	uint32_t dword;
+	enum drm_intel_decode_field_type type;
+	/** Label of the field, or NULL if it has none */
+	const char *name;
+	/** Value as formatted in the text output */
+	const char *value;
+	/** Value of DRM_INTEL_DECODE_FIELD_INT fields */
+	int64_t int_value;
+	/** Value of DRM_INTEL_DECODE_FIELD_FLOAT fields */
+	double float_value;
+};
+
+/** A packet walked by drm_intel_decode() */
+struct drm_intel_decode_packet {
+	/** GPU address of the packet */
+	uint32_t hw_offset;
+	/** The packet's DWORDs, only valid during the callback */
+	const uint32_t *data;
+	/** Length of the packet in DWORDs */
+	uint32_t length;
+	/**
+	 * Packet name from the decoder's opcode tables, or NULL if the
+	 * decoder doesn't know the packet.
+	 */
+	const char *name;
+	/** Decoded fields, in DWORD order, only valid during the callback */
+	const struct drm_intel_decode_field *fields;
+	uint32_t num_fields;
+};
+
+typedef void (*drm_intel_decode_packet_func)(void *data,
+		const struct drm_intel_decode_packet *packet);
+
+void drm_intel_decode_set_packet_callback(struct drm_intel_decode *ctx,
+					  drm_intel_decode_packet_func func,
+					  void *data);
 void drm_intel_decode(struct drm_intel_decode *ctx);
 
 int drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
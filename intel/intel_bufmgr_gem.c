@@ -40,6 +40,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <assert.h>
 #include <pthread.h>
@@ -58,6 +60,7 @@
 #include "intel_bufmgr_priv.h"
 #include "intel_chipset.h"
 #include "string.h"
+#include "util_bo_cache.h"
 
 #include "i915_drm.h"
 #include "uthash.h"
@@ -98,9 +101,30 @@
 
 typedef struct _drm_intel_bo_gem drm_intel_bo_gem;
 
-struct drm_intel_gem_bo_bucket {
-	drmMMListHead head;
-	unsigned long size;
+/*
+ * Per-thread cache of recently freed small BOs, consulted before the shared
+ * buckets without taking bufmgr_gem->lock. Cached BOs are kept
+ * I915_MADV_WILLNEED, and are moved to the shared buckets in batches.
+ */
+#define FRONT_CACHE_SIZE	16
+#define FRONT_CACHE_MAX_BO_SIZE	(256 * 1024)
+
+struct drm_intel_gem_front_cache {
+	struct _drm_intel_bufmgr_gem *bufmgr_gem;
+	drmMMListHead link;
+	/** Oldest first */
+	drm_intel_bo_gem *bos[FRONT_CACHE_SIZE];
+	int count;
+	/** Allocations served, not yet added to the bufmgr stats */
+	atomic_t hits;
+};
+
+/** Kinds of BO mappings, indexing bufmgr_gem->vma_bytes */
+enum {
+	VMA_CPU,
+	VMA_WC,
+	VMA_GTT,
+	VMA_NUM_TYPES,
 };
 
 typedef struct _drm_intel_bufmgr_gem {
@@ -120,10 +144,13 @@ typedef struct _drm_intel_bufmgr_gem {
 	int exec_size;
 	int exec_count;
 
-	/** Array of lists of cached gem objects of power-of-two sizes */
-	struct drm_intel_gem_bo_bucket cache_bucket[14 * 4];
-	int num_buckets;
-	time_t time;
+	/** Cached gem objects, in buckets of increasing sizes */
+	struct util_bo_cache bo_cache;
+
+	/** Per-thread struct drm_intel_gem_front_cache */
+	pthread_key_t front_cache_key;
+	bool has_front_cache;
+	drmMMListHead front_caches;
 
 	drmMMListHead managers;
 
@@ -132,6 +159,12 @@ typedef struct _drm_intel_bufmgr_gem {
 
 	drmMMListHead vma_cache;
 	int vma_count, vma_open, vma_max;
+	/** Size of the cached mappings, by mapping type */
+	uint64_t vma_bytes[VMA_NUM_TYPES];
+	uint64_t vma_max_bytes;
+
+	/** Serial of the last drm_intel_gem_bo_references() walk */
+	uint64_t references_serial;
 
 	uint64_t gtt_size;
 	int available_fences;
@@ -147,6 +180,15 @@ typedef struct _drm_intel_bufmgr_gem {
 	unsigned int has_vebox : 1;
 	unsigned int has_exec_async : 1;
 	bool fenced_relocs;
+	/** I915_EXEC_HANDLE_LUT | I915_EXEC_BATCH_FIRST | I915_EXEC_NO_RELOC,
+	 * whichever the kernel supports, once enabled by the user.
+	 */
+	unsigned int exec_fast_flags;
+
+	/** Smallest drm_intel_bo_subdata() upload worth creating a mapping */
+	unsigned long upload_map_size;
+	bool upload_stats_enabled;
+	struct drm_intel_upload_stats upload_stats;
 
 	struct {
 		void *ptr;
@@ -194,8 +236,6 @@ struct _drm_intel_bo_gem {
 
 	unsigned long kflags;
 
-	time_t free_time;
-
 	/** Array passed to the DRM containing relocation information. */
 	struct drm_i915_gem_relocation_entry *relocs;
 	/**
@@ -225,8 +265,11 @@ struct _drm_intel_bo_gem {
 	int map_count;
 	drmMMListHead vma_list;
 
-	/** BO cache list */
-	drmMMListHead head;
+	/** Links in bufmgr_gem->bo_cache while in the BO cache */
+	struct util_bo_cache_entry cache_entry;
+
+	/** Last drm_intel_gem_bo_references() walk that visited this BO */
+	uint64_t references_serial;
 
 	/**
 	 * Boolean of whether this BO and its children have been included in
@@ -392,23 +435,6 @@ drm_intel_gem_bo_tile_pitch(drm_intel_bufmgr_gem *bufmgr_gem,
 	return i;
 }
 
-static struct drm_intel_gem_bo_bucket *
-drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
-				 unsigned long size)
-{
-	int i;
-
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
-	}
-
-	return NULL;
-}
-
 static void
 drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem)
 {
@@ -681,23 +707,220 @@ drm_intel_gem_bo_madvise(drm_intel_bo *bo, int madv)
 		 madv);
 }
 
-/* drop the oldest entries that have been purged by the kernel */
+/* Puts a BO whose last reference was dropped into the BO cache. Returns
+ * false if it is too large to be cached.
+ */
+static bool
+drm_intel_gem_bo_cache_add(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo_gem *bo_gem, time_t time)
+{
+	bo_gem->name = NULL;
+	bo_gem->validate_index = -1;
+
+	return util_bo_cache_put(&bufmgr_gem->bo_cache, &bo_gem->cache_entry,
+				 bo_gem->bo.size, 0, time);
+}
+
+static inline drm_intel_bo_gem *
+to_bo_gem_cached(struct util_bo_cache_entry *entry)
+{
+	return (drm_intel_bo_gem *)
+		((char *)entry - offsetof(drm_intel_bo_gem, cache_entry));
+}
+
+static bool
+drm_intel_gem_bo_cache_is_idle(struct util_bo_cache_entry *entry)
+{
+	return !drm_intel_gem_bo_busy(&to_bo_gem_cached(entry)->bo);
+}
+
+static bool
+drm_intel_gem_bo_cache_madvise(struct util_bo_cache_entry *entry,
+			       bool willneed)
+{
+	drm_intel_bo_gem *bo_gem = to_bo_gem_cached(entry);
+
+	return drm_intel_gem_bo_madvise_internal
+		((drm_intel_bufmgr_gem *) bo_gem->bo.bufmgr, bo_gem,
+		 willneed ? I915_MADV_WILLNEED : I915_MADV_DONTNEED);
+}
+
 static void
-drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
-				    struct drm_intel_gem_bo_bucket *bucket)
+drm_intel_gem_bo_cache_evict(struct util_bo_cache_entry *entry)
 {
-	while (!DRMLISTEMPTY(&bucket->head)) {
-		drm_intel_bo_gem *bo_gem;
+	drm_intel_gem_bo_free(&to_bo_gem_cached(entry)->bo);
+}
 
-		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-				      bucket->head.next, head);
-		if (drm_intel_gem_bo_madvise_internal
-		    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED))
-			break;
+static const struct util_bo_cache_funcs drm_intel_gem_bo_cache_funcs = {
+	.is_idle = drm_intel_gem_bo_cache_is_idle,
+	.madvise = drm_intel_gem_bo_cache_madvise,
+	.evict = drm_intel_gem_bo_cache_evict,
+};
 
-		DRMLISTDEL(&bo_gem->head);
-		drm_intel_gem_bo_free(&bo_gem->bo);
+static void
+drm_intel_gem_bo_init_alloc(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo_gem *bo_gem,
+			    const char *name,
+			    unsigned int alignment)
+{
+	bo_gem->name = name;
+	atomic_set(&bo_gem->refcount, 1);
+	bo_gem->validate_index = -1;
+	bo_gem->reloc_tree_fences = 0;
+	bo_gem->used_as_reloc_target = false;
+	bo_gem->has_error = false;
+	bo_gem->reusable = true;
+
+	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, alignment);
+}
+
+static struct drm_intel_gem_front_cache *
+drm_intel_gem_front_cache(drm_intel_bufmgr_gem *bufmgr_gem, bool create)
+{
+	struct drm_intel_gem_front_cache *cache;
+
+	if (!bufmgr_gem->has_front_cache || !bufmgr_gem->bo_reuse)
+		return NULL;
+
+	cache = pthread_getspecific(bufmgr_gem->front_cache_key);
+	if (cache || !create)
+		return cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	if (pthread_setspecific(bufmgr_gem->front_cache_key, cache)) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->bufmgr_gem = bufmgr_gem;
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	DRMLISTADDTAIL(&cache->link, &bufmgr_gem->front_caches);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return cache;
+}
+
+/* Folds the hits counted by @cache into the bufmgr stats. Called with the
+ * lock held.
+ */
+static void
+drm_intel_gem_front_cache_collect_stats(drm_intel_bufmgr_gem *bufmgr_gem,
+					struct drm_intel_gem_front_cache *cache)
+{
+	int hits = atomic_read(&cache->hits);
+
+	atomic_dec(&cache->hits, hits);
+	bufmgr_gem->bo_cache.stats.hits += hits;
+}
+
+/* Moves the @count oldest BOs of @cache to the shared buckets. Called with
+ * the lock held.
+ */
+static void
+drm_intel_gem_front_cache_flush_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				       struct drm_intel_gem_front_cache *cache,
+				       int count, time_t time)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		drm_intel_gem_bo_cache_add(bufmgr_gem, cache->bos[i], time);
+
+	cache->count -= count;
+	memmove(cache->bos, cache->bos + count,
+		cache->count * sizeof(cache->bos[0]));
+
+	drm_intel_gem_front_cache_collect_stats(bufmgr_gem, cache);
+}
+
+static void
+drm_intel_gem_front_cache_destroy(void *data)
+{
+	struct drm_intel_gem_front_cache *cache = data;
+	drm_intel_bufmgr_gem *bufmgr_gem = cache->bufmgr_gem;
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_front_cache_flush_locked(bufmgr_gem, cache,
+					       cache->count, time.tv_sec);
+	DRMLISTDEL(&cache->link);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	free(cache);
+}
+
+static drm_intel_bo_gem *
+drm_intel_gem_front_cache_get(drm_intel_bufmgr_gem *bufmgr_gem,
+			      unsigned long bucket_size, bool for_render)
+{
+	struct drm_intel_gem_front_cache *cache;
+	drm_intel_bo_gem *bo_gem;
+	int i;
+
+	if (bucket_size == 0 || bucket_size > FRONT_CACHE_MAX_BO_SIZE)
+		return NULL;
+
+	cache = drm_intel_gem_front_cache(bufmgr_gem, false);
+	if (!cache)
+		return NULL;
+
+	/* Same policy as the shared buckets: MRU for render targets, and
+	 * only an idle LRU buffer for everything else.
+	 */
+	for (i = 0; i < cache->count; i++) {
+		int idx = for_render ? cache->count - 1 - i : i;
+
+		bo_gem = cache->bos[idx];
+		if (bo_gem->bo.size != bucket_size)
+			continue;
+
+		if (!for_render && drm_intel_gem_bo_busy(&bo_gem->bo))
+			return NULL;
+
+		cache->count--;
+		memmove(cache->bos + idx, cache->bos + idx + 1,
+			(cache->count - idx) * sizeof(cache->bos[0]));
+		atomic_inc(&cache->hits);
+		return bo_gem;
 	}
+
+	return NULL;
+}
+
+/* Takes ownership of a reusable BO whose last reference was just dropped.
+ * Returns false if the BO has to go through the locked path instead.
+ */
+static bool
+drm_intel_gem_front_cache_put(drm_intel_bufmgr_gem *bufmgr_gem,
+			      drm_intel_bo_gem *bo_gem)
+{
+	struct drm_intel_gem_front_cache *cache;
+	struct timespec time;
+
+	cache = drm_intel_gem_front_cache(bufmgr_gem, true);
+	if (!cache)
+		return false;
+
+	if (cache->count == FRONT_CACHE_SIZE) {
+		clock_gettime(CLOCK_MONOTONIC, &time);
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_front_cache_flush_locked(bufmgr_gem, cache,
+						       FRONT_CACHE_SIZE / 2,
+						       time.tv_sec);
+		util_bo_cache_cleanup(&bufmgr_gem->bo_cache, time.tv_sec);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
+	bo_gem->name = NULL;
+	bo_gem->validate_index = -1;
+	cache->bos[cache->count++] = bo_gem;
+	return true;
 }
 
 static drm_intel_bo *
@@ -713,79 +936,74 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 	drm_intel_bo_gem *bo_gem;
 	unsigned int page_size = getpagesize();
 	int ret;
-	struct drm_intel_gem_bo_bucket *bucket;
-	bool alloc_from_cache;
-	unsigned long bo_size;
+	struct util_bo_cache_entry *entry;
+	unsigned long bucket_size, bo_size;
 	bool for_render = false;
 
 	if (flags & BO_ALLOC_FOR_RENDER)
 		for_render = true;
 
 	/* Round the allocated size up to a power of two number of pages. */
-	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, size);
+	bucket_size = util_bo_cache_bucket_size(&bufmgr_gem->bo_cache, size);
 
 	/* If we don't have caching at this size, don't actually round the
 	 * allocation up.
 	 */
-	if (bucket == NULL) {
+	if (bucket_size == 0) {
 		bo_size = size;
 		if (bo_size < page_size)
 			bo_size = page_size;
 	} else {
-		bo_size = bucket->size;
+		bo_size = bucket_size;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Get a buffer out of the cache if available */
-retry:
-	alloc_from_cache = false;
-	if (bucket != NULL && !DRMLISTEMPTY(&bucket->head)) {
-		if (for_render) {
-			/* Allocate new render-target BOs from the tail (MRU)
-			 * of the list, as it will likely be hot in the GPU
-			 * cache and in the aperture for us.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
-			alloc_from_cache = true;
+	bo_gem = drm_intel_gem_front_cache_get(bufmgr_gem, bucket_size,
+					       for_render);
+	if (bo_gem) {
+		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+							 tiling_mode,
+							 stride) == 0) {
 			bo_gem->bo.align = alignment;
-		} else {
-			assert(alignment == 0);
-			/* For non-render-target BOs (where we're probably
-			 * going to map it first thing in order to fill it
-			 * with data), check if the last BO in the cache is
-			 * unbusy, and only reuse in that case. Otherwise,
-			 * allocating a new buffer is probably faster than
-			 * waiting for the GPU to finish.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
-				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
-			}
+			drm_intel_gem_bo_init_alloc(bufmgr_gem, bo_gem, name,
+						    alignment);
+
+			DBG("bo_create: buf %d (%s) %ldb (front cache)\n",
+			    bo_gem->gem_handle, bo_gem->name, size);
+
+			return &bo_gem->bo;
 		}
 
-		if (alloc_from_cache) {
-			if (!drm_intel_gem_bo_madvise_internal
-			    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
-								    bucket);
-				goto retry;
-			}
-
-			if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
-								 tiling_mode,
-								 stride)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				goto retry;
-			}
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	/* Get a buffer out of the cache if available.
+	 *
+	 * Allocate new render-target BOs from the tail (MRU) of the list, as
+	 * it will likely be hot in the GPU cache and in the aperture for us.
+	 * For non-render-target BOs (where we're probably going to map it
+	 * first thing in order to fill it with data), only reuse the oldest
+	 * BO if it is unbusy, as allocating a new buffer is probably faster
+	 * than waiting for the GPU to finish.
+	 */
+retry:
+	entry = util_bo_cache_get(&bufmgr_gem->bo_cache, bo_size, 0,
+				  for_render);
+	if (entry) {
+		assert(for_render || alignment == 0);
+		bo_gem = to_bo_gem_cached(entry);
+		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+							 tiling_mode,
+							 stride)) {
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			goto retry;
 		}
+		bo_gem->bo.align = alignment;
 	}
 
-	if (!alloc_from_cache) {
+	if (!entry) {
 		struct drm_i915_gem_create create;
 
 		bo_gem = calloc(1, sizeof(*bo_gem));
@@ -828,15 +1046,7 @@ retry:
 			goto err_free;
 	}
 
-	bo_gem->name = name;
-	atomic_set(&bo_gem->refcount, 1);
-	bo_gem->validate_index = -1;
-	bo_gem->reloc_tree_fences = 0;
-	bo_gem->used_as_reloc_target = false;
-	bo_gem->has_error = false;
-	bo_gem->reusable = true;
-
-	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, alignment);
+	drm_intel_gem_bo_init_alloc(bufmgr_gem, bo_gem, name, alignment);
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	DBG("bo_create: buf %d (%s) %ldb\n",
@@ -1199,15 +1409,18 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->mem_virtual, 0));
 		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_bytes[VMA_CPU] -= bo_gem->bo.size;
 	}
 	if (bo_gem->wc_virtual) {
 		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->wc_virtual, 0));
 		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_bytes[VMA_WC] -= bo_gem->bo.size;
 	}
 	if (bo_gem->gtt_virtual) {
 		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_bytes[VMA_GTT] -= bo_gem->bo.size;
 	}
 
 	if (bo_gem->global_name)
@@ -1242,52 +1455,41 @@ drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
 #endif
 }
 
-/** Frees all cached buffers significantly older than @time. */
-static void
-drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
+static uint64_t
+drm_intel_gem_vma_cache_bytes(drm_intel_bufmgr_gem *bufmgr_gem)
 {
-	int i;
-
-	if (bufmgr_gem->time == time)
-		return;
-
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			drm_intel_bo_gem *bo_gem;
-
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (time - bo_gem->free_time <= 1)
-				break;
-
-			DRMLISTDEL(&bo_gem->head);
-
-			drm_intel_gem_bo_free(&bo_gem->bo);
-		}
-	}
-
-	bufmgr_gem->time = time;
+	return bufmgr_gem->vma_bytes[VMA_CPU] +
+		bufmgr_gem->vma_bytes[VMA_WC] +
+		bufmgr_gem->vma_bytes[VMA_GTT];
 }
 
 static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 {
 	int limit;
 
-	DBG("%s: cached=%d, open=%d, limit=%d\n", __FUNCTION__,
-	    bufmgr_gem->vma_count, bufmgr_gem->vma_open, bufmgr_gem->vma_max);
+	DBG("%s: cached=%d (cpu %" PRIu64 ", wc %" PRIu64 ", gtt %" PRIu64
+	    " bytes), open=%d, limit=%d (%" PRIu64 " bytes)\n", __FUNCTION__,
+	    bufmgr_gem->vma_count, bufmgr_gem->vma_bytes[VMA_CPU],
+	    bufmgr_gem->vma_bytes[VMA_WC], bufmgr_gem->vma_bytes[VMA_GTT],
+	    bufmgr_gem->vma_open, bufmgr_gem->vma_max,
+	    bufmgr_gem->vma_max_bytes);
 
-	if (bufmgr_gem->vma_max < 0)
-		return;
-
-	/* We may need to evict a few entries in order to create new mmaps */
-	limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
-	if (limit < 0)
-		limit = 0;
+	if (bufmgr_gem->vma_max < 0) {
+		limit = INT_MAX;
+	} else {
+		/* We may need to evict a few entries in order to create new
+		 * mmaps
+		 */
+		limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
+		if (limit < 0)
+			limit = 0;
+	}
 
-	while (bufmgr_gem->vma_count > limit) {
+	/* Least recently unmapped BOs go first, with all their mappings */
+	while (!DRMLISTEMPTY(&bufmgr_gem->vma_cache) &&
+	       (bufmgr_gem->vma_count > limit ||
+		drm_intel_gem_vma_cache_bytes(bufmgr_gem) >
+		bufmgr_gem->vma_max_bytes)) {
 		drm_intel_bo_gem *bo_gem;
 
 		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
@@ -1300,16 +1502,19 @@ static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 			drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
 			bo_gem->mem_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_bytes[VMA_CPU] -= bo_gem->bo.size;
 		}
 		if (bo_gem->wc_virtual) {
 			drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
 			bo_gem->wc_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_bytes[VMA_WC] -= bo_gem->bo.size;
 		}
 		if (bo_gem->gtt_virtual) {
 			drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
 			bo_gem->gtt_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_bytes[VMA_GTT] -= bo_gem->bo.size;
 		}
 	}
 }
@@ -1319,12 +1524,18 @@ static void drm_intel_gem_bo_close_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 {
 	bufmgr_gem->vma_open--;
 	DRMLISTADDTAIL(&bo_gem->vma_list, &bufmgr_gem->vma_cache);
-	if (bo_gem->mem_virtual)
+	if (bo_gem->mem_virtual) {
 		bufmgr_gem->vma_count++;
-	if (bo_gem->wc_virtual)
+		bufmgr_gem->vma_bytes[VMA_CPU] += bo_gem->bo.size;
+	}
+	if (bo_gem->wc_virtual) {
 		bufmgr_gem->vma_count++;
-	if (bo_gem->gtt_virtual)
+		bufmgr_gem->vma_bytes[VMA_WC] += bo_gem->bo.size;
+	}
+	if (bo_gem->gtt_virtual) {
 		bufmgr_gem->vma_count++;
+		bufmgr_gem->vma_bytes[VMA_GTT] += bo_gem->bo.size;
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
@@ -1333,12 +1544,18 @@ static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 {
 	bufmgr_gem->vma_open++;
 	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual)
+	if (bo_gem->mem_virtual) {
 		bufmgr_gem->vma_count--;
-	if (bo_gem->wc_virtual)
+		bufmgr_gem->vma_bytes[VMA_CPU] -= bo_gem->bo.size;
+	}
+	if (bo_gem->wc_virtual) {
 		bufmgr_gem->vma_count--;
-	if (bo_gem->gtt_virtual)
+		bufmgr_gem->vma_bytes[VMA_WC] -= bo_gem->bo.size;
+	}
+	if (bo_gem->gtt_virtual) {
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_bytes[VMA_GTT] -= bo_gem->bo.size;
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
@@ -1347,7 +1564,6 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	struct drm_intel_gem_bo_bucket *bucket;
 	int i;
 
 	/* Unreference all the target buffers */
@@ -1392,20 +1608,10 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	}
 
-	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, bo->size);
 	/* Put the buffer into our internal cache for reuse if we can. */
-	if (bufmgr_gem->bo_reuse && bo_gem->reusable && bucket != NULL &&
-	    drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
-					      I915_MADV_DONTNEED)) {
-		bo_gem->free_time = time;
-
-		bo_gem->name = NULL;
-		bo_gem->validate_index = -1;
-
-		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
-	} else {
+	if (!bufmgr_gem->bo_reuse || !bo_gem->reusable ||
+	    !drm_intel_gem_bo_cache_add(bufmgr_gem, bo_gem, time))
 		drm_intel_gem_bo_free(bo);
-	}
 }
 
 static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
@@ -1418,13 +1624,57 @@ static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
 		drm_intel_gem_bo_unreference_final(bo, time);
 }
 
+/*
+ * Reusable BOs are never flinked or exported, so nobody else can look them
+ * up and take a new reference: when they carry no relocations and no
+ * mappings, dropping the last reference doesn't need the bufmgr lock.
+ */
+static bool
+drm_intel_gem_bo_unreference_to_front_cache(drm_intel_bo *bo)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	if (!bo_gem->reusable || bo_gem->reloc_count ||
+	    bo_gem->softpin_target_count || bo_gem->map_count ||
+	    bo->size > FRONT_CACHE_MAX_BO_SIZE ||
+	    util_bo_cache_bucket_size(&bufmgr_gem->bo_cache, bo->size) == 0 ||
+	    !bufmgr_gem->has_front_cache || !bufmgr_gem->bo_reuse)
+		return false;
+
+	if (!atomic_dec_and_test(&bo_gem->refcount))
+		return true;
+
+	bo_gem->kflags = 0;
+	bo_gem->used_as_reloc_target = false;
+	free(bo_gem->reloc_target_info);
+	bo_gem->reloc_target_info = NULL;
+	free(bo_gem->relocs);
+	bo_gem->relocs = NULL;
+	free(bo_gem->softpin_target);
+	bo_gem->softpin_target = NULL;
+	bo_gem->softpin_target_size = 0;
+
+	if (!drm_intel_gem_front_cache_put(bufmgr_gem, bo_gem)) {
+		struct timespec time;
+
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_unreference_final(bo, time.tv_sec);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
+	return true;
+}
+
 static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 	assert(atomic_read(&bo_gem->refcount) > 0);
 
-	if (atomic_add_unless(&bo_gem->refcount, -1, 1)) {
+	if (atomic_add_unless(&bo_gem->refcount, -1, 1) &&
+	    !drm_intel_gem_bo_unreference_to_front_cache(bo)) {
 		drm_intel_bufmgr_gem *bufmgr_gem =
 		    (drm_intel_bufmgr_gem *) bo->bufmgr;
 		struct timespec time;
@@ -1435,7 +1685,8 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 
 		if (atomic_dec_and_test(&bo_gem->refcount)) {
 			drm_intel_gem_bo_unreference_final(bo, time.tv_sec);
-			drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
+			util_bo_cache_cleanup(&bufmgr_gem->bo_cache,
+					      time.tv_sec);
 		}
 
 		pthread_mutex_unlock(&bufmgr_gem->lock);
@@ -1757,29 +2008,48 @@ static void set_domain(drm_intel_bo *bo, uint32_t read, uint32_t write)
 		assert(false);
 }
 
-static int mmap_write(drm_intel_bo *bo, unsigned long offset,
-		      unsigned long length, const void *buf)
+/**
+ * Writes through a CPU or WC mapping.  Returns false if the mapping can't be
+ * created.
+ *
+ * The mapping is unmapped again once written, so that the BO stays eligible
+ * for the BO caches and its VMA counts against the VMA cache limits; the VMA
+ * cache keeps it around for the next upload.  A mapping that already exists
+ * gets its own map_count reference for the duration of the copy, so that the
+ * unmap doesn't drop the one of whoever mapped it.
+ */
+static bool mmap_write(drm_intel_bo *bo, enum drm_intel_upload_path path,
+		       unsigned long offset, unsigned long length,
+		       const void *buf)
 {
-	void *map = NULL;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	void *map;
 
-	if (!length)
-		return 0;
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	map = path == DRM_INTEL_UPLOAD_CPU_MMAP ? bo_gem->mem_virtual :
+						  bo_gem->wc_virtual;
+	if (map && bo_gem->map_count++ == 0)
+		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 
-	if (is_cache_coherent(bo)) {
-		map = drm_intel_gem_bo_map__cpu(bo);
+	if (path == DRM_INTEL_UPLOAD_CPU_MMAP) {
+		if (!map)
+			map = drm_intel_gem_bo_map__cpu(bo);
 		if (map)
 			set_domain(bo, I915_GEM_DOMAIN_CPU, I915_GEM_DOMAIN_CPU);
-	}
-	if (!map) {
-		map = drm_intel_gem_bo_map__wc(bo);
+	} else {
+		if (!map)
+			map = drm_intel_gem_bo_map__wc(bo);
 		if (map)
 			set_domain(bo, I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
 	}
+	if (!map)
+		return false;
 
-	assert(map);
 	memcpy((char *)map + offset, buf, length);
 	drm_intel_gem_bo_unmap(bo);
-	return 0;
+	return true;
 }
 
 static int mmap_read(drm_intel_bo *bo, unsigned long offset,
@@ -1808,18 +2078,51 @@ static int mmap_read(drm_intel_bo *bo, unsigned long offset,
 	return 0;
 }
 
+/**
+ * Picks how drm_intel_bo_subdata() uploads @size bytes to @bo.
+ *
+ * pwrite costs a copy in the kernel, a mapping costs a domain change per
+ * upload (and its creation the first time), so mappings are only used for
+ * untiled uploads of at least upload_map_size bytes to idle BOs.  A busy BO
+ * is left to pwrite: both paths wait for the GPU first, and the wait then
+ * dominates whatever a mapping would save.  Only once a mapping is chosen is
+ * an existing one preferred over creating another.
+ */
+static enum drm_intel_upload_path
+drm_intel_gem_bo_upload_path(drm_intel_bo *bo, unsigned long size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	/* Only pwrite goes through a fence for detiling and swizzling */
+	if (bo_gem->tiling_mode != I915_TILING_NONE)
+		return DRM_INTEL_UPLOAD_PWRITE;
+
+	if (size < bufmgr_gem->upload_map_size)
+		return DRM_INTEL_UPLOAD_PWRITE;
+
+	if (drm_intel_gem_bo_busy(bo))
+		return DRM_INTEL_UPLOAD_PWRITE;
+
+	if (bo_gem->wc_virtual)
+		return DRM_INTEL_UPLOAD_WC_MMAP;
+	if (bo_gem->mem_virtual && bufmgr_gem->has_llc)
+		return DRM_INTEL_UPLOAD_CPU_MMAP;
+
+	if (is_cache_coherent(bo))
+		return DRM_INTEL_UPLOAD_CPU_MMAP;
+	return DRM_INTEL_UPLOAD_WC_MMAP;
+}
+
 static int
-drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
-			 unsigned long size, const void *data)
+drm_intel_gem_bo_pwrite(drm_intel_bo *bo, unsigned long offset,
+			unsigned long size, const void *data)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_i915_gem_pwrite pwrite;
 	int ret;
 
-	if (bo_gem->is_userptr)
-		return -EINVAL;
-
 	memclear(pwrite);
 	pwrite.handle = bo_gem->gem_handle;
 	pwrite.offset = offset;
@@ -1835,11 +2138,65 @@ drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
 		DBG("%s:%d: Error writing data to buffer %d: (%d %d) %s .\n",
 		    __FILE__, __LINE__, bo_gem->gem_handle, (int)offset,
 		    (int)size, strerror(errno));
-		return ret;
 	}
 
-	if (ret == -EOPNOTSUPP)
-		mmap_write(bo, offset, size, data);
+	return ret;
+}
+
+static void
+drm_intel_gem_count_upload(drm_intel_bufmgr_gem *bufmgr_gem,
+			   enum drm_intel_upload_path path, unsigned long size)
+{
+	struct drm_intel_upload_stats *stats = &bufmgr_gem->upload_stats;
+
+#if HAVE_LIBDRM_ATOMIC_PRIMITIVES
+	__sync_fetch_and_add(&stats->count[path], 1);
+	__sync_fetch_and_add(&stats->bytes[path], size);
+#else
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	stats->count[path]++;
+	stats->bytes[path] += size;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+#endif
+}
+
+static int
+drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
+			 unsigned long size, const void *data)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	enum drm_intel_upload_path path;
+	int ret;
+
+	if (bo_gem->is_userptr)
+		return -EINVAL;
+
+	if (!size)
+		return 0;
+
+	path = drm_intel_gem_bo_upload_path(bo, size);
+	if (path != DRM_INTEL_UPLOAD_PWRITE &&
+	    !mmap_write(bo, path, offset, size, data))
+		path = DRM_INTEL_UPLOAD_PWRITE;
+
+	if (path == DRM_INTEL_UPLOAD_PWRITE) {
+		ret = drm_intel_gem_bo_pwrite(bo, offset, size, data);
+		if (ret == -EOPNOTSUPP && is_cache_coherent(bo) &&
+		    mmap_write(bo, DRM_INTEL_UPLOAD_CPU_MMAP, offset, size,
+			       data)) {
+			path = DRM_INTEL_UPLOAD_CPU_MMAP;
+		} else if (ret == -EOPNOTSUPP &&
+			   mmap_write(bo, DRM_INTEL_UPLOAD_WC_MMAP, offset,
+				      size, data)) {
+			path = DRM_INTEL_UPLOAD_WC_MMAP;
+		} else if (ret) {
+			return ret;
+		}
+	}
+
+	if (bufmgr_gem->upload_stats_enabled)
+		drm_intel_gem_count_upload(bufmgr_gem, path, size);
 
 	return 0;
 }
@@ -2009,22 +2366,24 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 	free(bufmgr_gem->exec_objects);
 	free(bufmgr_gem->exec_bos);
 
+	/* Free the BOs still sitting in per-thread caches */
+	if (bufmgr_gem->has_front_cache) {
+		struct drm_intel_gem_front_cache *cache, *tmp;
+
+		pthread_key_delete(bufmgr_gem->front_cache_key);
+		DRMLISTFOREACHENTRYSAFE(cache, tmp, &bufmgr_gem->front_caches,
+					link) {
+			for (i = 0; i < cache->count; i++)
+				drm_intel_gem_bo_free(&cache->bos[i]->bo);
+			DRMLISTDEL(&cache->link);
+			free(cache);
+		}
+	}
+
 	pthread_mutex_destroy(&bufmgr_gem->lock);
 
 	/* Free any cached buffer objects we were going to reuse */
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		drm_intel_bo_gem *bo_gem;
-
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			DRMLISTDEL(&bo_gem->head);
-
-			drm_intel_gem_bo_free(&bo_gem->bo);
-		}
-	}
+	util_bo_cache_fini(&bufmgr_gem->bo_cache);
 
 	/* Release userptr bo kept hanging around for optimisation. */
 	if (bufmgr_gem->userptr_active.ptr) {
@@ -2331,6 +2690,45 @@ drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 }
 
 
+/**
+ * Prepares the relocations of the validation list for the execbuf flags in
+ * exec_fast_flags, and returns the subset of those flags usable for this
+ * execbuf.
+ *
+ * With I915_EXEC_HANDLE_LUT, relocation targets are given as indices into
+ * the validation list rather than as GEM handles.  I915_EXEC_NO_RELOC is
+ * dropped if any relocation was emitted against an offset that has since
+ * changed, as the kernel would then skip a relocation that is needed.
+ * As the kernel then doesn't look at the relocations either, the targets
+ * written to are flagged EXEC_OBJECT_WRITE for it to track the hazard.
+ */
+static unsigned int
+drm_intel_gem_prepare_fast_relocs(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	unsigned int flags = bufmgr_gem->exec_fast_flags;
+	int i, j;
+
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
+
+		for (j = 0; j < bo_gem->reloc_count; j++) {
+			drm_intel_bo *target_bo = bo_gem->reloc_target_info[j].bo;
+			int idx = to_bo_gem(target_bo)->validate_index;
+
+			if (bo_gem->relocs[j].write_domain)
+				bufmgr_gem->exec2_objects[idx].flags |=
+					EXEC_OBJECT_WRITE;
+			if (flags & I915_EXEC_HANDLE_LUT)
+				bo_gem->relocs[j].target_handle = idx;
+			if (bo_gem->relocs[j].presumed_offset !=
+			    target_bo->offset64)
+				flags &= ~I915_EXEC_NO_RELOC;
+		}
+	}
+
+	return flags;
+}
+
 static void
 drm_intel_update_buffer_offsets(drm_intel_bufmgr_gem *bufmgr_gem)
 {
@@ -2491,13 +2889,20 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	}
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc2(bo);
-
 	/* Add the batch buffer to the validation list.  There are no relocations
 	 * pointing to it.
 	 */
-	drm_intel_add_validate_buffer2(bo, 0);
+	if (bufmgr_gem->exec_fast_flags & I915_EXEC_BATCH_FIRST)
+		drm_intel_add_validate_buffer2(bo, 0);
+
+	/* Update indices and set up the validate list. */
+	drm_intel_gem_bo_process_reloc2(bo);
+
+	if (!(bufmgr_gem->exec_fast_flags & I915_EXEC_BATCH_FIRST))
+		drm_intel_add_validate_buffer2(bo, 0);
+
+	if (bufmgr_gem->exec_fast_flags)
+		flags |= drm_intel_gem_prepare_fast_relocs(bufmgr_gem);
 
 	memclear(execbuf);
 	execbuf.buffers_ptr = (uintptr_t)bufmgr_gem->exec2_objects;
@@ -2938,6 +3343,50 @@ drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
 		bufmgr_gem->fenced_relocs = true;
 }
 
+/**
+ * Enables the execbuffer2 fast path, using whichever of I915_EXEC_NO_RELOC,
+ * I915_EXEC_HANDLE_LUT and I915_EXEC_BATCH_FIRST the kernel supports.
+ *
+ * With I915_EXEC_NO_RELOC, the kernel trusts the addresses already written
+ * in the buffers, and skips relocation processing when nothing moved.  This
+ * requires the caller to write target_bo->offset64 + target_offset at the
+ * relocated location when emitting each relocation.
+ */
+drm_public void
+drm_intel_bufmgr_gem_enable_fast_relocs(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	static const struct {
+		int param;
+		unsigned int flag;
+	} features[] = {
+		{ I915_PARAM_HAS_EXEC_NO_RELOC, I915_EXEC_NO_RELOC },
+		{ I915_PARAM_HAS_EXEC_HANDLE_LUT, I915_EXEC_HANDLE_LUT },
+		{ I915_PARAM_HAS_EXEC_BATCH_FIRST, I915_EXEC_BATCH_FIRST },
+	};
+	unsigned int flags = 0;
+	unsigned int i;
+
+	if (bufmgr_gem->bufmgr.bo_exec != drm_intel_gem_bo_exec2)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(features); i++) {
+		drm_i915_getparam_t gp;
+		int value = 0;
+
+		memclear(gp);
+		gp.param = features[i].param;
+		gp.value = &value;
+		if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp) == 0 &&
+		    value > 0)
+			flags |= features[i].flag;
+	}
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->exec_fast_flags = flags;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
 /**
  * Return the additional aperture space required by the tree of buffer objects
  * rooted at bo.
@@ -3131,25 +3580,34 @@ drm_intel_gem_bo_is_reusable(drm_intel_bo *bo)
 }
 
 static int
-_drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
+_drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo,
+			     uint64_t serial)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	int i;
 
+	/* Relocation trees are DAGs that often share whole subtrees: only
+	 * walk each BO once per query.
+	 */
+	if (bo_gem->references_serial == serial)
+		return 0;
+	bo_gem->references_serial = serial;
+
 	for (i = 0; i < bo_gem->reloc_count; i++) {
 		if (bo_gem->reloc_target_info[i].bo == target_bo)
 			return 1;
 		if (bo == bo_gem->reloc_target_info[i].bo)
 			continue;
 		if (_drm_intel_gem_bo_references(bo_gem->reloc_target_info[i].bo,
-						target_bo))
+						target_bo, serial))
 			return 1;
 	}
 
 	for (i = 0; i< bo_gem->softpin_target_count; i++) {
 		if (bo_gem->softpin_target[i] == target_bo)
 			return 1;
-		if (_drm_intel_gem_bo_references(bo_gem->softpin_target[i], target_bo))
+		if (_drm_intel_gem_bo_references(bo_gem->softpin_target[i],
+						 target_bo, serial))
 			return 1;
 	}
 
@@ -3160,62 +3618,224 @@ _drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 static int
 drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
+	int ret;
 
 	if (bo == NULL || target_bo == NULL)
 		return 0;
-	if (target_bo_gem->used_as_reloc_target)
-		return _drm_intel_gem_bo_references(bo, target_bo);
-	return 0;
+	if (!target_bo_gem->used_as_reloc_target)
+		return 0;
+
+	/* The lock only protects the visited marks, which may be shared with
+	 * a concurrent query on another batch.
+	 */
+	bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	ret = _drm_intel_gem_bo_references(bo, target_bo,
+					   ++bufmgr_gem->references_serial);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
 }
 
-static void
-add_bucket(drm_intel_bufmgr_gem *bufmgr_gem, int size)
+drm_public void
+drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 {
-	unsigned int i = bufmgr_gem->num_buckets;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
 
-	assert(i < ARRAY_SIZE(bufmgr_gem->cache_bucket));
+	bufmgr_gem->vma_max = limit;
 
-	DRMINITLISTHEAD(&bufmgr_gem->cache_bucket[i].head);
-	bufmgr_gem->cache_bucket[i].size = size;
-	bufmgr_gem->num_buckets++;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
-static void
-init_cache_buckets(drm_intel_bufmgr_gem *bufmgr_gem)
+/**
+ * Limits the total size of the CPU, WC and GTT mappings kept around for
+ * unmapped BOs, on top of the limit on their number.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					 uint64_t limit)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->vma_max_bytes = limit;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Sets the maximum number of bytes kept in the BO cache.
+ *
+ * When the limit is exceeded, the buffers freed the longest time ago are
+ * released first, whatever their size.  This doesn't cover the small
+ * per-thread caches in front of the shared one.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_bo_cache_size(drm_intel_bufmgr *bufmgr,
+				       uint64_t max_bytes)
 {
-	unsigned long size, cache_max_size = 64 * 1024 * 1024;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
 
-	/* OK, so power of two buckets was too wasteful of memory.
-	 * Give 3 other sizes between each power of two, to hopefully
-	 * cover things accurately enough.  (The alternative is
-	 * probably to just go for exact matching of sizes, and assume
-	 * that for things like composited window resize the tiled
-	 * width/height alignment and rounding of sizes to pages will
-	 * get us useful cache hit rates anyway)
-	 */
-	add_bucket(bufmgr_gem, 4096);
-	add_bucket(bufmgr_gem, 4096 * 2);
-	add_bucket(bufmgr_gem, 4096 * 3);
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	util_bo_cache_set_max_bytes(&bufmgr_gem->bo_cache, max_bytes);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Shrinks the BO cache down to @max_bytes, without changing its limit.
+ *
+ * This is meant to be called when the system is under memory pressure, for
+ * instance when a PSI trigger on /proc/pressure/memory fires.  The calling
+ * thread's own front cache is emptied as well.
+ */
+drm_public void
+drm_intel_bufmgr_gem_trim_bo_cache(drm_intel_bufmgr *bufmgr,
+				   uint64_t max_bytes)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_intel_gem_front_cache *cache;
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
 
-	/* Initialize the linked lists for BO reuse cache. */
-	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
-		add_bucket(bufmgr_gem, size);
+	cache = drm_intel_gem_front_cache(bufmgr_gem, false);
 
-		add_bucket(bufmgr_gem, size + size * 1 / 4);
-		add_bucket(bufmgr_gem, size + size * 2 / 4);
-		add_bucket(bufmgr_gem, size + size * 3 / 4);
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (cache)
+		drm_intel_gem_front_cache_flush_locked(bufmgr_gem, cache,
+						       cache->count,
+						       time.tv_sec);
+	util_bo_cache_trim(&bufmgr_gem->bo_cache, max_bytes);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+drm_public void
+drm_intel_bufmgr_gem_get_bo_cache_stats(drm_intel_bufmgr *bufmgr,
+					struct drm_intel_bo_cache_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_intel_gem_front_cache *cache;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	DRMLISTFOREACHENTRY(cache, &bufmgr_gem->front_caches, link)
+		drm_intel_gem_front_cache_collect_stats(bufmgr_gem, cache);
+	stats->bytes_cached = bufmgr_gem->bo_cache.stats.bytes_cached;
+	stats->hits = bufmgr_gem->bo_cache.stats.hits;
+	stats->misses = bufmgr_gem->bo_cache.stats.misses;
+	stats->purged = bufmgr_gem->bo_cache.stats.purged;
+	stats->evicted = bufmgr_gem->bo_cache.stats.evicted;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Sets the smallest drm_intel_bo_subdata() upload for which a CPU or WC
+ * mapping of the BO is used, instead of pwrite.
+ *
+ * Tiled and busy BOs are always written with pwrite.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_upload_map_size(drm_intel_bufmgr *bufmgr,
+					 unsigned long size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	bufmgr_gem->upload_map_size = size;
+}
+
+static uint64_t
+drm_intel_gem_time_upload(drm_intel_bo *bo, enum drm_intel_upload_path path,
+			  unsigned long size, const void *data)
+{
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < 8; i++) {
+		if (path == DRM_INTEL_UPLOAD_PWRITE)
+			drm_intel_gem_bo_pwrite(bo, 0, size, data);
+		else
+			mmap_write(bo, path, 0, size, data);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) * 1000000000ull +
+		end.tv_nsec - start.tv_nsec;
 }
 
+/**
+ * Measures pwrite against writes through a mapping on this device, and
+ * sets the upload map size to the smallest size from which mappings win.
+ *
+ * This takes a few milliseconds, so it is left to the caller to decide
+ * whether it is worth it, and when.
+ */
+drm_public int
+drm_intel_bufmgr_gem_calibrate_upload(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	const unsigned long max_size = 1024 * 1024;
+	enum drm_intel_upload_path path;
+	unsigned long size, map_size = ULONG_MAX;
+	drm_intel_bo *bo;
+	void *data;
+
+	data = calloc(1, max_size);
+	if (!data)
+		return -ENOMEM;
+
+	bo = drm_intel_bo_alloc(bufmgr, "upload calibration", max_size, 0);
+	if (!bo) {
+		free(data);
+		return -ENOMEM;
+	}
+
+	path = is_cache_coherent(bo) ? DRM_INTEL_UPLOAD_CPU_MMAP :
+				       DRM_INTEL_UPLOAD_WC_MMAP;
+	if (!mmap_write(bo, path, 0, max_size, data)) {
+		drm_intel_bo_unreference(bo);
+		free(data);
+		return -ENODEV;
+	}
+
+	for (size = max_size; size >= 4096; size /= 2) {
+		if (drm_intel_gem_time_upload(bo, path, size, data) >=
+		    drm_intel_gem_time_upload(bo, DRM_INTEL_UPLOAD_PWRITE,
+					      size, data))
+			break;
+		map_size = size;
+	}
+
+	DBG("upload map size calibrated to %lu\n", map_size);
+	bufmgr_gem->upload_map_size = map_size;
+
+	drm_intel_bo_unreference(bo);
+	free(data);
+	return 0;
+}
+
+/**
+ * Starts counting drm_intel_bo_subdata() uploads by path, for
+ * drm_intel_bufmgr_gem_get_upload_stats().
+ */
 drm_public void
-drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
+drm_intel_bufmgr_gem_enable_upload_stats(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
 
-	bufmgr_gem->vma_max = limit;
+	bufmgr_gem->upload_stats_enabled = true;
+}
 
-	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+drm_public void
+drm_intel_bufmgr_gem_get_upload_stats(drm_intel_bufmgr *bufmgr,
+				      struct drm_intel_upload_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	*stats = bufmgr_gem->upload_stats;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 }
 
 static int
@@ -3896,10 +4516,18 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	    drm_intel_gem_get_pipe_from_crtc_id;
 	bufmgr_gem->bufmgr.bo_references = drm_intel_gem_bo_references;
 
-	init_cache_buckets(bufmgr_gem);
+	util_bo_cache_init(&bufmgr_gem->bo_cache, false,
+			   &drm_intel_gem_bo_cache_funcs);
+	bufmgr_gem->upload_map_size = ULONG_MAX; /* pwrite by default */
+
+	DRMINITLISTHEAD(&bufmgr_gem->front_caches);
+	bufmgr_gem->has_front_cache =
+		pthread_key_create(&bufmgr_gem->front_cache_key,
+				   drm_intel_gem_front_cache_destroy) == 0;
 
 	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
 	bufmgr_gem->vma_max = -1; /* unlimited by default */
+	bufmgr_gem->vma_max_bytes = UINT64_MAX;
 
 	DRMLISTADD(&bufmgr_gem->managers, &bufmgr_list);
 
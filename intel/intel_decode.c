@@ -22,12 +22,14 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
@@ -37,9 +39,36 @@
 
 /* Struct for tracking drm_intel_decode state. */
 struct drm_intel_decode {
-	/** stdio file where the output should land.  Defaults to stdout. */
+	/**
+	 * stdio file where the output should land.  Defaults to stdout,
+	 * NULL for no text output.
+	 */
 	FILE *out;
 
+	/** @{
+	 * Per-packet callback, and the record it is handed for the packet
+	 * being decoded.
+	 */
+	drm_intel_decode_packet_func packet_func;
+	void *packet_data;
+	struct drm_intel_decode_packet packet;
+	/** @} */
+
+	/** @{
+	 * Fields of the current packet, reported by instr_out() when the
+	 * caller set a packet callback.  Their names and values are offsets
+	 * into the strings buffer until the packet is handed over.
+	 */
+	bool want_fields;
+	struct drm_intel_decode_field *fields;
+	struct decode_field_strings {
+		int name, value;
+	} *field_strings;
+	unsigned int num_fields, max_fields;
+	char *strings;
+	size_t strings_used, strings_size;
+	/** @} */
+
 	/** PCI device ID. */
 	uint32_t devid;
 
@@ -78,20 +107,37 @@ struct drm_intel_decode {
 	bool dump_past_end;
 
 	bool overflowed;
-};
 
-static FILE *out;
-static uint32_t saved_s2 = 0, saved_s4 = 0;
-static char saved_s2_set = 0, saved_s4_set = 0;
-static uint32_t head_offset = 0xffffffff;	/* undefined */
-static uint32_t tail_offset = 0xffffffff;	/* undefined */
+	/** Number of threads drm_intel_decode() may split the batch across. */
+	int num_threads;
+
+	/** @{
+	 * i915 S2/S4 state from the last 3DSTATE_LOAD_STATE_IMMEDIATE_1,
+	 * needed to decode inline vertices.
+	 */
+	uint32_t saved_s2, saved_s4;
+	char saved_s2_set, saved_s4_set;
+	/** @} */
+
+	/** @{
+	 * Direct opcode lookups into the packet tables for this device, built
+	 * once by drm_intel_decode_context_alloc().  Each slot holds the index
+	 * of the table entry plus one, or 0 if the opcode has no entry.
+	 */
+	uint8_t lookup_mi[64];
+	uint8_t lookup_2d[128];
+	uint8_t lookup_3d[32];
+	uint8_t lookup_3d_i830[32];
+	uint8_t lookup_3d_965[8192];
+	/** @} */
+};
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(A[0]))
 #endif
 
 #define BUFFER_FAIL(_count, _len, _name) do {			\
-    fprintf(out, "Buffer size too small in %s (%d < %d)\n",	\
+    out_printf(ctx, "Buffer size too small in %s (%d < %d)\n",	\
 	    (_name), (_count), (_len));				\
     return _count;						\
 } while (0)
@@ -107,6 +153,373 @@ static float int_as_float(uint32_t intval)
 	return uval.f;
 }
 
+static void DRM_PRINTFLIKE(2, 3)
+out_printf(struct drm_intel_decode *ctx, const char *fmt, ...)
+{
+	va_list va;
+
+	if (!ctx->out)
+		return;
+
+	va_start(va, fmt);
+	vfprintf(ctx->out, fmt, va);
+	va_end(va);
+}
+
+/* Copies a string to ctx->strings, returning its offset or -1 */
+static int
+add_string(struct drm_intel_decode *ctx, const char *str, size_t len)
+{
+	int offset = ctx->strings_used;
+
+	if (ctx->strings_used + len + 1 > ctx->strings_size) {
+		size_t size = ctx->strings_size ? ctx->strings_size : 1024;
+		char *strings;
+
+		while (ctx->strings_used + len + 1 > size)
+			size *= 2;
+		strings = realloc(ctx->strings, size);
+		if (!strings)
+			return -1;
+		ctx->strings = strings;
+		ctx->strings_size = size;
+	}
+
+	memcpy(ctx->strings + offset, str, len);
+	ctx->strings[offset + len] = '\0';
+	ctx->strings_used += len + 1;
+
+	return offset;
+}
+
+/*
+ * Name of the field formatted after @lit, such as "src pitch " or "gtt
+ * offset = 0x": the last label in it, without the separators.
+ */
+static int
+field_name(struct drm_intel_decode *ctx, const char *lit, size_t len)
+{
+	size_t start;
+
+	if (len >= 2 && lit[len - 2] == '0' && lit[len - 1] == 'x')
+		len -= 2;
+	while (len && (lit[len - 1] == ' ' || lit[len - 1] == '=' ||
+		       lit[len - 1] == ':' || lit[len - 1] == '('))
+		len--;
+	for (start = len; start; start--) {
+		char c = lit[start - 1];
+
+		if (c == ',' || c == ';' || c == ':' || c == '(' ||
+		    c == ')' || c == '\n')
+			break;
+	}
+	while (start < len && lit[start] == ' ')
+		start++;
+
+	return add_string(ctx, lit + start, len - start);
+}
+
+static void
+add_field(struct drm_intel_decode *ctx, unsigned int index,
+	  const struct drm_intel_decode_field *field, int name,
+	  const char *prefix, const char *value)
+{
+	size_t prefix_len = strlen(prefix), len = strlen(value);
+	int offset;
+
+	/* flags are printed as ", flag" or " flag", or not at all */
+	if (field->type == DRM_INTEL_DECODE_FIELD_STRING) {
+		while (*value == ',' || *value == ' ') {
+			value++;
+			len--;
+		}
+		while (len && (value[len - 1] == ',' || value[len - 1] == ' '))
+			len--;
+		if (!len)
+			return;
+	}
+
+	if (ctx->num_fields == ctx->max_fields) {
+		unsigned int max = ctx->max_fields ? ctx->max_fields * 2 : 64;
+		struct drm_intel_decode_field *fields;
+		struct decode_field_strings *field_strings;
+
+		fields = realloc(ctx->fields, max * sizeof(*fields));
+		if (!fields)
+			return;
+		ctx->fields = fields;
+		field_strings = realloc(ctx->field_strings,
+					max * sizeof(*field_strings));
+		if (!field_strings)
+			return;
+		ctx->field_strings = field_strings;
+		ctx->max_fields = max;
+	}
+
+	/* the prefix and the value end up as a single string */
+	offset = add_string(ctx, prefix, prefix_len);
+	if (offset < 0)
+		return;
+	ctx->strings_used--;
+	if (add_string(ctx, value, len) < 0)
+		return;
+
+	ctx->fields[ctx->num_fields] = *field;
+	ctx->fields[ctx->num_fields].dword = index;
+	ctx->field_strings[ctx->num_fields].name = name;
+	ctx->field_strings[ctx->num_fields].value = offset;
+	ctx->num_fields++;
+}
+
+static bool
+has_label(const char *lit, size_t len)
+{
+	while (len--) {
+		if (isalnum((unsigned char)*lit++))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Formats the %d, %u, %x and %0<width>x conversions most fields use, as
+ * snprintf() is slow at it.  Returns -1 for the others.
+ */
+static int
+format_int(char *buf, size_t size, const char *spec, int64_t value)
+{
+	const char *p = spec + 1;
+	bool zero = *p == '0', neg = false;
+	uint64_t v = value;
+	int width = 0, n = 0, len, pad;
+	char digits[24];
+
+	p += zero;
+	while (*p >= '0' && *p <= '9')
+		width = width * 10 + *p++ - '0';
+	while (*p == 'l')
+		p++;
+	if (p[1] || width > 32)
+		return -1;
+
+	switch (*p) {
+	case 'd':
+	case 'i':
+		if (value < 0) {
+			neg = true;
+			v = -(uint64_t)value;
+		}
+		/* fallthrough */
+	case 'u':
+		do {
+			digits[n++] = '0' + v % 10;
+			v /= 10;
+		} while (v);
+		break;
+	case 'x':
+		do {
+			digits[n++] = "0123456789abcdef"[v & 0xf];
+			v >>= 4;
+		} while (v);
+		break;
+	default:
+		return -1;
+	}
+
+	len = n + neg;
+	pad = width > len ? width - len : 0;
+	len += pad;
+	if ((size_t)len >= size)
+		return -1;
+
+	if (!zero) {
+		memset(buf, ' ', pad);
+		buf += pad;
+	}
+	if (neg)
+		*buf++ = '-';
+	if (zero) {
+		memset(buf, '0', pad);
+		buf += pad;
+	}
+	while (n)
+		*buf++ = digits[--n];
+	*buf = '\0';
+
+	return len;
+}
+
+/* Formats a single conversion, returning the length it needs */
+static int
+format_value(char *buf, size_t size, const char *spec, int longs,
+	     const struct drm_intel_decode_field *field, const char *str)
+{
+	int len;
+
+	switch (field->type) {
+	case DRM_INTEL_DECODE_FIELD_FLOAT:
+		return snprintf(buf, size, spec, field->float_value);
+	case DRM_INTEL_DECODE_FIELD_INT:
+		len = format_int(buf, size, spec, field->int_value);
+		if (len >= 0)
+			return len;
+		if (longs >= 2)
+			return snprintf(buf, size, spec,
+					(long long)field->int_value);
+		if (longs)
+			return snprintf(buf, size, spec,
+					(long)field->int_value);
+		return snprintf(buf, size, spec, (int)field->int_value);
+	case DRM_INTEL_DECODE_FIELD_STRING:
+		return snprintf(buf, size, spec, str);
+	}
+
+	return 0;
+}
+
+/* Text of a DWORD, written out in one go */
+struct decode_line {
+	FILE *out;
+	size_t used;
+	char buf[256];
+};
+
+static void
+line_add(struct decode_line *line, const char *str, size_t len)
+{
+	if (!line->out)
+		return;
+
+	if (line->used + len > sizeof(line->buf)) {
+		fwrite(line->buf, 1, line->used, line->out);
+		line->used = 0;
+		if (len > sizeof(line->buf)) {
+			fwrite(str, 1, len, line->out);
+			return;
+		}
+	}
+	memcpy(line->buf + line->used, str, len);
+	line->used += len;
+}
+
+/*
+ * Walks the format of a DWORD's text, writing it out and reporting every
+ * conversion in it as a field, named after the label before it, or the
+ * previous field's if there is only punctuation in between.
+ */
+static void
+instr_vout(struct drm_intel_decode *ctx, unsigned int index,
+	   const char *fmt, va_list va)
+{
+	const char *lit = fmt, *p = fmt;
+	struct decode_line line;
+	int name = -1;
+
+	line.out = ctx->out;
+	line.used = 0;
+
+	while ((p = strchr(p, '%'))) {
+		struct drm_intel_decode_field field = { 0 };
+		const char *start = p, *prefix = "", *str = NULL, *value;
+		char spec[16], buf[128], *heap = NULL;
+		int longs = 0, len;
+
+		p++;
+		if (*p == '%') {
+			line_add(&line, lit, p - lit);
+			lit = ++p;
+			continue;
+		}
+		p += strspn(p, "-+ #0123456789.");
+		while (*p == 'l') {
+			longs++;
+			p++;
+		}
+		if (p + 1 - start >= (int)sizeof(spec))
+			break;
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+		case 'c':
+			field.type = DRM_INTEL_DECODE_FIELD_INT;
+			if (longs >= 2)
+				field.int_value = va_arg(va, long long);
+			else if (longs)
+				field.int_value = va_arg(va, long);
+			else
+				field.int_value = va_arg(va, int);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+			field.type = DRM_INTEL_DECODE_FIELD_INT;
+			if (longs >= 2)
+				field.int_value = va_arg(va, unsigned long long);
+			else if (longs)
+				field.int_value = va_arg(va, unsigned long);
+			else
+				field.int_value = va_arg(va, unsigned int);
+			break;
+		case 'f':
+		case 'g':
+		case 'e':
+			field.type = DRM_INTEL_DECODE_FIELD_FLOAT;
+			field.float_value = va_arg(va, double);
+			break;
+		case 's':
+			field.type = DRM_INTEL_DECODE_FIELD_STRING;
+			str = va_arg(va, const char *);
+			if (!str)
+				str = "(null)";
+			break;
+		default:
+			/* not a conversion the decoders use */
+			p = NULL;
+			break;
+		}
+		if (!p)
+			break;
+		p++;
+		memcpy(spec, start, p - start);
+		spec[p - start] = '\0';
+
+		if (str && strcmp(spec, "%s") == 0) {
+			value = str;
+		} else {
+			value = buf;
+			len = format_value(buf, sizeof(buf), spec, longs,
+					   &field, str);
+			if (len >= (int)sizeof(buf)) {
+				heap = malloc(len + 1);
+				if (heap)
+					format_value(heap, len + 1, spec, longs,
+						     &field, str);
+				value = heap ? heap : buf;
+			}
+		}
+
+		line_add(&line, lit, start - lit);
+		line_add(&line, value, strlen(value));
+
+		if (ctx->want_fields) {
+			if (has_label(lit, start - lit))
+				name = field_name(ctx, lit, start - lit);
+			if (start - lit >= 2 && start[-2] == '0' && start[-1] == 'x')
+				prefix = "0x";
+			add_field(ctx, index, &field, name, prefix, value);
+		}
+
+		free(heap);
+		lit = p;
+	}
+
+	line_add(&line, lit, strlen(lit));
+	if (line.used)
+		fwrite(line.buf, 1, line.used, line.out);
+}
+
 static void DRM_PRINTFLIKE(3, 4)
 instr_out(struct drm_intel_decode *ctx, unsigned int index,
 	  const char *fmt, ...)
@@ -117,23 +530,28 @@ instr_out(struct drm_intel_decode *ctx, unsigned int index,
 
 	if (index > ctx->count) {
 		if (!ctx->overflowed) {
-			fprintf(out, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
+			out_printf(ctx, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
 			ctx->overflowed = true;
 		}
 		return;
 	}
 
-	if (offset == head_offset)
-		parseinfo = "HEAD";
-	else if (offset == tail_offset)
-		parseinfo = "TAIL";
-	else
-		parseinfo = "    ";
+	if (!ctx->out && !ctx->want_fields)
+		return;
+
+	if (ctx->out) {
+		if (offset == ctx->head)
+			parseinfo = "HEAD";
+		else if (offset == ctx->tail)
+			parseinfo = "TAIL";
+		else
+			parseinfo = "    ";
 
-	fprintf(out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
-		ctx->data[index], index == 0 ? "" : "   ");
+		fprintf(ctx->out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
+			ctx->data[index], index == 0 ? "" : "   ");
+	}
 	va_start(va, fmt);
-	vfprintf(out, fmt, va);
+	instr_vout(ctx, index, fmt, va);
 	va_end(va);
 }
 
@@ -221,72 +639,73 @@ decode_MI_WAIT_FOR_EVENT(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+struct opcode_mi {
+	uint32_t opcode;
+	int len_mask;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+	int (*func)(struct drm_intel_decode *ctx);
+};
+
+static const struct opcode_mi opcodes_mi[] = {
+	{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
+	{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
+	{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
+	{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
+	{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
+	{ 0x04, 0, 1, 1, "MI_FLUSH" },
+	{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
+	{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
+	{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
+	{ 0x00, 0, 1, 1, "MI_NOOP" },
+	{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
+	{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
+	{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
+	{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
+	{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
+	{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
+	{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
+	{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
+	{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
+	{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
+	{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
+	{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
+	{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
+};
+
 static int
 decode_mi(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len = -1;
 	const char *post_sync_op = "";
 	uint32_t *data = ctx->data;
+	const struct opcode_mi *opcode_mi = NULL;
 
-	struct {
-		uint32_t opcode;
-		int len_mask;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_mi[] = {
-		{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
-		{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
-		{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
-		{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
-		{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
-		{ 0x04, 0, 1, 1, "MI_FLUSH" },
-		{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
-		{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
-		{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
-		{ 0x00, 0, 1, 1, "MI_NOOP" },
-		{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
-		{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
-		{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
-		{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
-		{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
-		{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
-		{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
-		{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
-		{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
-		{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
-		{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
-		{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
-		{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
-	}, *opcode_mi = NULL;
+	opcode = (data[0] & 0x1f800000) >> 23;
 
 	/* check instruction length */
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			len = 1;
-			if (opcodes_mi[opcode].max_len > 1) {
-				len =
-				    (data[0] & opcodes_mi[opcode].len_mask) + 2;
-				if (len < opcodes_mi[opcode].min_len
-				    || len > opcodes_mi[opcode].max_len) {
-					fprintf(out,
-						"Bad length (%d) in %s, [%d, %d]\n",
-						len, opcodes_mi[opcode].name,
-						opcodes_mi[opcode].min_len,
-						opcodes_mi[opcode].max_len);
-				}
+	if (ctx->lookup_mi[opcode]) {
+		opcode_mi = &opcodes_mi[ctx->lookup_mi[opcode] - 1];
+		ctx->packet.name = opcode_mi->name;
+		len = 1;
+		if (opcode_mi->max_len > 1) {
+			len = (data[0] & opcode_mi->len_mask) + 2;
+			if (len < opcode_mi->min_len
+			    || len > opcode_mi->max_len) {
+				out_printf(ctx,
+					"Bad length (%d) in %s, [%d, %d]\n",
+					len, opcode_mi->name,
+					opcode_mi->min_len,
+					opcode_mi->max_len);
 			}
-			opcode_mi = &opcodes_mi[opcode];
-			break;
 		}
 	}
 
 	if (opcode_mi && opcode_mi->func)
 		return opcode_mi->func(ctx);
 
-	switch ((data[0] & 0x1f800000) >> 23) {
+	switch (opcode) {
 	case 0x0a:
 		instr_out(ctx, 0, "MI_BATCH_BUFFER_END\n");
 		return -1;
@@ -352,19 +771,15 @@ decode_mi(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			unsigned int i;
-
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_mi[opcode].name);
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
+	if (opcode_mi) {
+		unsigned int i;
 
-			return len;
+		instr_out(ctx, 0, "%s\n", opcode_mi->name);
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "MI UNKNOWN\n");
@@ -415,46 +830,53 @@ decode_2d_br01(struct drm_intel_decode *ctx)
 
 }
 
+struct opcode_simple {
+	uint32_t opcode;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+};
+
+static const struct opcode_simple opcodes_2d[] = {
+	{ 0x40, 5, 5, "COLOR_BLT" },
+	{ 0x43, 6, 6, "SRC_COPY_BLT" },
+	{ 0x01, 8, 8, "XY_SETUP_BLT" },
+	{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
+	{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
+	{ 0x24, 2, 2, "XY_PIXEL_BLT" },
+	{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
+	{ 0x26, 4, 4, "Y_TEXT_BLT" },
+	{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
+	{ 0x50, 6, 6, "XY_COLOR_BLT" },
+	{ 0x51, 6, 6, "XY_PAT_BLT" },
+	{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
+	{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
+	{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
+	{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
+	{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
+	{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
+	{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
+	{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
+	{ 0x55, 9, 9, "XY_FULL_BLT" },
+	{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
+	{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
+	{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
+	{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
+	{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
+};
+
 static int
 decode_2d(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len;
 	uint32_t *data = ctx->data;
+	const struct opcode_simple *opcode_2d;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_2d[] = {
-		{ 0x40, 5, 5, "COLOR_BLT" },
-		{ 0x43, 6, 6, "SRC_COPY_BLT" },
-		{ 0x01, 8, 8, "XY_SETUP_BLT" },
-		{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
-		{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
-		{ 0x24, 2, 2, "XY_PIXEL_BLT" },
-		{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
-		{ 0x26, 4, 4, "Y_TEXT_BLT" },
-		{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
-		{ 0x50, 6, 6, "XY_COLOR_BLT" },
-		{ 0x51, 6, 6, "XY_PAT_BLT" },
-		{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
-		{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
-		{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
-		{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
-		{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
-		{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
-		{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
-		{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
-		{ 0x55, 9, 9, "XY_FULL_BLT" },
-		{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
-		{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
-		{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
-		{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
-		{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
-	};
-
-	switch ((data[0] & 0x1fc00000) >> 22) {
+	opcode = (data[0] & 0x1fc00000) >> 22;
+	if (ctx->lookup_2d[opcode])
+		ctx->packet.name = opcodes_2d[ctx->lookup_2d[opcode] - 1].name;
+
+	switch (opcode) {
 	case 0x25:
 		instr_out(ctx, 0,
 			  "XY_SCANLINES_BLT (pattern seed (%d, %d), dst tile %d)\n",
@@ -463,7 +885,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SCANLINES_BLT\n");
+			out_printf(ctx, "Bad count in XY_SCANLINES_BLT\n");
 
 		instr_out(ctx, 1, "dest (%d,%d)\n",
 			  data[1] & 0xffff, data[1] >> 16);
@@ -475,7 +897,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SETUP_BLT\n");
+			out_printf(ctx, "Bad count in XY_SETUP_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "cliprect (%d,%d)\n",
@@ -493,7 +915,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SETUP_CLIP_BLT\n");
+			out_printf(ctx, "Bad count in XY_SETUP_CLIP_BLT\n");
 
 		instr_out(ctx, 1, "cliprect (%d,%d)\n",
 			  data[1] & 0xffff, data[2] >> 16);
@@ -505,7 +927,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 9)
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in XY_SETUP_MONO_PATTERN_SL_BLT\n");
 
 		decode_2d_br01(ctx);
@@ -525,7 +947,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 6)
-			fprintf(out, "Bad count in XY_COLOR_BLT\n");
+			out_printf(ctx, "Bad count in XY_COLOR_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "(%d,%d)\n",
@@ -540,7 +962,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SRC_COPY_BLT\n");
+			out_printf(ctx, "Bad count in XY_SRC_COPY_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "dst (%d,%d)\n",
@@ -556,29 +978,26 @@ decode_2d(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_2d) / sizeof(opcodes_2d[0]);
-	     opcode++) {
-		if ((data[0] & 0x1fc00000) >> 22 == opcodes_2d[opcode].opcode) {
-			unsigned int i;
-
-			len = 1;
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_2d[opcode].name);
-			if (opcodes_2d[opcode].max_len > 1) {
-				len = (data[0] & 0x000000ff) + 2;
-				if (len < opcodes_2d[opcode].min_len ||
-				    len > opcodes_2d[opcode].max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcodes_2d[opcode].name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+	if (ctx->lookup_2d[opcode]) {
+		unsigned int i;
+
+		opcode_2d = &opcodes_2d[ctx->lookup_2d[opcode] - 1];
+		len = 1;
+		instr_out(ctx, 0, "%s\n", opcode_2d->name);
+		if (opcode_2d->max_len > 1) {
+			len = (data[0] & 0x000000ff) + 2;
+			if (len < opcode_2d->min_len ||
+			    len > opcode_2d->max_len) {
+				out_printf(ctx, "Bad count in %s\n",
+					opcode_2d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "2D UNKNOWN\n");
@@ -595,20 +1014,25 @@ decode_3d_1c(struct drm_intel_decode *ctx)
 
 	switch (opcode) {
 	case 0x11:
+		ctx->packet.name = "3DSTATE_DEPTH_SUBRECTANGLE_DISABLE";
 		instr_out(ctx, 0,
 			  "3DSTATE_DEPTH_SUBRECTANGLE_DISABLE\n");
 		return 1;
 	case 0x10:
+		ctx->packet.name = "3DSTATE_SCISSOR_ENABLE";
 		instr_out(ctx, 0, "3DSTATE_SCISSOR_ENABLE %s\n",
 			  data[0] & 1 ? "enabled" : "disabled");
 		return 1;
 	case 0x01:
+		ctx->packet.name = "3DSTATE_MAP_COORD_SET_I830";
 		instr_out(ctx, 0, "3DSTATE_MAP_COORD_SET_I830\n");
 		return 1;
 	case 0x0a:
+		ctx->packet.name = "3DSTATE_MAP_CUBE_I830";
 		instr_out(ctx, 0, "3DSTATE_MAP_CUBE_I830\n");
 		return 1;
 	case 0x05:
+		ctx->packet.name = "3DSTATE_MAP_TEX_STREAM_I830";
 		instr_out(ctx, 0, "3DSTATE_MAP_TEX_STREAM_I830\n");
 		return 1;
 	}
@@ -620,8 +1044,10 @@ decode_3d_1c(struct drm_intel_decode *ctx)
 
 /** Sets the string dstname to describe the destination of the PS instruction */
 static void
-i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
+i915_get_instruction_dst(struct drm_intel_decode *ctx, int i, char *dstname,
+			 int do_mask)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a0 = data[i];
 	int dst_nr = (a0 >> 14) & 0xf;
 	char dstmask[8];
@@ -657,22 +1083,22 @@ i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
 	switch ((a0 >> 19) & 0x7) {
 	case 0:
 		if (dst_nr > 15)
-			fprintf(out, "bad destination reg R%d\n", dst_nr);
+			out_printf(ctx, "bad destination reg R%d\n", dst_nr);
 		sprintf(dstname, "R%d%s%s", dst_nr, dstmask, sat);
 		break;
 	case 4:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oC%d\n", dst_nr);
+			out_printf(ctx, "bad destination reg oC%d\n", dst_nr);
 		sprintf(dstname, "oC%s%s", dstmask, sat);
 		break;
 	case 5:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oD%d\n", dst_nr);
+			out_printf(ctx, "bad destination reg oD%d\n", dst_nr);
 		sprintf(dstname, "oD%s%s", dstmask, sat);
 		break;
 	case 6:
 		if (dst_nr > 3)
-			fprintf(out, "bad destination reg U%d\n", dst_nr);
+			out_printf(ctx, "bad destination reg U%d\n", dst_nr);
 		sprintf(dstname, "U%d%s%s", dst_nr, dstmask, sat);
 		break;
 	default:
@@ -703,13 +1129,14 @@ i915_get_channel_swizzle(uint32_t select)
 }
 
 static void
-i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_src_name(struct drm_intel_decode *ctx, uint32_t src_type,
+			      uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			out_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -721,39 +1148,41 @@ i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			out_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 2:
 		sprintf(name, "C%d", src_nr);
 		if (src_nr > 31)
-			fprintf(out, "bad src reg %s\n", name);
+			out_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			out_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			out_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	case 6:
 		sprintf(name, "U%d", src_nr);
 		if (src_nr > 3)
-			fprintf(out, "bad src reg %s\n", name);
+			out_printf(ctx, "bad src reg %s\n", name);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		out_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
 }
 
-static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src0(struct drm_intel_decode *ctx, int i,
+				      char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a0 = data[i];
 	uint32_t a1 = data[i + 1];
 	int src_nr = (a0 >> 2) & 0x1f;
@@ -763,15 +1192,17 @@ static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a1 >> 16) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a0 >> 7) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a0 >> 7) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src1(struct drm_intel_decode *ctx, int i,
+				      char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a1 = data[i + 1];
 	uint32_t a2 = data[i + 2];
 	int src_nr = (a1 >> 8) & 0x1f;
@@ -781,15 +1212,17 @@ static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 24) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a1 >> 13) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a1 >> 13) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src2(struct drm_intel_decode *ctx, int i,
+				      char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a2 = data[i + 2];
 	int src_nr = (a2 >> 16) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a2 >> 12) & 0xf);
@@ -798,7 +1231,7 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 0) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a2 >> 21) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a2 >> 21) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
@@ -806,13 +1239,14 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 }
 
 static void
-i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_addr(struct drm_intel_decode *ctx, uint32_t src_type,
+			  uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			out_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -824,22 +1258,22 @@ i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			out_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			out_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			out_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		out_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
@@ -851,8 +1285,8 @@ i915_decode_alu1(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
 
 	instr_out(ctx, i++, "%s: %s %s, %s\n", instr_prefix,
 		  op_name, dst, src0);
@@ -866,9 +1300,9 @@ i915_decode_alu2(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1);
@@ -882,10 +1316,10 @@ i915_decode_alu3(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100], src2[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
-	i915_get_instruction_src2(ctx->data, i, src2);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
+	i915_get_instruction_src2(ctx, i, src2);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1, src2);
@@ -903,8 +1337,8 @@ i915_decode_tex(struct drm_intel_decode *ctx, int i,
 	char addr_name[100];
 	int sampler_nr;
 
-	i915_get_instruction_dst(ctx->data, i, dst_name, 0);
-	i915_get_instruction_addr((t1 >> 24) & 0x7,
+	i915_get_instruction_dst(ctx, i, dst_name, 0);
+	i915_get_instruction_addr(ctx, (t1 >> 24) & 0x7,
 				  (t1 >> 17) & 0xf, addr_name);
 	sampler_nr = t0 & 0xf;
 
@@ -930,30 +1364,30 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 	case 1:
 		sprintf(dcl_mask, ".%s%s%s%s", dcl_x, dcl_y, dcl_z, dcl_w);
 		if (strcmp(dcl_mask, ".") == 0)
-			fprintf(out, "bad (empty) dcl mask\n");
+			out_printf(ctx, "bad (empty) dcl mask\n");
 
 		if (dcl_nr > 10)
-			fprintf(out, "bad T%d dcl register number\n", dcl_nr);
+			out_printf(ctx, "bad T%d dcl register number\n", dcl_nr);
 		if (dcl_nr < 8) {
 			if (strcmp(dcl_mask, ".x") != 0 &&
 			    strcmp(dcl_mask, ".xy") != 0 &&
 			    strcmp(dcl_mask, ".xz") != 0 &&
 			    strcmp(dcl_mask, ".w") != 0 &&
 			    strcmp(dcl_mask, ".xyzw") != 0) {
-				fprintf(out, "bad T%d.%s dcl mask\n", dcl_nr,
+				out_printf(ctx, "bad T%d.%s dcl mask\n", dcl_nr,
 					dcl_mask);
 			}
 			instr_out(ctx, i++, "%s: DCL T%d%s\n",
 				  instr_prefix, dcl_nr, dcl_mask);
 		} else {
 			if (strcmp(dcl_mask, ".xz") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				out_printf(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 			else if (strcmp(dcl_mask, ".xw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				out_printf(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 			else if (strcmp(dcl_mask, ".xzw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				out_printf(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 
 			if (dcl_nr == 8) {
@@ -989,7 +1423,7 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 			break;
 		}
 		if (dcl_nr > 15)
-			fprintf(out, "bad S%d dcl register number\n", dcl_nr);
+			out_printf(ctx, "bad S%d dcl register number\n", dcl_nr);
 		instr_out(ctx, i++, "%s: DCL S%d %s\n",
 			  instr_prefix, dcl_nr, sampletype);
 		instr_out(ctx, i++, "%s\n", instr_prefix);
@@ -1301,6 +1735,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 	switch (opcode) {
 	case 0x07:
+		ctx->packet.name = "3DSTATE_LOAD_INDIRECT";
 		/* This instruction is unusual.  A 0 length means just
 		 * 1 DWORD instead of 2.  The 0 length is specified in
 		 * one place to be unsupported, but stated to be
@@ -1334,11 +1769,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			instr_out(ctx, i++, "PSC.1\n");
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
+			out_printf(ctx, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
 			return len;
 		}
 		return len;
 	case 0x04:
+		ctx->packet.name = "3DSTATE_LOAD_STATE_IMMEDIATE_1";
 		instr_out(ctx, 0,
 			  "3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		len = (data[0] & 0x0000000f) + 2;
@@ -1350,12 +1786,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 					int tex_num;
 
 					if (word == 2) {
-						saved_s2_set = 1;
-						saved_s2 = data[i];
+						ctx->saved_s2_set = 1;
+						ctx->saved_s2 = data[i];
 					}
 					if (word == 4) {
-						saved_s4_set = 1;
-						saved_s4 = data[i];
+						ctx->saved_s4_set = 1;
+						ctx->saved_s4 = data[i];
 					}
 
 					switch (word) {
@@ -1384,43 +1820,43 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 								 tex_num *
 								 4) & 0xf) {
 							case 0:
-								fprintf(out,
+								out_printf(ctx,
 									"%i=2D ",
 									tex_num);
 								break;
 							case 1:
-								fprintf(out,
+								out_printf(ctx,
 									"%i=3D ",
 									tex_num);
 								break;
 							case 2:
-								fprintf(out,
+								out_printf(ctx,
 									"%i=4D ",
 									tex_num);
 								break;
 							case 3:
-								fprintf(out,
+								out_printf(ctx,
 									"%i=1D ",
 									tex_num);
 								break;
 							case 4:
-								fprintf(out,
+								out_printf(ctx,
 									"%i=2D_16 ",
 									tex_num);
 								break;
 							case 5:
-								fprintf(out,
+								out_printf(ctx,
 									"%i=4D_16 ",
 									tex_num);
 								break;
 							case 0xf:
-								fprintf(out,
+								out_printf(ctx,
 									"%i=NP ",
 									tex_num);
 								break;
 							}
 						}
-						fprintf(out, "\n");
+						out_printf(ctx, "\n");
 
 						break;
 					case 3:
@@ -1721,11 +2157,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		}
 		return len;
 	case 0x03:
+		ctx->packet.name = "3DSTATE_LOAD_STATE_IMMEDIATE_2";
 		instr_out(ctx, 0,
 			  "3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		len = (data[0] & 0x0000000f) + 2;
@@ -1771,11 +2208,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		}
 		return len;
 	case 0x00:
+		ctx->packet.name = "3DSTATE_MAP_STATE";
 		instr_out(ctx, 0, "3DSTATE_MAP_STATE\n");
 		len = (data[0] & 0x0000003f) + 2;
 		instr_out(ctx, 1, "mask\n");
@@ -1973,11 +2411,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_MAP_STATE\n");
+			out_printf(ctx, "Bad count in 3DSTATE_MAP_STATE\n");
 			return len;
 		}
 		return len;
 	case 0x06:
+		ctx->packet.name = "3DSTATE_PIXEL_SHADER_CONSTANTS";
 		instr_out(ctx, 0,
 			  "3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		len = (data[0] & 0x000000ff) + 2;
@@ -2000,15 +2439,16 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		}
 		return len;
 	case 0x05:
+		ctx->packet.name = "3DSTATE_PIXEL_SHADER_PROGRAM";
 		instr_out(ctx, 0, "3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		len = (data[0] & 0x000000ff) + 2;
 		if ((len - 1) % 3 != 0 || len > 370) {
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		}
 		i = 1;
@@ -2022,6 +2462,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		}
 		return len;
 	case 0x01:
+		ctx->packet.name = "3DSTATE_SAMPLER_STATE";
 		if (IS_GEN2(devid))
 			break;
 		instr_out(ctx, 0, "3DSTATE_SAMPLER_STATE\n");
@@ -2086,14 +2527,15 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_SAMPLER_STATE\n");
+			out_printf(ctx, "Bad count in 3DSTATE_SAMPLER_STATE\n");
 		}
 		return len;
 	case 0x85:
+		ctx->packet.name = "3DSTATE_DEST_BUFFER_VARIABLES";
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 2)
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_DEST_BUFFER_VARIABLES\n");
 
 		instr_out(ctx, 0,
@@ -2158,12 +2600,13 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x8e:
+		ctx->packet.name = "3DSTATE_BUFFER_INFO";
 		{
 			const char *name, *tiling;
 
 			len = (data[0] & 0x0000000f) + 2;
 			if (len != 3)
-				fprintf(out,
+				out_printf(ctx,
 					"Bad count in 3DSTATE_BUFFER_INFO\n");
 
 			switch ((data[1] >> 24) & 0x7) {
@@ -2193,10 +2636,11 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			return len;
 		}
 	case 0x81:
+		ctx->packet.name = "3DSTATE_SCISSOR_RECTANGLE";
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 3)
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_SCISSOR_RECTANGLE\n");
 
 		instr_out(ctx, 0, "3DSTATE_SCISSOR_RECTANGLE\n");
@@ -2207,10 +2651,11 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 		return len;
 	case 0x80:
+		ctx->packet.name = "3DSTATE_DRAWING_RECTANGLE";
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 5)
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_DRAWING_RECTANGLE\n");
 
 		instr_out(ctx, 0, "3DSTATE_DRAWING_RECTANGLE\n");
@@ -2225,10 +2670,11 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 		return len;
 	case 0x9c:
+		ctx->packet.name = "3DSTATE_CLEAR_PARAMETERS";
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 7)
-			fprintf(out, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
+			out_printf(ctx, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
 
 		instr_out(ctx, 0, "3DSTATE_CLEAR_PARAMETERS\n");
 		instr_out(ctx, 1, "prim_type=%s, clear=%s%s%s\n",
@@ -2253,13 +2699,15 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		if (((data[0] & 0x00ff0000) >> 16) == opcode_3d_1d->opcode) {
 			len = 1;
 
+			ctx->packet.name = opcode_3d_1d->name;
+
 			instr_out(ctx, 0, "%s\n",
 				  opcode_3d_1d->name);
 			if (opcode_3d_1d->max_len > 1) {
 				len = (data[0] & 0x0000ffff) + 2;
 				if (len < opcode_3d_1d->min_len ||
 				    len > opcode_3d_1d->max_len) {
-					fprintf(out, "Bad count in %s\n",
+					out_printf(ctx, "Bad count in %s\n",
 						opcode_3d_1d->name);
 				}
 			}
@@ -2285,8 +2733,10 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	char immediate = (data[0] & (1 << 23)) == 0;
 	unsigned int len, i, j, ret;
 	const char *primtype;
-	int original_s2 = saved_s2;
-	int original_s4 = saved_s4;
+	int original_s2 = ctx->saved_s2;
+	int original_s4 = ctx->saved_s4;
+
+	ctx->packet.name = "3DPRIMITIVE";
 
 	switch ((data[0] >> 18) & 0xf) {
 	case 0x0:
@@ -2321,8 +2771,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 		break;
 	case 0xa:
 		primtype = "CLEAR_RECT";
-		saved_s4 = 3 << 6;
-		saved_s2 = ~0;
+		ctx->saved_s4 = 3 << 6;
+		ctx->saved_s2 = ~0;
 		break;
 	default:
 		primtype = "unknown";
@@ -2336,8 +2786,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 			  primtype);
 		if (count < len)
 			BUFFER_FAIL(count, len, "3DPRIMITIVE inline");
-		if (!saved_s2_set || !saved_s4_set) {
-			fprintf(out, "unknown vertex format\n");
+		if (!ctx->saved_s2_set || !ctx->saved_s4_set) {
+			out_printf(ctx, "unknown vertex format\n");
 			for (i = 1; i < len; i++) {
 				instr_out(ctx, i,
 					  "           vertex data (%f float)\n",
@@ -2352,13 +2802,13 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
     if (i < len)							\
 	instr_out(ctx, i, " V%d."fmt"\n", vertex, __VA_ARGS__); \
     else								\
-	fprintf(out, " missing data in V%d\n", vertex);			\
+	out_printf(ctx, " missing data in V%d\n", vertex);			\
     i++;								\
 } while (0)
 
 				VERTEX_OUT("X = %f", int_as_float(data[i]));
 				VERTEX_OUT("Y = %f", int_as_float(data[i]));
-				switch (saved_s4 >> 6 & 0x7) {
+				switch (ctx->saved_s4 >> 6 & 0x7) {
 				case 0x1:
 					VERTEX_OUT("Z = %f",
 						   int_as_float(data[i]));
@@ -2376,10 +2826,10 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 						   int_as_float(data[i]));
 					break;
 				default:
-					fprintf(out, "bad S4 position mask\n");
+					out_printf(ctx, "bad S4 position mask\n");
 				}
 
-				if (saved_s4 & (1 << 10)) {
+				if (ctx->saved_s4 & (1 << 10)) {
 					VERTEX_OUT
 					    ("color = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2387,7 +2837,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 11)) {
+				if (ctx->saved_s4 & (1 << 11)) {
 					VERTEX_OUT
 					    ("spec = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2395,11 +2845,11 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 12))
+				if (ctx->saved_s4 & (1 << 12))
 					VERTEX_OUT("width = 0x%08x)", data[i]);
 
 				for (tc = 0; tc <= 7; tc++) {
-					switch ((saved_s2 >> (tc * 4)) & 0xf) {
+					switch ((ctx->saved_s2 >> (tc * 4)) & 0xf) {
 					case 0x0:
 						VERTEX_OUT("T%d.X = %f", tc,
 							   int_as_float(data
@@ -2454,7 +2904,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					case 0xf:
 						break;
 					default:
-						fprintf(out,
+						out_printf(ctx,
 							"bad S2.T%d format\n",
 							tc);
 					}
@@ -2499,7 +2949,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 							  data[i] >> 16);
 					}
 				}
-				fprintf(out,
+				out_printf(ctx,
 					"3DPRIMITIVE: no terminator found in index buffer\n");
 				ret = count;
 				goto out;
@@ -2532,35 +2982,29 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	}
 
 out:
-	saved_s2 = original_s2;
-	saved_s4 = original_s4;
+	ctx->saved_s2 = original_s2;
+	ctx->saved_s4 = original_s4;
 	return ret;
 }
 
+static const struct opcode_simple opcodes_3d[] = {
+	{ 0x06, 1, 1, "3DSTATE_ANTI_ALIASING" },
+	{ 0x08, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
+	{ 0x09, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
+	{ 0x16, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
+	{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x0b, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
+	{ 0x0d, 1, 1, "3DSTATE_MODES_4" },
+	{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
+};
+
 static int
 decode_3d(struct drm_intel_decode *ctx)
 {
 	uint32_t opcode;
-	unsigned int idx;
 	uint32_t *data = ctx->data;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x06, 1, 1, "3DSTATE_ANTI_ALIASING" },
-		{ 0x08, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
-		{ 0x09, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
-		{ 0x16, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x0b, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
-		{ 0x0d, 1, 1, "3DSTATE_MODES_4" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
-	}, *opcode_3d;
-
 	opcode = (data[0] & 0x1f000000) >> 24;
 
 	switch (opcode) {
@@ -2572,26 +3016,26 @@ decode_3d(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if (opcode == opcode_3d->opcode) {
-			unsigned int len = 1, i;
-
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
+	if (ctx->lookup_3d[opcode]) {
+		const struct opcode_simple *opcode_3d;
+		unsigned int len = 1, i;
+
+		opcode_3d = &opcodes_3d[ctx->lookup_3d[opcode] - 1];
+		ctx->packet.name = opcode_3d->name;
+		instr_out(ctx, 0, "%s\n", opcode_3d->name);
+		if (opcode_3d->max_len > 1) {
+			len = (data[0] & 0xff) + 2;
+			if (len < opcode_3d->min_len ||
+			    len > opcode_3d->max_len) {
+				out_printf(ctx, "Bad count in %s\n",
+					opcode_3d->name);
 			}
+		}
 
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+		return len;
 	}
 
 	instr_out(ctx, 0, "3D UNKNOWN: 3d opcode = 0x%x\n", opcode);
@@ -2724,7 +3168,7 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 	uint32_t *data = ctx->data;
 
 	if (len != 3)
-		fprintf(out, "Bad count in URB_FENCE\n");
+		out_printf(ctx, "Bad count in URB_FENCE\n");
 
 	vs_fence = data[1] & 0x3ff;
 	gs_fence = (data[1] >> 10) & 0x3ff;
@@ -2747,13 +3191,13 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 		  "sf fence: %d, vfe_fence: %d, cs_fence: %d\n",
 		  sf_fence, vfe_fence, cs_fence);
 	if (gs_fence < vs_fence)
-		fprintf(out, "gs fence < vs fence!\n");
+		out_printf(ctx, "gs fence < vs fence!\n");
 	if (clip_fence < gs_fence)
-		fprintf(out, "clip fence < gs fence!\n");
+		out_printf(ctx, "clip fence < gs fence!\n");
 	if (sf_fence < clip_fence)
-		fprintf(out, "sf fence < clip fence!\n");
+		out_printf(ctx, "sf fence < clip fence!\n");
 	if (cs_fence < sf_fence)
-		fprintf(out, "cs fence < sf fence!\n");
+		out_printf(ctx, "cs fence < sf fence!\n");
 
 	return len;
 }
@@ -3129,6 +3573,107 @@ gen7_3DPRIMITIVE(struct drm_intel_decode *ctx)
 	return 7;
 }
 
+struct opcode_3d_965 {
+	uint32_t opcode;
+	uint32_t len_mask;
+	int unsigned min_len;
+	int unsigned max_len;
+	const char *name;
+	int gen;
+	int (*func)(struct drm_intel_decode *ctx);
+};
+
+static const struct opcode_3d_965 opcodes_3d_965[] = {
+	{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
+	{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
+	{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
+	{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
+	{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
+	{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
+	{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
+	{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
+	{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
+	{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
+	{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
+	{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
+	{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
+	{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
+	{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
+	{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
+	{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
+	{ 0x780e, 0xffff, 4, 4, "3DSTATE_CC_STATE_POINTERS", 6, gen6_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780e, 0x00ff, 2, 2, "3DSTATE_CC_STATE_POINTERS", 7, gen7_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
+	{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
+	{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
+	{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
+	{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
+	{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
+	{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
+	{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
+	{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
+	{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
+	{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
+	{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
+	{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
+	{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
+	{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
+	{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
+	{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
+	{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
+	{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
+	{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
+	{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
+	{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
+	{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
+	{ 0x7821, 0x00ff, 2, 2, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP", 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
+	{ 0x7823, 0x00ff, 2, 2, "3DSTATE_VIEWPORT_STATE_POINTERS_CC", 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
+	{ 0x7824, 0x00ff, 2, 2, "3DSTATE_BLEND_STATE_POINTERS", 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
+	{ 0x7825, 0x00ff, 2, 2, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS", 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
+	{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
+	{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
+	{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
+	{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
+	{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
+	{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
+	{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
+	{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
+	{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
+	{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
+	{ 0x7830, 0x00ff, 2, 2, "3DSTATE_URB_VS", 7, gen7_3DSTATE_URB_VS },
+	{ 0x7831, 0x00ff, 2, 2, "3DSTATE_URB_HS", 7, gen7_3DSTATE_URB_HS },
+	{ 0x7832, 0x00ff, 2, 2, "3DSTATE_URB_DS", 7, gen7_3DSTATE_URB_DS },
+	{ 0x7833, 0x00ff, 2, 2, "3DSTATE_URB_GS", 7, gen7_3DSTATE_URB_GS },
+	{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
+	{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
+	{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
+	{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
+	{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
+	{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
+	{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
+	{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
+	{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
+	{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
+	{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
+	{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
+	{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
+	{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
+	{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
+	{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
+	{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
+	{ 0x7b00, 0x00ff, 7, 7, "3DPRIMITIVE", 7, gen7_3DPRIMITIVE },
+	{ 0x7b00, 0x00ff, 6, 6, "3DPRIMITIVE", 0, gen4_3DPRIMITIVE },
+};
+
 static int
 decode_3d_965(struct drm_intel_decode *ctx)
 {
@@ -3139,120 +3684,17 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	uint32_t *data = ctx->data;
 	uint32_t devid = ctx->devid;
 
-	struct {
-		uint32_t opcode;
-		uint32_t len_mask;
-		int unsigned min_len;
-		int unsigned max_len;
-		const char *name;
-		int gen;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_3d[] = {
-		{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
-		{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
-		{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
-		{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
-		{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
-		{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
-		{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
-		{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
-		{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
-		{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
-		{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
-		{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
-		{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
-		{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
-		{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
-		{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
-		{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
-		{ 0x780e, 0xffff, 4, 4, NULL, 6, gen6_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780e, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
-		{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
-		{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
-		{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
-		{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
-		{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
-		{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
-		{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
-		{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
-		{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
-		{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
-		{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
-		{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
-		{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
-		{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
-		{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
-		{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
-		{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
-		{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
-		{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
-		{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
-		{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
-		{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
-		{ 0x7821, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
-		{ 0x7823, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
-		{ 0x7824, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
-		{ 0x7825, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
-		{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
-		{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
-		{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
-		{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
-		{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
-		{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
-		{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
-		{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
-		{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
-		{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
-		{ 0x7830, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_VS },
-		{ 0x7831, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_HS },
-		{ 0x7832, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_DS },
-		{ 0x7833, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_GS },
-		{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
-		{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
-		{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
-		{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
-		{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
-		{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
-		{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
-		{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
-		{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
-		{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
-		{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
-		{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
-		{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
-		{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
-		{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
-		{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
-		{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
-		{ 0x7b00, 0x00ff, 7, 7, NULL, 7, gen7_3DPRIMITIVE },
-		{ 0x7b00, 0x00ff, 6, 6, NULL, 0, gen4_3DPRIMITIVE },
-	}, *opcode_3d = NULL;
+	const struct opcode_3d_965 *opcode_3d = NULL;
 
 	opcode = (data[0] & 0xffff0000) >> 16;
 
-	for (i = 0; i < ARRAY_SIZE(opcodes_3d); i++) {
-		if (opcode != opcodes_3d[i].opcode)
-			continue;
-
-		/* If it's marked as not our gen, skip. */
-		if (opcodes_3d[i].gen && opcodes_3d[i].gen != ctx->gen)
-			continue;
-
-		opcode_3d = &opcodes_3d[i];
-		break;
-	}
+	/* Type 3 pipeline packets all have 0x6000 set in the opcode. */
+	i = ctx->lookup_3d_965[opcode & 0x1fff];
+	if (i)
+		opcode_3d = &opcodes_3d_965[i - 1];
 
 	if (opcode_3d) {
+		ctx->packet.name = opcode_3d->name;
 		if (opcode_3d->max_len == 1)
 			len = 1;
 		else
@@ -3260,7 +3702,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		if (len < opcode_3d->min_len ||
 		    len > opcode_3d->max_len) {
-			fprintf(out, "Bad length %d in %s, expected %d-%d\n",
+			out_printf(ctx, "Bad length %d in %s, expected %d-%d\n",
 				len, opcode_3d->name,
 				opcode_3d->min_len, opcode_3d->max_len);
 		}
@@ -3297,7 +3739,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		else
 			sba_len = 6;
 		if (len != sba_len)
-			fprintf(out, "Bad count in STATE_BASE_ADDRESS\n");
+			out_printf(ctx, "Bad count in STATE_BASE_ADDRESS\n");
 
 		state_base_out(ctx, i++, "general");
 		state_base_out(ctx, i++, "surface");
@@ -3326,7 +3768,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 	case 0x7801:
 		if (len != 6 && len != 4)
-			fprintf(out,
+			out_printf(ctx,
 				"Bad count in 3DSTATE_BINDING_TABLE_POINTERS\n");
 		if (len == 6) {
 			instr_out(ctx, 0,
@@ -3375,7 +3817,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7808:
 		if ((len - 1) % 4 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
+			out_printf(ctx, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_BUFFERS\n");
 
 		for (i = 1; i < len;) {
@@ -3400,7 +3842,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7809:
 		if ((len + 1) % 2 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
+			out_printf(ctx, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_ELEMENTS\n");
 
 		for (i = 1; i < len;) {
@@ -3628,7 +4070,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	case 0x7a00:
 		if (IS_GEN6(devid) || IS_GEN7(devid)) {
 			if (len != 4 && len != 5)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				out_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[1] >> 14) & 0x3) {
 			case 0:
@@ -3694,7 +4136,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 			return len;
 		} else {
 			if (len != 4)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				out_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[0] >> 14) & 0x3) {
 			case 0:
@@ -3742,37 +4184,31 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+static const struct opcode_simple opcodes_3d_i830[] = {
+	{ 0x02, 1, 1, "3DSTATE_MODES_3" },
+	{ 0x03, 1, 1, "3DSTATE_ENABLES_1" },
+	{ 0x04, 1, 1, "3DSTATE_ENABLES_2" },
+	{ 0x05, 1, 1, "3DSTATE_VFT0" },
+	{ 0x06, 1, 1, "3DSTATE_AA" },
+	{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
+	{ 0x08, 1, 1, "3DSTATE_MODES_1" },
+	{ 0x09, 1, 1, "3DSTATE_STENCIL_TEST" },
+	{ 0x0a, 1, 1, "3DSTATE_VFT1" },
+	{ 0x0b, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
+	{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x0d, 1, 1, "3DSTATE_MAP_BLEND_OP" },
+	{ 0x0e, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
+	{ 0x0f, 1, 1, "3DSTATE_MODES_2" },
+	{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x16, 1, 1, "3DSTATE_MODES_4"},
+};
+
 static int
 decode_3d_i830(struct drm_intel_decode *ctx)
 {
-	unsigned int idx;
 	uint32_t opcode;
 	uint32_t *data = ctx->data;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x02, 1, 1, "3DSTATE_MODES_3" },
-		{ 0x03, 1, 1, "3DSTATE_ENABLES_1" },
-		{ 0x04, 1, 1, "3DSTATE_ENABLES_2" },
-		{ 0x05, 1, 1, "3DSTATE_VFT0" },
-		{ 0x06, 1, 1, "3DSTATE_AA" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
-		{ 0x08, 1, 1, "3DSTATE_MODES_1" },
-		{ 0x09, 1, 1, "3DSTATE_STENCIL_TEST" },
-		{ 0x0a, 1, 1, "3DSTATE_VFT1" },
-		{ 0x0b, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x0d, 1, 1, "3DSTATE_MAP_BLEND_OP" },
-		{ 0x0e, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
-		{ 0x0f, 1, 1, "3DSTATE_MODES_2" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x16, 1, 1, "3DSTATE_MODES_4"},
-	}, *opcode_3d;
-
 	opcode = (data[0] & 0x1f000000) >> 24;
 
 	switch (opcode) {
@@ -3784,26 +4220,26 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if ((data[0] & 0x1f000000) >> 24 == opcode_3d->opcode) {
-			unsigned int len = 1, i;
-
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
+	if (ctx->lookup_3d_i830[opcode]) {
+		const struct opcode_simple *opcode_3d;
+		unsigned int len = 1, i;
+
+		opcode_3d = &opcodes_3d_i830[ctx->lookup_3d_i830[opcode] - 1];
+		ctx->packet.name = opcode_3d->name;
+		instr_out(ctx, 0, "%s\n", opcode_3d->name);
+		if (opcode_3d->max_len > 1) {
+			len = (data[0] & 0xff) + 2;
+			if (len < opcode_3d->min_len ||
+			    len > opcode_3d->max_len) {
+				out_printf(ctx, "Bad count in %s\n",
+					opcode_3d->name);
 			}
+		}
 
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+		return len;
 	}
 
 	instr_out(ctx, 0, "3D UNKNOWN: 3d_i830 opcode = 0x%x\n",
@@ -3811,6 +4247,30 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+static void
+decode_context_init_lookups(struct drm_intel_decode *ctx)
+{
+	unsigned int i;
+
+	/* Walk the tables backwards so that the first match wins, as it did
+	 * when they were searched linearly.
+	 */
+	for (i = ARRAY_SIZE(opcodes_mi); i-- > 0; )
+		ctx->lookup_mi[opcodes_mi[i].opcode] = i + 1;
+	for (i = ARRAY_SIZE(opcodes_2d); i-- > 0; )
+		ctx->lookup_2d[opcodes_2d[i].opcode] = i + 1;
+	for (i = ARRAY_SIZE(opcodes_3d); i-- > 0; )
+		ctx->lookup_3d[opcodes_3d[i].opcode] = i + 1;
+	for (i = ARRAY_SIZE(opcodes_3d_i830); i-- > 0; )
+		ctx->lookup_3d_i830[opcodes_3d_i830[i].opcode] = i + 1;
+	for (i = ARRAY_SIZE(opcodes_3d_965); i-- > 0; ) {
+		/* If it's marked as not our gen, skip. */
+		if (opcodes_3d_965[i].gen && opcodes_3d_965[i].gen != ctx->gen)
+			continue;
+		ctx->lookup_3d_965[opcodes_3d_965[i].opcode & 0x1fff] = i + 1;
+	}
+}
+
 drm_public struct drm_intel_decode *
 drm_intel_decode_context_alloc(uint32_t devid)
 {
@@ -3842,12 +4302,17 @@ drm_intel_decode_context_alloc(uint32_t devid)
 		ctx->gen = 2;
 	}
 
+	decode_context_init_lookups(ctx);
+
 	return ctx;
 }
 
 drm_public void
 drm_intel_decode_context_free(struct drm_intel_decode *ctx)
 {
+	free(ctx->fields);
+	free(ctx->field_strings);
+	free(ctx->strings);
 	free(ctx);
 }
 
@@ -3883,47 +4348,42 @@ drm_intel_decode_set_output_file(struct drm_intel_decode *ctx,
 }
 
 /**
- * Decodes an i830-i915 batch buffer, writing the output to stdout.
+ * Sets a callback to be handed a drm_intel_decode_packet record for every
+ * packet drm_intel_decode() walks, after its text (if any) has been written.
  *
- * \param data batch buffer contents
- * \param count number of DWORDs to decode in the batch buffer
- * \param hw_offset hardware address for the buffer
+ * The record carries the fields the text output is made of, with their
+ * labels and values, so that tools can use them without parsing the text.
+ * Together with a NULL output file nothing is written out.
  */
 drm_public void
-drm_intel_decode(struct drm_intel_decode *ctx)
+drm_intel_decode_set_packet_callback(struct drm_intel_decode *ctx,
+				     drm_intel_decode_packet_func func,
+				     void *data)
 {
-	int ret;
-	unsigned int index = 0;
-	uint32_t devid;
-	int size;
-	void *temp;
-
-	if (!ctx)
-		return;
-
-	/* Put a scratch page full of obviously undefined data after
-	 * the batchbuffer.  This lets us avoid a bunch of length
-	 * checking in statically sized packets.
-	 */
-	size = ctx->base_count * 4;
-	temp = malloc(size + 4096);
-	memcpy(temp, ctx->base_data, size);
-	memset((char *)temp + size, 0xd0, 4096);
-	ctx->data = temp;
-
-	ctx->hw_offset = ctx->base_hw_offset;
-	ctx->count = ctx->base_count;
+	ctx->packet_func = func;
+	ctx->packet_data = data;
+	ctx->want_fields = func != NULL;
+}
 
-	devid = ctx->devid;
-	head_offset = ctx->head;
-	tail_offset = ctx->tail;
-	out = ctx->out;
+/**
+ * Decodes packets from ctx->data on, until only @end_count DWORDs of the
+ * batch are left.
+ */
+static void
+decode_packets(struct drm_intel_decode *ctx, uint32_t end_count)
+{
+	uint32_t devid = ctx->devid;
+	unsigned int index, i;
+	int ret;
 
-	saved_s2_set = 0;
-	saved_s4_set = 1;
+	while (ctx->count > end_count) {
+		uint32_t length;
 
-	while (ctx->count > 0) {
 		index = 0;
+		ret = 0;
+		ctx->packet.name = NULL;
+		ctx->num_fields = 0;
+		ctx->strings_used = 0;
 
 		switch ((ctx->data[index] & 0xe0000000) >> 29) {
 		case 0x0:
@@ -3966,7 +4426,28 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 			index++;
 			break;
 		}
-		fflush(out);
+		if (ctx->out)
+			fflush(ctx->out);
+
+		if (ctx->packet_func) {
+			length = ret == -1 ? 1 : index;
+			ctx->packet.hw_offset = ctx->hw_offset;
+			ctx->packet.data = ctx->data;
+			ctx->packet.length = length < ctx->count ?
+					     length : ctx->count;
+			for (i = 0; i < ctx->num_fields; i++) {
+				struct decode_field_strings *strings =
+					&ctx->field_strings[i];
+
+				ctx->fields[i].name = strings->name < 0 ? NULL :
+					ctx->strings + strings->name;
+				ctx->fields[i].value =
+					ctx->strings + strings->value;
+			}
+			ctx->packet.fields = ctx->fields;
+			ctx->packet.num_fields = ctx->num_fields;
+			ctx->packet_func(ctx->packet_data, &ctx->packet);
+		}
 
 		if (ctx->count < index)
 			break;
@@ -3976,5 +4457,203 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 		ctx->hw_offset += 4 * index;
 	}
 
+}
+
+#if HAVE_OPEN_MEMSTREAM
+struct decode_split {
+	uint32_t base_hw_offset;
+	uint32_t chunk_count;
+	uint32_t *starts;
+	int num_starts;
+	int max_starts;
+};
+
+static void
+decode_split_packet(void *data, const struct drm_intel_decode_packet *packet)
+{
+	struct decode_split *split = data;
+	uint32_t start = (packet->hw_offset - split->base_hw_offset) / 4;
+
+	if (split->num_starts < split->max_starts &&
+	    start >= (split->num_starts + 1) * split->chunk_count)
+		split->starts[split->num_starts++] = start;
+}
+
+struct decode_chunk {
+	pthread_t thread;
+	bool threaded;
+	struct drm_intel_decode ctx;
+	uint32_t end_count;
+	char *text;
+	size_t size;
+};
+
+static void *
+decode_chunk_thread(void *data)
+{
+	struct decode_chunk *chunk = data;
+
+	decode_packets(&chunk->ctx, chunk->end_count);
+	fclose(chunk->ctx.out);
+
+	return NULL;
+}
+
+/**
+ * Decodes the batch with ctx->num_threads threads, each writing the text of
+ * its share of the packets to memory, which is then written out in order.
+ *
+ * Packets are variable length, so the batch is first walked without any
+ * output to find where packets start.  Gen2/3 can't be split, as decoding
+ * inline vertices depends on state loaded by earlier packets.
+ */
+static bool
+decode_threaded(struct drm_intel_decode *ctx)
+{
+	struct decode_split split;
+	struct decode_chunk *chunks;
+	FILE *out = ctx->out;
+	bool overflowed = ctx->overflowed;
+	void *packet_data = ctx->packet_data;
+	uint32_t *data = ctx->data;
+	int num_chunks, started, i;
+	bool ok;
+
+	if (ctx->num_threads <= 1 || ctx->gen < 4 || !out || ctx->packet_func)
+		return false;
+
+	memset(&split, 0, sizeof(split));
+	split.base_hw_offset = ctx->hw_offset;
+	split.chunk_count = ctx->count / ctx->num_threads;
+	split.max_starts = ctx->num_threads - 1;
+	split.starts = calloc(split.max_starts, sizeof(*split.starts));
+	if (!split.starts)
+		return false;
+
+	ctx->out = NULL;
+	ctx->packet_func = decode_split_packet;
+	ctx->packet_data = &split;
+	decode_packets(ctx, 0);
+	ctx->out = out;
+	ctx->packet_func = NULL;
+	ctx->packet_data = packet_data;
+	ctx->overflowed = overflowed;
+
+	ctx->data = data;
+	ctx->hw_offset = ctx->base_hw_offset;
+	ctx->count = ctx->base_count;
+
+	num_chunks = split.num_starts + 1;
+	chunks = num_chunks > 1 ? calloc(num_chunks, sizeof(*chunks)) : NULL;
+	if (!chunks) {
+		free(split.starts);
+		return false;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		struct decode_chunk *chunk = &chunks[i];
+		uint32_t start = i ? split.starts[i - 1] : 0;
+
+		chunk->ctx = *ctx;
+		chunk->ctx.data = data + start;
+		chunk->ctx.count = ctx->base_count - start;
+		chunk->ctx.hw_offset = ctx->base_hw_offset + 4 * start;
+		chunk->end_count = i < split.num_starts ?
+				   ctx->base_count - split.starts[i] : 0;
+		chunk->ctx.out = open_memstream(&chunk->text, &chunk->size);
+		if (!chunk->ctx.out)
+			break;
+		chunk->threaded = pthread_create(&chunk->thread, NULL,
+						 decode_chunk_thread,
+						 chunk) == 0;
+	}
+
+	/* If we ran out of streams, the caller decodes serially instead. */
+	started = i;
+	ok = started == num_chunks;
+
+	for (i = 0; i < started; i++) {
+		struct decode_chunk *chunk = &chunks[i];
+
+		if (chunk->threaded)
+			pthread_join(chunk->thread, NULL);
+		else if (ok)
+			decode_chunk_thread(chunk);
+		else
+			fclose(chunk->ctx.out);
+	}
+
+	for (i = 0; i < started; i++) {
+		if (ok) {
+			fwrite(chunks[i].text, 1, chunks[i].size, out);
+			if (chunks[i].ctx.overflowed)
+				ctx->overflowed = true;
+		}
+		free(chunks[i].text);
+	}
+	if (ok)
+		fflush(out);
+
+	free(chunks);
+	free(split.starts);
+	return ok;
+}
+#else
+static bool
+decode_threaded(struct drm_intel_decode *ctx)
+{
+	return false;
+}
+#endif
+
+/**
+ * Sets the number of threads drm_intel_decode() may use.
+ *
+ * With more than one, large gen4+ batches are split at packet boundaries
+ * and decoded in parallel, with the same output.  This only applies to
+ * text output: with a packet callback set, decoding stays serial so that
+ * the callback sees the packets in order.
+ */
+drm_public void
+drm_intel_decode_set_threads(struct drm_intel_decode *ctx, int num_threads)
+{
+	ctx->num_threads = num_threads;
+}
+
+/**
+ * Decodes an i830-i915 batch buffer, writing the output to stdout.
+ *
+ * \param data batch buffer contents
+ * \param count number of DWORDs to decode in the batch buffer
+ * \param hw_offset hardware address for the buffer
+ */
+drm_public void
+drm_intel_decode(struct drm_intel_decode *ctx)
+{
+	int size;
+	void *temp;
+
+	if (!ctx)
+		return;
+
+	/* Put a scratch page full of obviously undefined data after
+	 * the batchbuffer.  This lets us avoid a bunch of length
+	 * checking in statically sized packets.
+	 */
+	size = ctx->base_count * 4;
+	temp = malloc(size + 4096);
+	memcpy(temp, ctx->base_data, size);
+	memset((char *)temp + size, 0xd0, 4096);
+	ctx->data = temp;
+
+	ctx->hw_offset = ctx->base_hw_offset;
+	ctx->count = ctx->base_count;
+
+	ctx->saved_s2_set = 0;
+	ctx->saved_s4_set = 1;
+
+	if (!decode_threaded(ctx))
+		decode_packets(ctx, 0);
+
 	free(temp);
 }
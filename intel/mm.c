@@ -29,13 +29,141 @@
 #include "libdrm_macros.h"
 #include "mm.h"
 
+/*
+ * Free blocks are kept in segregated free lists, two-level as in TLSF: the
+ * first level splits sizes by power of two, the second splits each power of
+ * two range into SL_COUNT lists.  Bitmaps of the non-empty lists make both
+ * finding a free block and freeing one O(1).
+ */
+#define SL_LOG2		4
+#define SL_COUNT	(1 << SL_LOG2)
+#define FL_COUNT	(32 - SL_LOG2)
+
+/** The heap sentinel, followed by the free lists. */
+struct mem_heap {
+	struct mem_block head;
+	unsigned int fl_bitmap;
+	unsigned int sl_bitmap[FL_COUNT];
+	struct mem_block *free_lists[FL_COUNT][SL_COUNT];
+};
+
+static struct mem_heap *to_heap(struct mem_block *heap)
+{
+	return (struct mem_heap *)heap;
+}
+
+static void mapping(unsigned int size, int *fl, int *sl)
+{
+	if (size < SL_COUNT) {
+		*fl = 0;
+		*sl = size;
+	} else {
+		int bit = 31 - __builtin_clz(size);
+
+		*fl = bit - SL_LOG2 + 1;
+		*sl = (size >> (bit - SL_LOG2)) ^ SL_COUNT;
+	}
+}
+
+static void free_list_insert(struct mem_heap *heap, struct mem_block *p)
+{
+	int fl, sl;
+
+	mapping(p->size, &fl, &sl);
+
+	p->prev_free = NULL;
+	p->next_free = heap->free_lists[fl][sl];
+	if (p->next_free)
+		p->next_free->prev_free = p;
+	heap->free_lists[fl][sl] = p;
+
+	heap->fl_bitmap |= 1U << fl;
+	heap->sl_bitmap[fl] |= 1U << sl;
+}
+
+static void free_list_remove(struct mem_heap *heap, struct mem_block *p)
+{
+	int fl, sl;
+
+	mapping(p->size, &fl, &sl);
+
+	if (p->next_free)
+		p->next_free->prev_free = p->prev_free;
+	if (p->prev_free)
+		p->prev_free->next_free = p->next_free;
+	else
+		heap->free_lists[fl][sl] = p->next_free;
+
+	if (!heap->free_lists[fl][sl]) {
+		heap->sl_bitmap[fl] &= ~(1U << sl);
+		if (!heap->sl_bitmap[fl])
+			heap->fl_bitmap &= ~(1U << fl);
+	}
+
+	p->next_free = NULL;
+	p->prev_free = NULL;
+}
+
+/**
+ * Returns a free block with room for 'size' bytes at 'mask' + 1 alignment,
+ * or NULL.
+ *
+ * The first block of the list 'size' maps to is tried, as it often fits
+ * exactly.  Past that, 'size' + 'mask' is rounded up to the next list, so
+ * that any block of that list fits.
+ */
+static struct mem_block *find_free_block(struct mem_heap *heap,
+					 unsigned int size, int mask)
+{
+	unsigned int fl_map, sl_map;
+	struct mem_block *p;
+	int fl, sl;
+
+	mapping(size, &fl, &sl);
+	p = fl < FL_COUNT ? heap->free_lists[fl][sl] : NULL;
+	if (p && ((p->ofs + mask) & ~mask) - p->ofs + size <=
+		 (unsigned int)p->size)
+		return p;
+
+	if (size > ~0U - mask)
+		return NULL;
+	size += mask;
+	if (size >= SL_COUNT) {
+		unsigned int round = (1U << (31 - __builtin_clz(size) -
+					     SL_LOG2)) - 1;
+
+		if (size > ~round)
+			return NULL;
+		size += round;
+	}
+	mapping(size, &fl, &sl);
+	if (fl >= FL_COUNT)
+		return NULL;
+
+	sl_map = heap->sl_bitmap[fl] & (~0U << sl);
+	if (!sl_map) {
+		if (fl + 1 >= FL_COUNT)
+			return NULL;
+		fl_map = heap->fl_bitmap & (~0U << (fl + 1));
+		if (!fl_map)
+			return NULL;
+		fl = __builtin_ctz(fl_map);
+		sl_map = heap->sl_bitmap[fl];
+	}
+	sl = __builtin_ctz(sl_map);
+
+	return heap->free_lists[fl][sl];
+}
+
 drm_private void mmDumpMemInfo(const struct mem_block *heap)
 {
 	drmMsg("Memory heap %p:\n", (void *)heap);
 	if (heap == 0) {
 		drmMsg("  heap == 0\n");
 	} else {
+		const struct mem_heap *mem_heap = (const struct mem_heap *)heap;
 		const struct mem_block *p;
+		int fl, sl;
 
 		for (p = heap->next; p != heap; p = p->next) {
 			drmMsg("  Offset:%08x, Size:%08x, %c%c\n", p->ofs,
@@ -45,24 +173,76 @@ drm_private void mmDumpMemInfo(const struct mem_block *heap)
 
 		drmMsg("\nFree list:\n");
 
-		for (p = heap->next_free; p != heap; p = p->next_free) {
-			drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n", p->ofs,
-			       p->size, p->free ? 'F' : '.',
-			       p->reserved ? 'R' : '.');
+		for (fl = 0; fl < FL_COUNT; fl++) {
+			for (sl = 0; sl < SL_COUNT; sl++) {
+				for (p = mem_heap->free_lists[fl][sl]; p;
+				     p = p->next_free) {
+					drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n",
+					       p->ofs, p->size,
+					       p->free ? 'F' : '.',
+					       p->reserved ? 'R' : '.');
+				}
+			}
 		}
 
 	}
 	drmMsg("End of memory blocks\n");
 }
 
+drm_private int mmCheckHeap(const struct mem_block *heap)
+{
+	const struct mem_heap *mem_heap = (const struct mem_heap *)heap;
+	const struct mem_block *p;
+	int fl, sl, map_fl, map_sl, num_free = 0;
+
+	/* Blocks tile the heap in address order, and are never left as two
+	 * adjacent free blocks.
+	 */
+	for (p = heap->next; p != heap; p = p->next) {
+		if (p->next->prev != p || p->heap != heap || p->size <= 0)
+			return -1;
+		if (p->next != heap && p->ofs + p->size != p->next->ofs)
+			return -1;
+		if (p->free && p->next != heap && p->next->free)
+			return -1;
+		if (p->free)
+			num_free++;
+	}
+
+	/* Every free block is in the list its size maps to, and only there. */
+	for (fl = 0; fl < FL_COUNT; fl++) {
+		if (!(mem_heap->fl_bitmap & (1U << fl)) != !mem_heap->sl_bitmap[fl])
+			return -1;
+		for (sl = 0; sl < SL_COUNT; sl++) {
+			if (!(mem_heap->sl_bitmap[fl] & (1U << sl)) !=
+			    !mem_heap->free_lists[fl][sl])
+				return -1;
+			for (p = mem_heap->free_lists[fl][sl]; p;
+			     p = p->next_free) {
+				if (!p->free || p->heap != heap)
+					return -1;
+				if (p->next_free && p->next_free->prev_free != p)
+					return -1;
+				mapping(p->size, &map_fl, &map_sl);
+				if (map_fl != fl || map_sl != sl)
+					return -1;
+				num_free--;
+			}
+		}
+	}
+
+	return num_free == 0 ? 0 : -1;
+}
+
 drm_private struct mem_block *mmInit(int ofs, int size)
 {
-	struct mem_block *heap, *block;
+	struct mem_heap *heap;
+	struct mem_block *block;
 
 	if (size <= 0)
 		return NULL;
 
-	heap = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+	heap = (struct mem_heap *)calloc(1, sizeof(struct mem_heap));
 	if (!heap)
 		return NULL;
 
@@ -72,90 +252,79 @@ drm_private struct mem_block *mmInit(int ofs, int size)
 		return NULL;
 	}
 
-	heap->next = block;
-	heap->prev = block;
-	heap->next_free = block;
-	heap->prev_free = block;
+	heap->head.next = block;
+	heap->head.prev = block;
 
-	block->heap = heap;
-	block->next = heap;
-	block->prev = heap;
-	block->next_free = heap;
-	block->prev_free = heap;
+	block->heap = &heap->head;
+	block->next = &heap->head;
+	block->prev = &heap->head;
 
 	block->ofs = ofs;
 	block->size = size;
 	block->free = 1;
+	free_list_insert(heap, block);
 
-	return heap;
+	return &heap->head;
 }
 
 static struct mem_block *SliceBlock(struct mem_block *p,
 				    int startofs, int size,
 				    int reserved, int alignment)
 {
-	struct mem_block *newblock;
+	struct mem_heap *heap = to_heap(p->heap);
+	struct mem_block *left = NULL, *right = NULL;
 
-	/* break left  [p, newblock, p->next], then p = newblock */
+	/* Allocate both halves up front, so that failing leaves p alone. */
 	if (startofs > p->ofs) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		left = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+		if (!left)
 			return NULL;
-		newblock->ofs = startofs;
-		newblock->size = p->size - (startofs - p->ofs);
-		newblock->free = 1;
-		newblock->heap = p->heap;
-
-		newblock->next = p->next;
-		newblock->prev = p;
-		p->next->prev = newblock;
-		p->next = newblock;
-
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
-		p->size -= newblock->size;
-		p = newblock;
 	}
-
-	/* break right, also [p, newblock, p->next] */
-	if (size < p->size) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+	if (startofs + size < p->ofs + p->size) {
+		right = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+		if (!right) {
+			free(left);
 			return NULL;
-		newblock->ofs = startofs + size;
-		newblock->size = p->size - size;
-		newblock->free = 1;
-		newblock->heap = p->heap;
+		}
+	}
 
-		newblock->next = p->next;
-		newblock->prev = p;
-		p->next->prev = newblock;
-		p->next = newblock;
+	free_list_remove(heap, p);
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
+	/* break left  [p, newblock, p->next], then p = newblock */
+	if (left) {
+		left->ofs = startofs;
+		left->size = p->size - (startofs - p->ofs);
+		left->free = 1;
+		left->heap = p->heap;
+
+		left->next = p->next;
+		left->prev = p;
+		p->next->prev = left;
+		p->next = left;
+
+		p->size -= left->size;
+		free_list_insert(heap, p);
+		p = left;
+	}
+
+	/* break right, also [p, newblock, p->next] */
+	if (right) {
+		right->ofs = startofs + size;
+		right->size = p->size - size;
+		right->free = 1;
+		right->heap = p->heap;
+
+		right->next = p->next;
+		right->prev = p;
+		p->next->prev = right;
+		p->next = right;
 
 		p->size = size;
+		free_list_insert(heap, right);
 	}
 
 	/* p = middle block */
 	p->free = 0;
-
-	/* Remove p from the free list: 
-	 */
-	p->next_free->prev_free = p->prev_free;
-	p->prev_free->next_free = p->next_free;
-
-	p->next_free = 0;
-	p->prev_free = 0;
-
 	p->reserved = reserved;
 	return p;
 }
@@ -171,8 +340,21 @@ drm_private struct mem_block *mmAllocMem(struct mem_block *heap, int size,
 	if (!heap || align2 < 0 || size <= 0)
 		return NULL;
 
-	for (p = heap->next_free; p != heap; p = p->next_free) {
-		assert(p->free);
+	if (startSearch <= 0) {
+		p = find_free_block(to_heap(heap), size, mask);
+		if (p) {
+			startofs = (p->ofs + mask) & ~mask;
+			return SliceBlock(p, startofs, size, 0, mask + 1);
+		}
+	}
+
+	/* Otherwise, when a start offset was given or the free lists have no
+	 * block that is sure to fit, take the first free block in address
+	 * order that fits.
+	 */
+	for (p = heap->next; p != heap; p = p->next) {
+		if (!p->free)
+			continue;
 
 		startofs = (p->ofs + mask) & ~mask;
 		if (startofs < startSearch) {
@@ -192,32 +374,28 @@ drm_private struct mem_block *mmAllocMem(struct mem_block *heap, int size,
 	return p;
 }
 
-static int Join2Blocks(struct mem_block *p)
+/**
+ * Merges p->next into p.  Both must be free, and out of the free lists.
+ */
+static void Join2Blocks(struct mem_block *p)
 {
-	/* XXX there should be some assertions here */
-
-	/* NOTE: heap->free == 0 */
+	struct mem_block *q = p->next;
 
-	if (p->free && p->next->free) {
-		struct mem_block *q = p->next;
+	assert(p->free && q->free);
+	assert(p->ofs + p->size == q->ofs);
 
-		assert(p->ofs + p->size == q->ofs);
-		p->size += q->size;
+	p->size += q->size;
 
-		p->next = q->next;
-		q->next->prev = p;
+	p->next = q->next;
+	q->next->prev = p;
 
-		q->next_free->prev_free = q->prev_free;
-		q->prev_free->next_free = q->next_free;
-
-		free(q);
-		return 1;
-	}
-	return 0;
+	free(q);
 }
 
 drm_private int mmFreeMem(struct mem_block *b)
 {
+	struct mem_heap *heap;
+
 	if (!b)
 		return 0;
 
@@ -230,15 +408,21 @@ drm_private int mmFreeMem(struct mem_block *b)
 		return -1;
 	}
 
+	heap = to_heap(b->heap);
 	b->free = 1;
-	b->next_free = b->heap->next_free;
-	b->prev_free = b->heap;
-	b->next_free->prev_free = b;
-	b->prev_free->next_free = b;
 
-	Join2Blocks(b);
-	if (b->prev != b->heap)
-		Join2Blocks(b->prev);
+	/* NOTE: heap->free == 0, so the sentinel never gets merged. */
+	if (b->next->free) {
+		free_list_remove(heap, b->next);
+		Join2Blocks(b);
+	}
+	if (b->prev->free) {
+		b = b->prev;
+		free_list_remove(heap, b);
+		Join2Blocks(b);
+	}
+
+	free_list_insert(heap, b);
 
 	return 0;
 }
@@ -256,5 +440,5 @@ drm_private void mmDestroy(struct mem_block *heap)
 		p = next;
 	}
 
-	free(heap);
+	free(to_heap(heap));
 }
@@ -77,4 +77,11 @@ drm_private extern void mmDestroy(struct mem_block *mmInit);
  */
 drm_private extern void mmDumpMemInfo(const struct mem_block *mmInit);
 
+/**
+ * Checks that the blocks tile the heap and that the free lists hold exactly
+ * the free blocks, for testing.
+ * return: 0 if OK, -1 if the heap is inconsistent
+ */
+drm_private extern int mmCheckHeap(const struct mem_block *heap);
+
 #endif
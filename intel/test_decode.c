@@ -29,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <err.h>
+#include <time.h>
 
 #include "libdrm_macros.h"
 #include "intel_bufmgr.h"
@@ -42,6 +43,8 @@ usage(void)
 	fprintf(stderr, "usage:\n");
 	fprintf(stderr, "  test_decode <batch>\n");
 	fprintf(stderr, "  test_decode <batch> -dump\n");
+	fprintf(stderr, "  test_decode <batch> -packets\n");
+	fprintf(stderr, "  test_decode <batch> -bench [iterations]\n");
 	exit(1);
 }
 
@@ -83,7 +86,126 @@ dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 }
 
 static void
-compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
+print_packet(void *data, const struct drm_intel_decode_packet *packet)
+{
+	uint32_t i;
+
+	printf("0x%08x %u %s\n", packet->hw_offset, packet->length,
+	       packet->name ? packet->name : "?");
+	for (i = 0; i < packet->num_fields; i++) {
+		const struct drm_intel_decode_field *field = &packet->fields[i];
+
+		printf("  %u %s = %s\n", field->dword,
+		       field->name ? field->name : "?", field->value);
+	}
+}
+
+static void
+dump_packets(struct drm_intel_decode *ctx, const char *batch_filename)
+{
+	void *batch_ptr;
+	size_t batch_size;
+
+	read_file(batch_filename, &batch_ptr, &batch_size);
+
+	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+					   batch_size / 4);
+	drm_intel_decode_set_output_file(ctx, NULL);
+	drm_intel_decode_set_packet_callback(ctx, print_packet, NULL);
+
+	drm_intel_decode(ctx);
+}
+
+static void
+count_packet(void *data, const struct drm_intel_decode_packet *packet)
+{
+	(*(unsigned int *)data)++;
+}
+
+static double
+time_decode(struct drm_intel_decode *ctx, void *batch_ptr, size_t batch_size,
+	    int iterations)
+{
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+						   batch_size / 4);
+		drm_intel_decode(ctx);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+/*
+ * Decodes the batch over and over, as text into /dev/null, so that what
+ * gets timed is the decoder itself rather than the terminal, and then as
+ * packet records only.  Threaded decoding is timed on a batch made of 256
+ * copies of this one, as it only pays off for large batches.
+ */
+static void
+bench_batch(struct drm_intel_decode *ctx, const char *batch_filename,
+	    int iterations)
+{
+	void *batch_ptr;
+	size_t batch_size;
+	unsigned int packets = 0;
+	double elapsed;
+	char *large;
+	FILE *out;
+	int i;
+
+	read_file(batch_filename, &batch_ptr, &batch_size);
+
+	out = fopen("/dev/null", "w");
+	if (!out)
+		errx(1, "couldn't open /dev/null");
+	drm_intel_decode_set_output_file(ctx, out);
+
+	elapsed = time_decode(ctx, batch_ptr, batch_size, iterations);
+	printf("%s: %d x %zu DWORDs in %.3fs: %.2f MDWORDs/s\n",
+	       batch_filename, iterations, batch_size / 4, elapsed,
+	       iterations * (batch_size / 4) / elapsed / 1e6);
+
+	large = malloc(256 * batch_size);
+	if (!large)
+		errx(1, "out of memory");
+	for (i = 0; i < 256; i++)
+		memcpy(large + i * batch_size, batch_ptr, batch_size);
+	drm_intel_decode_set_dump_past_end(ctx, 1);
+	for (i = 1; i <= 4; i *= 4) {
+		drm_intel_decode_set_threads(ctx, i);
+		elapsed = time_decode(ctx, large, 256 * batch_size,
+				      iterations / 256 + 1);
+		printf("%s: %d x %zu DWORDs, %d threads in %.3fs: "
+		       "%.2f MDWORDs/s\n",
+		       batch_filename, iterations / 256 + 1,
+		       256 * batch_size / 4, i, elapsed,
+		       (iterations / 256 + 1) * (256 * batch_size / 4) /
+		       elapsed / 1e6);
+	}
+	drm_intel_decode_set_threads(ctx, 1);
+	drm_intel_decode_set_dump_past_end(ctx, 0);
+	free(large);
+
+	drm_intel_decode_set_output_file(ctx, NULL);
+	drm_intel_decode_set_packet_callback(ctx, count_packet, &packets);
+
+	elapsed = time_decode(ctx, batch_ptr, batch_size, iterations);
+	printf("%s: %d x %u packets in %.3fs: %.2f MDWORDs/s\n",
+	       batch_filename, iterations, packets / iterations, elapsed,
+	       iterations * (batch_size / 4) / elapsed / 1e6);
+
+	fclose(out);
+}
+
+static void
+compare_batch(struct drm_intel_decode *ctx, const char *batch_filename,
+	      int threads)
 {
 	FILE *out = NULL;
 	void *ptr, *ref_ptr, *batch_ptr;
@@ -115,12 +237,13 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
 					   batch_size / 4);
 	drm_intel_decode_set_output_file(ctx, out);
+	drm_intel_decode_set_threads(ctx, threads);
 
 	drm_intel_decode(ctx);
 
 	if (strcmp(ref_ptr, ptr) != 0) {
-		fprintf(stderr, "Decode mismatch with reference `%s'.\n",
-			ref_filename);
+		fprintf(stderr, "Decode mismatch with reference `%s'%s.\n",
+			ref_filename, threads > 1 ? " when threaded" : "");
 		fprintf(stderr, "You can dump the new output using:\n");
 		fprintf(stderr, "  test_decode \"%s\" -dump\n", batch_filename);
 		exit(1);
@@ -131,6 +254,85 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	free(ptr);
 }
 
+#if HAVE_OPEN_MEMSTREAM
+struct check_fields {
+	FILE *out;
+	char **text;
+	size_t *size;
+	size_t packet_start;
+	unsigned int num_fields;
+};
+
+static void
+check_packet_fields(void *data, const struct drm_intel_decode_packet *packet)
+{
+	struct check_fields *check = data;
+	char *text = *check->text + check->packet_start;
+	uint32_t i;
+
+	(*check->text)[*check->size] = '\0';
+	for (i = 0; i < packet->num_fields; i++) {
+		const struct drm_intel_decode_field *field = &packet->fields[i];
+		char prefix[16], *line, *end;
+
+		snprintf(prefix, sizeof(prefix), "0x%08x:",
+			 packet->hw_offset + 4 * field->dword);
+		line = strstr(text, prefix);
+		if (!line || field->dword >= packet->length)
+			errx(1, "field %u of the packet at 0x%08x isn't in it",
+			     i, packet->hw_offset);
+		end = strchr(line, '\n');
+		if (end)
+			*end = '\0';
+		if (!strstr(line, field->value) ||
+		    (field->name && !strstr(line, field->name)))
+			errx(1, "field %s = %s isn't in \"%s\"",
+			     field->name ? field->name : "?", field->value,
+			     line);
+		if (end)
+			*end = '\n';
+	}
+	check->num_fields += packet->num_fields;
+	check->packet_start = *check->size;
+}
+
+/*
+ * Checks that the fields handed to the packet callback are the ones the
+ * text of their DWORDs is made of.
+ */
+static void
+check_fields(struct drm_intel_decode *ctx, const char *batch_filename)
+{
+	struct check_fields check;
+	void *batch_ptr;
+	size_t batch_size, size = 0;
+	char *text = NULL;
+
+	read_file(batch_filename, &batch_ptr, &batch_size);
+
+	memset(&check, 0, sizeof(check));
+	check.out = open_memstream(&text, &size);
+	if (!check.out)
+		errx(1, "couldn't open a memory stream");
+	check.text = &text;
+	check.size = &size;
+
+	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+					   batch_size / 4);
+	drm_intel_decode_set_output_file(ctx, check.out);
+	drm_intel_decode_set_threads(ctx, 1);
+	drm_intel_decode_set_packet_callback(ctx, check_packet_fields, &check);
+
+	drm_intel_decode(ctx);
+
+	drm_intel_decode_set_packet_callback(ctx, NULL, NULL);
+	fclose(check.out);
+	free(text);
+	if (!check.num_fields)
+		errx(1, "no fields decoded from `%s'", batch_filename);
+}
+#endif
+
 static uint16_t
 infer_devid(const char *batch_filename)
 {
@@ -179,13 +381,22 @@ main(int argc, char **argv)
 
 	ctx = drm_intel_decode_context_alloc(devid);
 
-	if (argc == 3) {
+	if (argc >= 3 && strcmp(argv[2], "-bench") == 0) {
+		bench_batch(ctx, argv[1], argc > 3 ? atoi(argv[3]) : 1000);
+	} else if (argc == 3) {
 		if (strcmp(argv[2], "-dump") == 0)
 			dump_batch(ctx, argv[1]);
+		else if (strcmp(argv[2], "-packets") == 0)
+			dump_packets(ctx, argv[1]);
 		else
 			usage();
 	} else {
-		compare_batch(ctx, argv[1]);
+		/* Threaded decoding has to give the same output. */
+		compare_batch(ctx, argv[1], 1);
+		compare_batch(ctx, argv[1], 4);
+#if HAVE_OPEN_MEMSTREAM
+		check_fields(ctx, argv[1]);
+#endif
 	}
 
 	drm_intel_decode_context_free(ctx);
@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2007 Red Hat Inc.
+ * Copyright © 2007-2012 Intel Corporation
+ * Copyright 2006 Tungsten Graphics, Inc., Bismarck, ND., USA
+ * Copyright (C) 2016 Rob Clark <robclark@freedesktop.org>
+ * Copyright (C) 2016 Etnaviv Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmarks the BO cache shared by the intel, freedreno and etnaviv buffer
+ * managers against a fake allocator, so that they measure the cache and not
+ * the kernel.
+ *
+ * Fake BOs are plain malloc()ed structs.  A BO stays busy for a while after
+ * it is freed, as if the GPU was still using it, and the fake kernel
+ * reclaims the pages of one purgeable BO in a thousand.  Time moves on by a
+ * second every 10000 operations, so that old BOs get cleaned up.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "util_bo_cache.h"
+
+#define WORKING_SET	16
+#define BUSY_OPS	64
+#define OPS_PER_SECOND	10000
+
+struct fake_bo {
+	struct util_bo_cache_entry entry;
+	unsigned long size;
+	uint64_t busy_until;
+	bool purgeable;
+	bool purged;
+};
+
+static uint64_t now;
+static unsigned int seed = 1;
+static long fake_live, fake_allocs;
+
+static struct fake_bo *
+to_fake_bo(struct util_bo_cache_entry *entry)
+{
+	return (struct fake_bo *)((char *)entry - offsetof(struct fake_bo, entry));
+}
+
+static bool
+fake_is_idle(struct util_bo_cache_entry *entry)
+{
+	return to_fake_bo(entry)->busy_until <= now;
+}
+
+static bool
+fake_madvise(struct util_bo_cache_entry *entry, bool willneed)
+{
+	struct fake_bo *bo = to_fake_bo(entry);
+
+	if (bo->purgeable && rand_r(&seed) % 1000 == 0)
+		bo->purged = true;
+	bo->purgeable = !willneed;
+
+	return !bo->purged;
+}
+
+static void
+fake_evict(struct util_bo_cache_entry *entry)
+{
+	free(to_fake_bo(entry));
+	fake_live--;
+}
+
+static const struct util_bo_cache_funcs fake_funcs = {
+	.is_idle = fake_is_idle,
+	.madvise = fake_madvise,
+	.evict = fake_evict,
+};
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static struct fake_bo *
+fake_bo_alloc(struct util_bo_cache *cache, unsigned long size, bool mru)
+{
+	struct util_bo_cache_entry *entry;
+	unsigned long bucket_size;
+	struct fake_bo *bo;
+
+	bucket_size = util_bo_cache_bucket_size(cache, size);
+	if (bucket_size)
+		size = bucket_size;
+
+	entry = util_bo_cache_get(cache, size, 0, mru);
+	if (entry)
+		return to_fake_bo(entry);
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		errx(1, "out of memory");
+	bo->size = size;
+	fake_live++;
+	fake_allocs++;
+
+	return bo;
+}
+
+static void
+fake_bo_free(struct util_bo_cache *cache, struct fake_bo *bo)
+{
+	bo->busy_until = now + BUSY_OPS;
+	if (!util_bo_cache_put(cache, &bo->entry, bo->size, 0,
+			       now / OPS_PER_SECOND + 1))
+		fake_evict(&bo->entry);
+}
+
+/*
+ * Allocates a working set of BOs, from 4k to 512k but mostly small ones,
+ * frees it, and starts over.
+ */
+static void
+run(const char *name, bool coarse, bool mru, uint64_t max_bytes, int rounds)
+{
+	struct util_bo_cache cache;
+	struct fake_bo *bos[WORKING_SET];
+	uint64_t max_cached = 0;
+	double elapsed;
+	int i, j;
+
+	util_bo_cache_init(&cache, coarse, &fake_funcs);
+	util_bo_cache_set_max_bytes(&cache, max_bytes);
+	fake_allocs = 0;
+	now = 0;
+
+	elapsed = get_time();
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < WORKING_SET; j++) {
+			int order = rand_r(&seed) % 11;
+			unsigned long size;
+
+			if (order > 6)
+				order = rand_r(&seed) % 3;
+			size = 4096UL << order;
+			size += rand_r(&seed) % size;
+			bos[j] = fake_bo_alloc(&cache, size, mru);
+			now++;
+		}
+		for (j = 0; j < WORKING_SET; j++) {
+			fake_bo_free(&cache, bos[j]);
+			now++;
+		}
+
+		if (cache.stats.bytes_cached > max_cached)
+			max_cached = cache.stats.bytes_cached;
+		util_bo_cache_cleanup(&cache, now / OPS_PER_SECOND + 1);
+	}
+	elapsed = get_time() - elapsed;
+
+	printf("%s: %d alloc/free pairs in %.3fs: %.2f Mops/s\n",
+	       name, rounds * WORKING_SET, elapsed,
+	       rounds * WORKING_SET / elapsed / 1e6);
+	printf("%s: %" PRIu64 " hits, %" PRIu64 " misses, %ld new BOs, "
+	       "%" PRIu64 " purged, %" PRIu64 " evicted, %.1fMB cached at most\n",
+	       name, cache.stats.hits, cache.stats.misses, fake_allocs,
+	       cache.stats.purged, cache.stats.evicted, max_cached / 1048576.0);
+
+	util_bo_cache_fini(&cache);
+	if (fake_live != 0 || cache.stats.bytes_cached != 0)
+		errx(1, "%s: %ld BOs leaked", name, fake_live);
+}
+
+int
+main(int argc, char **argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+
+	/* intel and etnaviv style, then intel render targets */
+	run("fine", false, false, UINT64_MAX, rounds);
+	run("fine-mru", false, true, UINT64_MAX, rounds);
+	/* freedreno's ring BO cache */
+	run("coarse", true, false, UINT64_MAX, rounds);
+	/* with a byte budget, as set with drm_intel_bufmgr_gem_set_bo_cache_size() */
+	run("budget", false, false, 16 << 20, rounds);
+
+	return 0;
+}
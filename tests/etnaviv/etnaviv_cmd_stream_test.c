@@ -24,12 +24,175 @@
  *    Christian Gmeiner <christian.gmeiner@gmail.com>
  */
 
+/*
+ * Without arguments, runs the unit tests.  "bench [threads] [submits]
+ * [relocs]" has each thread build and flush its own command streams, with
+ * relocs to random bo's out of a set shared by all threads.  "bench-async
+ * [submits] [relocs] [us]" builds a single stream with synchronous, then
+ * asynchronous submits, each submit ioctl taking that many microseconds.
+ *
+ * The reloc tests and the benchmark run against a mock etnaviv ioctl
+ * backend, which replaces ioctl() for the whole process and checks every
+ * submit.  It has to be exported for libdrm.so to bind to it, hence
+ * drm_public.  The mock device is a temporary file, so that bo's can be
+ * mapped, and it has a single perfmon domain whose signal N goes up by N + 1
+ * in every submit.
+ */
+
 #undef NDEBUG
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
+#include "libdrm_macros.h"
+#include "xf86atomic.h"
+#include "xf86drm.h"
+#include "util_submit_capture.h"
 #include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+
+#define MOCK_SIZE	(64 << 20)
+#define NUM_BOS		1024
+
+static int mock_fd = -1;
+static uint32_t *mock_map;
+
+static atomic_t mock_handle = { 0 };
+static atomic_t mock_relocs = { 0 };
+static atomic_t mock_fence = { 0 };
+static int mock_submit_us;
+
+/* every reloc is preceded by the handle of its bo in the stream */
+static void mock_check_submit(const struct drm_etnaviv_gem_submit *req)
+{
+	const struct drm_etnaviv_gem_submit_bo *bos = (void *)(uintptr_t)req->bos;
+	const struct drm_etnaviv_gem_submit_reloc *relocs =
+		(void *)(uintptr_t)req->relocs;
+	const uint32_t *stream = (void *)(uintptr_t)req->stream;
+	uint8_t *seen = calloc(atomic_read(&mock_handle) + 1, 1);
+
+	assert(seen);
+	for (uint32_t i = 0; i < req->nr_bos; i++) {
+		assert(bos[i].handle <= (uint32_t)atomic_read(&mock_handle));
+		assert(!seen[bos[i].handle]);
+		seen[bos[i].handle] = 1;
+	}
+	free(seen);
+
+	for (uint32_t i = 0; i < req->nr_relocs; i++) {
+		uint32_t offset = relocs[i].submit_offset / 4;
+
+		assert(relocs[i].reloc_idx < req->nr_bos);
+		assert(offset > 0 && offset * 4 < req->stream_size);
+		assert(stream[offset - 1] == bos[relocs[i].reloc_idx].handle);
+	}
+
+	atomic_add(&mock_relocs, req->nr_relocs);
+}
+
+static void mock_sample(const struct drm_etnaviv_gem_submit *req, uint32_t fence)
+{
+	const struct drm_etnaviv_gem_submit_bo *bos = (void *)(uintptr_t)req->bos;
+	const struct drm_etnaviv_gem_submit_pmr *pmrs = (void *)(uintptr_t)req->pmrs;
+
+	for (uint32_t i = 0; i < req->nr_pmrs; i++) {
+		uint32_t *map = mock_map + bos[pmrs[i].read_idx].handle * 1024;
+
+		assert(pmrs[i].read_idx < req->nr_bos);
+		assert(pmrs[i].read_offset >= 4 && pmrs[i].read_offset < 4096);
+		map[pmrs[i].read_offset / 4] = fence * 1000;
+		if (pmrs[i].flags == ETNA_PM_PROCESS_POST)
+			map[pmrs[i].read_offset / 4] += pmrs[i].signal + 1;
+	}
+
+	/* like the kernel, once all POST samples are written */
+	for (uint32_t i = 0; i < req->nr_pmrs; i++)
+		mock_map[bos[pmrs[i].read_idx].handle * 1024] = pmrs[i].sequence;
+}
+
+drm_public int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd != mock_fd) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	switch (request) {
+	case DRM_IOCTL_ETNAVIV_GET_PARAM: {
+		struct drm_etnaviv_param *param = arg;
+
+		param->value = param->param == ETNAVIV_PARAM_GPU_MODEL ? 0x2000 : 0;
+		return 0;
+	}
+	case DRM_IOCTL_ETNAVIV_GEM_NEW: {
+		struct drm_etnaviv_gem_new *req = arg;
+
+		req->handle = atomic_inc_return(&mock_handle);
+		return 0;
+	}
+	case DRM_IOCTL_ETNAVIV_GEM_INFO: {
+		struct drm_etnaviv_gem_info *req = arg;
+
+		req->offset = (uint64_t)req->handle * 4096;
+		assert(req->offset < MOCK_SIZE);
+		return 0;
+	}
+	case DRM_IOCTL_ETNAVIV_PM_QUERY_DOM: {
+		struct drm_etnaviv_pm_domain *req = arg;
+
+		req->id = 0;
+		req->nr_signals = 2;
+		strcpy(req->name, "HI");
+		req->iter = 0xff;
+		return 0;
+	}
+	case DRM_IOCTL_ETNAVIV_PM_QUERY_SIG: {
+		struct drm_etnaviv_pm_signal *req = arg;
+
+		req->id = req->iter;
+		strcpy(req->name, req->iter ? "IDLE_CYCLES" : "TOTAL_CYCLES");
+		req->iter = req->iter ? 0xffff : 1;
+		return 0;
+	}
+	case DRM_IOCTL_ETNAVIV_GEM_SUBMIT: {
+		struct drm_etnaviv_gem_submit *req = arg;
+
+		mock_check_submit(req);
+		if (mock_submit_us) {
+			struct timespec ts = { 0, mock_submit_us * 1000 };
+
+			nanosleep(&ts, NULL);
+		}
+		req->fence = atomic_inc_return(&mock_fence);
+		mock_sample(req, req->fence);
+		return 0;
+	}
+	case DRM_IOCTL_ETNAVIV_GEM_CPU_PREP:
+	case DRM_IOCTL_ETNAVIV_GEM_CPU_FINI:
+	case DRM_IOCTL_ETNAVIV_WAIT_FENCE:
+	case DRM_IOCTL_GEM_CLOSE:
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
 
 static void test_avail()
 {
@@ -113,11 +276,377 @@ static void test_offset()
 	printf("ok\n");
 }
 
+struct reloc_thread {
+	pthread_t thread;
+	struct etna_pipe *pipe;
+	struct etna_bo **bos;
+	int submits, relocs;
+	int async;
+	unsigned int seed;
+	uint32_t timestamp;
+};
+
+static void *reloc_thread(void *arg)
+{
+	struct reloc_thread *t = arg;
+	struct etna_cmd_stream *stream;
+
+	stream = etna_cmd_stream_new(t->pipe, 0x10000, NULL, NULL);
+	if (!stream)
+		errx(1, "failed to create a command stream");
+	if (t->async && etna_cmd_stream_enable_async(stream))
+		errx(1, "failed to enable async submits");
+
+	for (int i = 0; i < t->submits; i++) {
+		for (int j = 0; j < t->relocs; j++) {
+			struct etna_reloc r = {
+				.bo = t->bos[rand_r(&t->seed) % NUM_BOS],
+				.flags = ETNA_RELOC_READ,
+			};
+
+			etna_cmd_stream_reserve(stream, 2);
+			etna_cmd_stream_emit(stream, etna_bo_handle(r.bo));
+			etna_cmd_stream_reloc(stream, &r);
+		}
+		etna_cmd_stream_flush(stream);
+	}
+
+	t->timestamp = etna_cmd_stream_timestamp(stream);
+	etna_cmd_stream_del(stream);
+
+	return NULL;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* returns the number of relocs per second */
+static double run_relocs(int num_threads, int submits, int relocs, int async)
+{
+	struct etna_device *dev;
+	struct etna_gpu *gpu;
+	struct etna_pipe *pipe;
+	struct etna_bo *bos[NUM_BOS];
+	struct reloc_thread *threads;
+	double elapsed;
+	int i;
+
+	dev = etna_device_new(mock_fd);
+	gpu = dev ? etna_gpu_new(dev, 0) : NULL;
+	pipe = gpu ? etna_pipe_new(gpu, ETNA_PIPE_3D) : NULL;
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!pipe || !threads)
+		errx(1, "failed to set up the mock device");
+
+	for (i = 0; i < NUM_BOS; i++) {
+		bos[i] = etna_bo_new(dev, 4096, ETNA_BO_WC);
+		if (!bos[i])
+			errx(1, "failed to allocate a bo");
+	}
+
+	atomic_set(&mock_relocs, 0);
+	atomic_set(&mock_fence, 0);
+	elapsed = get_time();
+	for (i = 0; i < num_threads; i++) {
+		threads[i].pipe = pipe;
+		threads[i].bos = bos;
+		threads[i].submits = submits;
+		threads[i].relocs = relocs;
+		threads[i].async = async;
+		threads[i].seed = i + 1;
+		if (pthread_create(&threads[i].thread, NULL, reloc_thread,
+				   &threads[i]))
+			errx(1, "failed to create a thread");
+	}
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	elapsed = get_time() - elapsed;
+
+	assert(atomic_read(&mock_relocs) == num_threads * submits * relocs);
+	assert(atomic_read(&mock_fence) == num_threads * submits);
+	if (num_threads == 1)
+		assert(threads[0].timestamp == (uint32_t)submits);
+
+	for (i = 0; i < NUM_BOS; i++)
+		etna_bo_del(bos[i]);
+	free(threads);
+	etna_pipe_del(pipe);
+	etna_gpu_del(gpu);
+	etna_device_del(dev);
+
+	return num_threads * submits * relocs / elapsed;
+}
+
+static void test_reloc(void)
+{
+	printf("testing etna_cmd_stream_reloc ... ");
+
+	/* one stream, then several streams sharing the bo's */
+	run_relocs(1, 4, 5000, 0);
+	run_relocs(4, 4, 5000, 0);
+
+	printf("ok\n");
+}
+
+static void test_async(void)
+{
+	printf("testing etna_cmd_stream_enable_async ... ");
+
+	run_relocs(1, 8, 5000, 1);
+	run_relocs(4, 8, 5000, 1);
+
+	printf("ok\n");
+}
+
+static void test_perfmon_session(void)
+{
+	struct etna_device *dev;
+	struct etna_gpu *gpu;
+	struct etna_pipe *pipe;
+	struct etna_perfmon *pm;
+	struct etna_perfmon_signal *signals[2];
+	struct etna_perfmon_session *session;
+	struct etna_cmd_stream *stream;
+	uint32_t deltas[8 * 2];
+
+	printf("testing etna_perfmon_session ... ");
+
+	dev = etna_device_new(mock_fd);
+	gpu = etna_gpu_new(dev, 0);
+	pipe = etna_pipe_new(gpu, ETNA_PIPE_3D);
+	pm = etna_perfmon_create(pipe);
+	assert(pm);
+	signals[0] = etna_perfmon_get_sig_by_name(
+		etna_perfmon_get_dom_by_name(pm, "HI"), "IDLE_CYCLES");
+	signals[1] = etna_perfmon_get_sig_by_name(
+		etna_perfmon_get_dom_by_name(pm, "HI"), "TOTAL_CYCLES");
+	assert(signals[0] && signals[1]);
+
+	session = etna_perfmon_session_new(pm, signals, 2, 4);
+	assert(session);
+	stream = etna_cmd_stream_new(pipe, 0x1000, NULL, NULL);
+	assert(stream);
+
+	for (int async = 0; async < 2; async++) {
+		if (async)
+			assert(etna_cmd_stream_enable_async(stream) == 0);
+		etna_cmd_stream_set_perfmon_session(stream, session);
+
+		/* nothing to read before the first submit */
+		assert(etna_perfmon_session_read(session, deltas, 8) == 0);
+
+		for (int i = 0; i < 3; i++)
+			etna_cmd_stream_flush(stream);
+		etna_cmd_stream_timestamp(stream);
+		assert(etna_perfmon_session_read(session, deltas, 2) == 2);
+		assert(etna_perfmon_session_read(session, deltas + 4, 8) == 1);
+		for (int i = 0; i < 3; i++)
+			assert(deltas[2 * i] == 2 && deltas[2 * i + 1] == 1);
+		assert(etna_perfmon_session_lost(session) == 3u * async);
+
+		/* 2 more than the ring holds */
+		for (int i = 0; i < 6; i++)
+			etna_cmd_stream_flush(stream);
+		etna_cmd_stream_finish(stream);
+		assert(etna_perfmon_session_read(session, deltas, 8) == 4);
+		assert(etna_perfmon_session_lost(session) == 3u * (1 + async));
+
+		etna_cmd_stream_set_perfmon_session(stream, NULL);
+		etna_cmd_stream_flush(stream);
+		etna_cmd_stream_timestamp(stream);
+		assert(etna_perfmon_session_read(session, deltas, 8) == 0);
+	}
+
+	etna_cmd_stream_del(stream);
+	etna_perfmon_session_del(session);
+	etna_perfmon_del(pm);
+	etna_pipe_del(pipe);
+	etna_gpu_del(gpu);
+	etna_device_del(dev);
+
+	printf("ok\n");
+}
+
+static void capture_emit(struct etna_cmd_stream *stream, struct etna_bo **bos)
+{
+	for (int i = 0; i < 2; i++) {
+		struct etna_reloc r = { .bo = bos[i], .flags = ETNA_RELOC_READ };
+
+		etna_cmd_stream_reserve(stream, 2);
+		etna_cmd_stream_emit(stream, etna_bo_handle(r.bo));
+		etna_cmd_stream_reloc(stream, &r);
+	}
+}
+
+static void test_capture(void)
+{
+	char prefix[] = "/tmp/etnaviv_capture_test.XXXXXX";
+	struct util_capture_file_header *header;
+	struct etna_device *dev;
+	struct etna_gpu *gpu;
+	struct etna_pipe *pipe;
+	struct etna_bo *bos[2];
+	struct etna_cmd_stream *stream;
+	uint8_t *map, *data, *p, *end;
+	unsigned bo_blobs = 0, stream_blobs = 0, submits = 0;
+	uint32_t handle;
+	char path[64];
+	FILE *file;
+	long size;
+	int fd;
+
+	printf("testing submit capture ... ");
+
+	fd = mkstemp(prefix);
+	assert(fd >= 0);
+	close(fd);
+	unlink(prefix);
+
+	setenv("ETNA_CAPTURE", prefix, 1);
+	dev = etna_device_new(mock_fd);
+	unsetenv("ETNA_CAPTURE");
+	gpu = etna_gpu_new(dev, 0);
+	pipe = etna_pipe_new(gpu, ETNA_PIPE_3D);
+	stream = etna_cmd_stream_new(pipe, 0x1000, NULL, NULL);
+	assert(stream);
+
+	/* the contents of the mapped bo and the stream are the same for the
+	 * first 3 submits, then the bo changes and the last one is async:
+	 */
+	bos[0] = etna_bo_new(dev, 4096, ETNA_BO_WC);
+	bos[1] = etna_bo_new(dev, 4096, ETNA_BO_WC);
+	handle = etna_bo_handle(bos[0]);
+	map = etna_bo_map(bos[0]);
+	assert(map);
+	memset(map, 0x11, 4096);
+	for (int i = 0; i < 3; i++) {
+		capture_emit(stream, bos);
+		etna_cmd_stream_flush(stream);
+	}
+	/* mapping it again tells capture the contents may change: */
+	assert(etna_bo_map(bos[0]) == map);
+	memset(map, 0x22, 4096);
+	assert(etna_cmd_stream_enable_async(stream) == 0);
+	capture_emit(stream, bos);
+	etna_cmd_stream_flush(stream);
+
+	etna_cmd_stream_del(stream);
+	etna_bo_del(bos[0]);
+	etna_bo_del(bos[1]);
+	etna_pipe_del(pipe);
+	etna_gpu_del(gpu);
+	etna_device_del(dev);
+
+	snprintf(path, sizeof(path), "%s.%d.1", prefix, (int)getpid());
+	file = fopen(path, "rb");
+	assert(file);
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+	data = malloc(size);
+	assert(data && fread(data, 1, size, file) == (size_t)size);
+	fclose(file);
+	unlink(path);
+
+	header = (struct util_capture_file_header *)data;
+	assert(memcmp(header->magic, UTIL_CAPTURE_MAGIC, 8) == 0);
+	assert(header->version == UTIL_CAPTURE_VERSION);
+	assert(header->driver_len == strlen("etnaviv"));
+
+	end = data + size;
+	p = data + sizeof(*header) + 8;
+	while (p < end) {
+		struct util_capture_record *record = (void *)p;
+		uint8_t *payload = p + sizeof(*record);
+
+		if (record->type == UTIL_CAPTURE_BLOB) {
+			uint8_t byte = payload[sizeof(struct util_capture_file_blob)];
+
+			/* bo[0] twice, and the stream of 4 words once */
+			if (record->size == 8 + 4096) {
+				assert(byte == (bo_blobs ? 0x22 : 0x11));
+				bo_blobs++;
+			} else {
+				assert(record->size == 8 + 16);
+				stream_blobs++;
+			}
+		} else {
+			struct util_capture_file_submit *s = (void *)payload;
+			struct util_capture_file_bo *b = (void *)(s + 1);
+			struct util_capture_file_cmd *c = (void *)(b + 2);
+			struct util_capture_reloc *r = (void *)(c + 1);
+
+			assert(record->type == UTIL_CAPTURE_SUBMIT);
+			assert(s->seqno == submits && s->nr_bos == 2 &&
+			       s->nr_cmds == 1 && s->nr_relocs == 2);
+			assert(b[0].handle == handle);
+			/* blobs are numbered in order: bo[0], stream, new bo[0] */
+			assert(b[0].blob == (submits < 3 ? 1 : 3) && !b[1].blob);
+			assert(c->bo_idx == UTIL_CAPTURE_NO_BO && c->blob == 2);
+			assert(r[0].reloc_idx == 0 && r[1].reloc_idx == 1);
+			submits++;
+		}
+		p = payload + ((record->size + 7) & ~7u);
+	}
+	assert(p == end);
+	assert(submits == 4 && bo_blobs == 2 && stream_blobs == 1);
+	free(data);
+
+	printf("ok\n");
+}
+
 int main(int argc, char *argv[])
 {
+	FILE *file = tmpfile();
+
+	if (!file || ftruncate(fileno(file), MOCK_SIZE))
+		err(1, "failed to create the mock device");
+	mock_fd = fileno(file);
+	mock_map = mmap(NULL, MOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			mock_fd, 0);
+	if (mock_map == MAP_FAILED)
+		err(1, "failed to map the mock device");
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		int threads = argc > 2 ? atoi(argv[2]) : 4;
+		int submits = argc > 3 ? atoi(argv[3]) : 200;
+		int relocs = argc > 4 ? atoi(argv[4]) : 4096;
+		double rate = run_relocs(threads, submits, relocs, 0);
+
+		printf("cmd-stream-reloc: %d threads, %d submits of %d relocs "
+		       "over %d bo's: %.2f Mrelocs/s\n",
+		       threads, submits, relocs, NUM_BOS, rate / 1e6);
+		return 0;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "bench-async") == 0) {
+		int submits = argc > 2 ? atoi(argv[2]) : 1000;
+		int relocs = argc > 3 ? atoi(argv[3]) : 4096;
+
+		mock_submit_us = argc > 4 ? atoi(argv[4]) : 100;
+		for (int async = 0; async < 2; async++) {
+			double rate = run_relocs(1, submits, relocs, async);
+
+			printf("cmd-stream-%s: %d submits of %d relocs, %dus "
+			       "per submit: %.2f Mrelocs/s\n",
+			       async ? "async" : "sync", submits, relocs,
+			       mock_submit_us, rate / 1e6);
+		}
+		return 0;
+	}
+
 	test_avail();
 	test_emit();
 	test_offset();
+	test_reloc();
+	test_async();
+	test_perfmon_session();
+	test_capture();
 
 	return 0;
 }
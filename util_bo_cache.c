@@ -0,0 +1,326 @@
+/*
+ * Copyright © 2007 Red Hat Inc.
+ * Copyright © 2007-2012 Intel Corporation
+ * Copyright 2006 Tungsten Graphics, Inc., Bismarck, ND., USA
+ * Copyright (C) 2016 Rob Clark <robclark@freedesktop.org>
+ * Copyright (C) 2016 Etnaviv Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "util_bo_cache.h"
+
+static inline unsigned
+util_bo_cache_log2(unsigned long n)
+{
+#if defined(__GNUC__)
+	return sizeof(n) * 8 - 1 - __builtin_clzl(n);
+#else
+	unsigned i = 0;
+
+	while (n >>= 1)
+		i++;
+	return i;
+#endif
+}
+
+static unsigned long
+bucket_size(const struct util_bo_cache *cache, unsigned i)
+{
+	unsigned long pot;
+
+	if (cache->coarse)
+		return 4096UL << i;
+	if (i < 3)
+		return (i + 1) * 4096UL;
+
+	i -= 3;
+	pot = 16384UL << (i / 4);
+	return pot + pot * (i % 4) / 4;
+}
+
+/* Index of the smallest bucket holding @size, without looping over them */
+static unsigned
+bucket_index(const struct util_bo_cache *cache, unsigned long size)
+{
+	unsigned long pot;
+	unsigned order;
+
+	if (size <= 4096)
+		return 0;
+	if (cache->coarse)
+		return util_bo_cache_log2(size - 1) + 1 - 12;
+	if (size <= 3 * 4096)
+		return (size - 1) / 4096;
+
+	/* pot < size <= 2 * pot */
+	order = util_bo_cache_log2(size - 1);
+	pot = 1UL << order;
+	if (order < 14)
+		return 3;
+	return 3 + 4 * (order - 14) + (4 * (size - pot) + pot - 1) / pot;
+}
+
+drm_private void
+util_bo_cache_init(struct util_bo_cache *cache, bool coarse,
+		const struct util_bo_cache_funcs *funcs)
+{
+	unsigned i;
+
+	cache->funcs = funcs;
+	cache->coarse = coarse;
+	/* up to 64MB, or 112MB for the last fine-grained bucket */
+	cache->num_buckets = coarse ? 2 + 13 : UTIL_BO_CACHE_MAX_BUCKETS;
+	for (i = 0; i < cache->num_buckets; i++)
+		list_inithead(&cache->buckets[i]);
+	list_inithead(&cache->lru);
+	cache->max_bytes = UINT64_MAX;
+	cache->time = 0;
+	memset(&cache->stats, 0, sizeof(cache->stats));
+}
+
+/* Frees every cached BO */
+drm_private void
+util_bo_cache_fini(struct util_bo_cache *cache)
+{
+	while (!LIST_IS_EMPTY(&cache->lru)) {
+		struct util_bo_cache_entry *entry =
+			LIST_FIRST_ENTRY(&cache->lru, struct util_bo_cache_entry,
+					 lru_link);
+
+		util_bo_cache_remove(entry);
+		cache->funcs->evict(entry);
+	}
+}
+
+/**
+ * Returns the size of the bucket @size falls in, which is what allocations
+ * should be rounded up to, or 0 if it is too large to be cached.
+ */
+drm_private unsigned long
+util_bo_cache_bucket_size(struct util_bo_cache *cache, unsigned long size)
+{
+	unsigned i = bucket_index(cache, size);
+
+	if (i >= cache->num_buckets)
+		return 0;
+
+	assert(bucket_size(cache, i) >= size);
+	assert(i == 0 || bucket_size(cache, i - 1) < size);
+	return bucket_size(cache, i);
+}
+
+/**
+ * Takes a BO out of the cache, returning true if it was in one.  Used when
+ * a cached BO is looked up by handle or name.
+ */
+drm_private bool
+util_bo_cache_remove(struct util_bo_cache_entry *entry)
+{
+	struct util_bo_cache *cache = entry->cache;
+
+	if (!cache)
+		return false;
+
+	list_del(&entry->bucket_link);
+	list_del(&entry->lru_link);
+	cache->stats.bytes_cached -= entry->size;
+	entry->cache = NULL;
+
+	return true;
+}
+
+static void
+evict_to(struct util_bo_cache *cache, uint64_t max_bytes)
+{
+	while (cache->stats.bytes_cached > max_bytes) {
+		struct util_bo_cache_entry *entry =
+			LIST_FIRST_ENTRY(&cache->lru, struct util_bo_cache_entry,
+					 lru_link);
+
+		util_bo_cache_remove(entry);
+		cache->funcs->evict(entry);
+		cache->stats.evicted++;
+	}
+}
+
+/* drop the oldest entries that have been purged by the kernel */
+static void
+purge_bucket(struct util_bo_cache *cache, struct list_head *bucket)
+{
+	while (!LIST_IS_EMPTY(bucket)) {
+		struct util_bo_cache_entry *entry =
+			LIST_FIRST_ENTRY(bucket, struct util_bo_cache_entry,
+					 bucket_link);
+
+		if (cache->funcs->madvise(entry, false))
+			break;
+
+		util_bo_cache_remove(entry);
+		cache->funcs->evict(entry);
+		cache->stats.purged++;
+	}
+}
+
+/**
+ * Takes a BO of @size and @flags out of the cache, or returns NULL.
+ *
+ * With @mru, the most recently freed BO is returned whether or not the GPU
+ * is done with it, as it will likely be hot in the GPU caches: this is for
+ * render targets, which aren't mapped first thing.  Otherwise, only the
+ * least recently freed BO is considered, and only if it is idle, as
+ * allocating a new BO is probably faster than waiting for the GPU.
+ */
+drm_private struct util_bo_cache_entry *
+util_bo_cache_get(struct util_bo_cache *cache, unsigned long size,
+		uint32_t flags, bool mru)
+{
+	struct util_bo_cache_entry *entry, *tmp, *found;
+	struct list_head *bucket;
+	unsigned i = bucket_index(cache, size);
+
+	if (i >= cache->num_buckets) {
+		cache->stats.misses++;
+		return NULL;
+	}
+	bucket = &cache->buckets[i];
+
+retry:
+	found = NULL;
+	if (mru) {
+		LIST_FOR_EACH_ENTRY_SAFE_REV(entry, tmp, bucket, bucket_link) {
+			if (entry->flags == flags) {
+				found = entry;
+				break;
+			}
+		}
+	} else {
+		LIST_FOR_EACH_ENTRY(entry, bucket, bucket_link) {
+			if (entry->flags != flags)
+				continue;
+			/* If the oldest BO is still busy, don't try younger ones */
+			if (cache->funcs->is_idle(entry))
+				found = entry;
+			break;
+		}
+	}
+
+	if (!found) {
+		cache->stats.misses++;
+		return NULL;
+	}
+
+	util_bo_cache_remove(found);
+
+	if (cache->funcs->madvise && !cache->funcs->madvise(found, true)) {
+		/* we've lost the backing pages, and likely those of the
+		 * older BOs as well: delete them and try again
+		 */
+		cache->funcs->evict(found);
+		cache->stats.purged++;
+		purge_bucket(cache, bucket);
+		goto retry;
+	}
+
+	cache->stats.hits++;
+	return found;
+}
+
+/**
+ * Puts a BO whose last reference was dropped at @time into the cache.  If
+ * the kernel already took its pages back it is freed instead.  The least
+ * recently freed BOs are then released until the cache fits its budget.
+ *
+ * Returns false, leaving the BO alone, if it is too large to be cached.
+ */
+drm_private bool
+util_bo_cache_put(struct util_bo_cache *cache,
+		struct util_bo_cache_entry *entry, unsigned long size,
+		uint32_t flags, time_t time)
+{
+	unsigned i = bucket_index(cache, size);
+
+	if (i >= cache->num_buckets)
+		return false;
+
+	assert(!entry->cache);
+
+	if (cache->funcs->madvise && !cache->funcs->madvise(entry, false)) {
+		cache->funcs->evict(entry);
+		cache->stats.purged++;
+		return true;
+	}
+
+	entry->cache = cache;
+	entry->size = size;
+	entry->flags = flags;
+	entry->free_time = time;
+	list_addtail(&entry->bucket_link, &cache->buckets[i]);
+	list_addtail(&entry->lru_link, &cache->lru);
+	cache->stats.bytes_cached += size;
+
+	evict_to(cache, cache->max_bytes);
+
+	return true;
+}
+
+/**
+ * Frees the BOs cached for more than a second at @time, or all of them if
+ * @time is 0.
+ */
+drm_private void
+util_bo_cache_cleanup(struct util_bo_cache *cache, time_t time)
+{
+	if (cache->time == time)
+		return;
+
+	while (!LIST_IS_EMPTY(&cache->lru)) {
+		struct util_bo_cache_entry *entry =
+			LIST_FIRST_ENTRY(&cache->lru, struct util_bo_cache_entry,
+					 lru_link);
+
+		/* keep things in cache for at least 1 second: */
+		if (time && time - entry->free_time <= 1)
+			break;
+
+		util_bo_cache_remove(entry);
+		cache->funcs->evict(entry);
+	}
+
+	cache->time = time;
+}
+
+/** Sets the maximum number of bytes kept in the cache. */
+drm_private void
+util_bo_cache_set_max_bytes(struct util_bo_cache *cache, uint64_t max_bytes)
+{
+	cache->max_bytes = max_bytes;
+	evict_to(cache, max_bytes);
+}
+
+/** Shrinks the cache down to @max_bytes, without changing its budget. */
+drm_private void
+util_bo_cache_trim(struct util_bo_cache *cache, uint64_t max_bytes)
+{
+	evict_to(cache, max_bytes);
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2007 Red Hat Inc.
+ * Copyright © 2007-2012 Intel Corporation
+ * Copyright 2006 Tungsten Graphics, Inc., Bismarck, ND., USA
+ * Copyright (C) 2016 Rob Clark <robclark@freedesktop.org>
+ * Copyright (C) 2016 Etnaviv Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * \file
+ * Bucketed cache of freed buffer objects, shared by the intel, freedreno and
+ * etnaviv buffer managers.
+ *
+ * Each driver embeds a struct util_bo_cache_entry in its BO, and tells the
+ * cache how to check whether a BO is idle, how to madvise it and how to free
+ * it.  BOs are sorted in buckets of 4k, 8k and 12k, then four per power of
+ * two (1, 1.25, 1.5 and 1.75 times it) from 16k to 64MB; a "coarse" cache
+ * only has the power of two ones.
+ *
+ * Not threadsafe: the caller serializes all calls on a given cache.
+ */
+
+#ifndef _UTIL_BO_CACHE_H_
+#define _UTIL_BO_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "util_double_list.h"
+
+#define UTIL_BO_CACHE_MAX_BUCKETS	(3 + 13 * 4)
+
+struct util_bo_cache;
+
+struct util_bo_cache_entry {
+	struct list_head bucket_link;
+	/** Link in util_bo_cache::lru */
+	struct list_head lru_link;
+	/** Cache the BO sits in, or NULL */
+	struct util_bo_cache *cache;
+	unsigned long size;
+	uint32_t flags;
+	time_t free_time;
+};
+
+struct util_bo_cache_funcs {
+	/** Returns true if the GPU is done with the BO. */
+	bool (*is_idle)(struct util_bo_cache_entry *entry);
+	/**
+	 * Optional: tells the kernel whether the BO's pages are needed, and
+	 * returns false if they have already been reclaimed.
+	 */
+	bool (*madvise)(struct util_bo_cache_entry *entry, bool willneed);
+	/** Frees a BO the cache is getting rid of. */
+	void (*evict)(struct util_bo_cache_entry *entry);
+};
+
+struct util_bo_cache_stats {
+	/** Size of the BOs sitting in the cache */
+	uint64_t bytes_cached;
+	/** Allocations served from the cache */
+	uint64_t hits;
+	/** Allocations that needed a new BO */
+	uint64_t misses;
+	/** Cached BOs whose pages had been reclaimed by the kernel */
+	uint64_t purged;
+	/** Cached BOs released to honour the byte budget */
+	uint64_t evicted;
+};
+
+struct util_bo_cache {
+	const struct util_bo_cache_funcs *funcs;
+	bool coarse;
+	unsigned num_buckets;
+	struct list_head buckets[UTIL_BO_CACHE_MAX_BUCKETS];
+	/** All cached BOs, least recently freed first */
+	struct list_head lru;
+	uint64_t max_bytes;
+	time_t time;
+	struct util_bo_cache_stats stats;
+};
+
+drm_private void util_bo_cache_init(struct util_bo_cache *cache, bool coarse,
+		const struct util_bo_cache_funcs *funcs);
+drm_private void util_bo_cache_fini(struct util_bo_cache *cache);
+drm_private unsigned long util_bo_cache_bucket_size(struct util_bo_cache *cache,
+		unsigned long size);
+drm_private struct util_bo_cache_entry *
+util_bo_cache_get(struct util_bo_cache *cache, unsigned long size,
+		uint32_t flags, bool mru);
+drm_private bool util_bo_cache_put(struct util_bo_cache *cache,
+		struct util_bo_cache_entry *entry, unsigned long size,
+		uint32_t flags, time_t time);
+drm_private bool util_bo_cache_remove(struct util_bo_cache_entry *entry);
+drm_private void util_bo_cache_cleanup(struct util_bo_cache *cache, time_t time);
+drm_private void util_bo_cache_set_max_bytes(struct util_bo_cache *cache,
+		uint64_t max_bytes);
+drm_private void util_bo_cache_trim(struct util_bo_cache *cache,
+		uint64_t max_bytes);
+
+#endif /* _UTIL_BO_CACHE_H_ */
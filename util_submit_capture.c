@@ -0,0 +1,856 @@
+/*
+ * Copyright (C) 2013 Rob Clark <robclark@freedesktop.org>
+ * Copyright (C) 2016 Etnaviv Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xf86atomic.h"
+#include "util_submit_capture.h"
+
+/* past this much waiting to be written, submits are dropped */
+#define MAX_QUEUED		(64 * 1024 * 1024)
+#define WRITE_BUF_SIZE		(1024 * 1024)
+/* bo's larger than this only have their contents captured if they hold
+ * commands
+ */
+#define DEFAULT_MAX_BO_SIZE	(1024 * 1024)
+#define SEEN_INIT_SIZE		1024
+/* forget about the blobs already written past this many, so that the set
+ * doesn't grow forever: they'll just be written again
+ */
+#define SEEN_MAX_SIZE		(64 * 1024)
+#define HANDLES_INIT_SIZE	64
+
+#define ALIGN8(x)		(((x) + 7) & ~(size_t)7)
+
+/* what a pending submit has of the contents of a bo or command: */
+enum contents_type {
+	CONTENTS_NONE,
+	/* a copy taken by the submitting thread */
+	CONTENTS_COPY,
+	/* the same as the last copy of the bo with that handle */
+	CONTENTS_UNCHANGED,
+};
+
+struct contents {
+	enum contents_type type;
+	uint32_t size;
+	const uint8_t *data;
+};
+
+/* A submit waiting for the writer thread, allocated in one piece along
+ * with its tables and the copies of its contents.  The blob ids in bos and
+ * cmds are filled in by the writer thread.
+ */
+struct pending {
+	struct pending *next;
+	/* set once the submitting thread is done filling it in: */
+	int ready;
+	size_t size;
+
+	struct util_capture_file_submit submit;
+	struct util_capture_file_bo *bos;
+	struct util_capture_file_cmd *cmds;
+	struct util_capture_reloc *relocs;
+	/* bo's first, then commands: */
+	struct contents *contents;
+};
+
+/* open-addressed map of GEM handles, which are never 0, to values: */
+struct handle_map {
+	uint32_t *handles;
+	uint64_t *values;
+	uint32_t size, count;
+};
+
+/* a blob written at @offset in the file: */
+struct seen_blob {
+	uint64_t hash;
+	uint64_t id;
+	uint64_t offset;
+	uint32_t size;
+};
+
+struct util_capture {
+	int fd;
+	uint32_t max_bo_size;
+	atomic_t generation;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop, write_error;
+
+	/* submits waiting for the writer thread, oldest first: */
+	struct pending *queue, **queue_tail;
+	/* bytes in queue: */
+	size_t queued;
+
+	/* generation of the contents last copied, per handle: */
+	struct handle_map generations;
+
+	uint32_t seqno;
+	struct util_capture_stats stats;
+
+	/* the rest only belongs to the writer thread */
+
+	/* blob id of the contents last copied, per handle: */
+	struct handle_map blobs;
+
+	/* open-addressed by hash, with a probe sequence of its own for every
+	 * content that has the same hash:
+	 */
+	struct seen_blob *seen;
+	uint32_t seen_size, seen_count;
+	uint64_t last_blob_id;
+
+	/* output buffer, to be written at @offset in the file: */
+	uint8_t *buf;
+	size_t buf_used;
+	uint64_t offset;
+};
+
+static atomic_t capture_cnt;
+
+/* Hash of some contents, only telling which blobs to compare them with */
+static uint64_t
+hash_data(const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	uint64_t h = 0xcbf29ce484222325ull ^ size;
+
+	while (size >= 8) {
+		uint64_t v;
+
+		memcpy(&v, p, 8);
+		h = (h ^ v) * 0x100000001b3ull;
+		h ^= h >> 29;
+		p += 8;
+		size -= 8;
+	}
+	while (size--)
+		h = (h ^ *p++) * 0x100000001b3ull;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static uint32_t
+handle_slot(const struct handle_map *map, uint32_t handle)
+{
+	uint32_t mask = map->size - 1;
+	uint32_t i = (handle * 2654435761u) & mask;
+
+	while (map->handles[i] && map->handles[i] != handle)
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+/* Returns the value of @handle, adding it if @insert is set, or NULL if
+ * it isn't there or couldn't be added.
+ */
+static uint64_t *
+handle_map_get(struct handle_map *map, uint32_t handle, int insert)
+{
+	uint32_t i;
+
+	if (map->size) {
+		i = handle_slot(map, handle);
+		if (map->handles[i])
+			return &map->values[i];
+	}
+	if (!insert)
+		return NULL;
+
+	if ((map->count + 1) * 2 > map->size) {
+		struct handle_map grown;
+		uint32_t j;
+
+		grown.size = map->size ? map->size * 2 : HANDLES_INIT_SIZE;
+		grown.count = map->count;
+		grown.handles = calloc(grown.size, sizeof(*grown.handles));
+		grown.values = calloc(grown.size, sizeof(*grown.values));
+		if (!grown.handles || !grown.values) {
+			free(grown.handles);
+			free(grown.values);
+			return NULL;
+		}
+		for (j = 0; j < map->size; j++) {
+			if (!map->handles[j])
+				continue;
+			i = handle_slot(&grown, map->handles[j]);
+			grown.handles[i] = map->handles[j];
+			grown.values[i] = map->values[j];
+		}
+		free(map->handles);
+		free(map->values);
+		*map = grown;
+	}
+
+	i = handle_slot(map, handle);
+	map->handles[i] = handle;
+	map->values[i] = 0;
+	map->count++;
+
+	return &map->values[i];
+}
+
+static void
+handle_map_fini(struct handle_map *map)
+{
+	free(map->handles);
+	free(map->values);
+}
+
+static int
+write_all(int fd, const uint8_t *data, size_t size)
+{
+	while (size) {
+		ssize_t ret = write(fd, data, size);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int
+out_flush(struct util_capture *capture)
+{
+	int ret = write_all(capture->fd, capture->buf, capture->buf_used);
+
+	capture->offset += capture->buf_used;
+	capture->buf_used = 0;
+
+	return ret;
+}
+
+static int
+out(struct util_capture *capture, const void *data, size_t size)
+{
+	int ret;
+
+	if (capture->buf_used + size > WRITE_BUF_SIZE) {
+		ret = out_flush(capture);
+		if (ret)
+			return ret;
+		if (size > WRITE_BUF_SIZE) {
+			ret = write_all(capture->fd, data, size);
+			capture->offset += size;
+			return ret;
+		}
+	}
+
+	memcpy(capture->buf + capture->buf_used, data, size);
+	capture->buf_used += size;
+
+	return 0;
+}
+
+static int
+out_pad(struct util_capture *capture, size_t size)
+{
+	static const uint8_t zeros[8];
+
+	return out(capture, zeros, ALIGN8(size) - size);
+}
+
+/* Whether the blob @seen in the file holds @data */
+static int
+blob_matches(struct util_capture *capture, const struct seen_blob *seen,
+		const uint8_t *data, uint32_t size)
+{
+	uint8_t tmp[64 * 1024];
+	uint64_t offset = seen->offset;
+
+	if (seen->size != size)
+		return 0;
+
+	/* it may not have left the output buffer yet: */
+	if (offset + size > capture->offset && out_flush(capture))
+		return 0;
+
+	while (size) {
+		ssize_t ret = pread(capture->fd, tmp,
+				    size < sizeof(tmp) ? size : sizeof(tmp),
+				    offset);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0 || memcmp(tmp, data, ret))
+			return 0;
+		data += ret;
+		offset += ret;
+		size -= ret;
+	}
+
+	return 1;
+}
+
+static uint32_t
+seen_first(const struct util_capture *capture, uint64_t hash)
+{
+	return (uint32_t)(hash ^ (hash >> 32)) & (capture->seen_size - 1);
+}
+
+/* Returns the id of a blob already written with these contents, or 0 */
+static uint64_t
+seen_find(struct util_capture *capture, uint64_t hash, const uint8_t *data,
+		uint32_t size)
+{
+	uint32_t mask = capture->seen_size - 1;
+	uint32_t i;
+
+	for (i = seen_first(capture, hash); capture->seen[i].id;
+	     i = (i + 1) & mask) {
+		if (capture->seen[i].hash == hash &&
+		    blob_matches(capture, &capture->seen[i], data, size))
+			return capture->seen[i].id;
+	}
+
+	return 0;
+}
+
+static void
+seen_add(struct util_capture *capture, const struct seen_blob *blob)
+{
+	uint32_t i, j, mask;
+
+	if ((capture->seen_count + 1) * 2 > capture->seen_size) {
+		struct seen_blob *old = capture->seen;
+		uint32_t old_size = capture->seen_size;
+		struct seen_blob *seen = NULL;
+
+		if (old_size < SEEN_MAX_SIZE)
+			seen = calloc(old_size * 2, sizeof(*seen));
+		if (!seen) {
+			/* forget about all of them */
+			memset(old, 0, old_size * sizeof(*old));
+			capture->seen_count = 0;
+		} else {
+			capture->seen = seen;
+			capture->seen_size = old_size * 2;
+			mask = capture->seen_size - 1;
+			for (j = 0; j < old_size; j++) {
+				if (!old[j].id)
+					continue;
+				for (i = seen_first(capture, old[j].hash);
+				     seen[i].id; i = (i + 1) & mask)
+					;
+				seen[i] = old[j];
+			}
+			free(old);
+		}
+	}
+
+	mask = capture->seen_size - 1;
+	for (i = seen_first(capture, blob->hash); capture->seen[i].id;
+	     i = (i + 1) & mask)
+		;
+	capture->seen[i] = *blob;
+	capture->seen_count++;
+}
+
+/* Sets @id to the blob with these contents, writing it unless it already
+ * was
+ */
+static int
+write_blob(struct util_capture *capture, const uint8_t *data, uint32_t size,
+		uint64_t *id, uint64_t *dedup_bytes)
+{
+	struct util_capture_record record = {
+		UTIL_CAPTURE_BLOB, sizeof(struct util_capture_file_blob) + size,
+	};
+	struct util_capture_file_blob file_blob;
+	struct seen_blob seen;
+	int ret;
+
+	seen.hash = hash_data(data, size);
+	*id = seen_find(capture, seen.hash, data, size);
+	if (*id) {
+		*dedup_bytes += size;
+		return 0;
+	}
+
+	file_blob.id = ++capture->last_blob_id;
+	ret = out(capture, &record, sizeof(record));
+	if (!ret)
+		ret = out(capture, &file_blob, sizeof(file_blob));
+	seen.offset = capture->offset + capture->buf_used;
+	if (!ret)
+		ret = out(capture, data, size);
+	if (!ret)
+		ret = out_pad(capture, size);
+	if (ret)
+		return ret;
+
+	seen.id = file_blob.id;
+	seen.size = size;
+	seen_add(capture, &seen);
+	*id = seen.id;
+
+	return 0;
+}
+
+static int
+write_pending(struct util_capture *capture, struct pending *p,
+		uint64_t *dedup_bytes)
+{
+	uint32_t nr_bos = p->submit.nr_bos, nr_cmds = p->submit.nr_cmds;
+	struct util_capture_record record = { UTIL_CAPTURE_SUBMIT, 0 };
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < nr_bos + nr_cmds; i++) {
+		struct contents *c = &p->contents[i];
+		uint64_t *blob = i < nr_bos ? &p->bos[i].blob
+					    : &p->cmds[i - nr_bos].blob;
+		uint64_t *last;
+
+		switch (c->type) {
+		case CONTENTS_NONE:
+			break;
+		case CONTENTS_UNCHANGED:
+			last = handle_map_get(&capture->blobs, p->bos[i].handle, 0);
+			if (last)
+				*blob = *last;
+			break;
+		case CONTENTS_COPY:
+			ret = write_blob(capture, c->data, c->size, blob,
+					 dedup_bytes);
+			if (ret)
+				return ret;
+			if (i >= nr_bos)
+				break;
+			last = handle_map_get(&capture->blobs, p->bos[i].handle, 1);
+			if (last)
+				*last = *blob;
+			break;
+		}
+	}
+
+	record.size = sizeof(p->submit) +
+		nr_bos * sizeof(*p->bos) +
+		nr_cmds * sizeof(*p->cmds) +
+		p->submit.nr_relocs * sizeof(*p->relocs);
+	ret = out(capture, &record, sizeof(record));
+	if (!ret)
+		ret = out(capture, &p->submit, sizeof(p->submit));
+	if (!ret)
+		ret = out(capture, p->bos, nr_bos * sizeof(*p->bos));
+	if (!ret)
+		ret = out(capture, p->cmds, nr_cmds * sizeof(*p->cmds));
+	if (!ret)
+		ret = out(capture, p->relocs,
+			  p->submit.nr_relocs * sizeof(*p->relocs));
+
+	return ret;
+}
+
+static void
+set_write_error(struct util_capture *capture, int error)
+{
+	if (error && !capture->write_error)
+		fprintf(stderr, "submit capture: write failed: %s\n",
+			strerror(-error));
+	capture->write_error = error;
+}
+
+/*
+ * Writes out the submits in the order they were made, and whatever is
+ * buffered once there are none left, so that not much is lost if the
+ * process dies.  After an error, keeps throwing submits away so that they
+ * don't pile up.
+ */
+static void *
+writer_thread(void *arg)
+{
+	struct util_capture *capture = arg;
+
+	pthread_mutex_lock(&capture->lock);
+	for (;;) {
+		struct pending *p = capture->queue;
+		uint64_t dedup_bytes = 0, written;
+		int error = capture->write_error;
+
+		if (!p || !p->ready) {
+			if (capture->buf_used && !error) {
+				pthread_mutex_unlock(&capture->lock);
+				error = out_flush(capture);
+				pthread_mutex_lock(&capture->lock);
+				set_write_error(capture, error);
+				continue;
+			}
+			if (capture->stop)
+				break;
+			pthread_cond_wait(&capture->cond, &capture->lock);
+			continue;
+		}
+
+		capture->queue = p->next;
+		if (!capture->queue)
+			capture->queue_tail = &capture->queue;
+		pthread_mutex_unlock(&capture->lock);
+
+		written = capture->offset + capture->buf_used;
+		if (!error)
+			error = write_pending(capture, p, &dedup_bytes);
+		written = capture->offset + capture->buf_used - written;
+
+		pthread_mutex_lock(&capture->lock);
+		set_write_error(capture, error);
+		capture->queued -= p->size;
+		capture->stats.dedup_bytes += dedup_bytes;
+		if (!error)
+			capture->stats.written_bytes += written;
+		free(p);
+	}
+	pthread_mutex_unlock(&capture->lock);
+
+	return NULL;
+}
+
+/**
+ * Opens a capture file at "<$env>.<pid>.<n>" if the environment variable
+ * @env is set, or returns NULL.
+ */
+drm_private struct util_capture *
+util_capture_open_env(const char *env, const char *driver)
+{
+	const char *prefix = getenv(env);
+	struct util_capture *capture;
+	char *path;
+
+	if (!prefix || !*prefix)
+		return NULL;
+
+	if (asprintf(&path, "%s.%d.%d", prefix, (int)getpid(),
+		     atomic_inc_return(&capture_cnt)) < 0)
+		return NULL;
+
+	capture = util_capture_open(path, driver, DEFAULT_MAX_BO_SIZE);
+	free(path);
+
+	return capture;
+}
+
+/**
+ * Creates the capture file at @path, for submits of @driver.  The contents
+ * of bo's larger than @max_bo_size are only captured when they hold
+ * commands.
+ */
+drm_private struct util_capture *
+util_capture_open(const char *path, const char *driver, uint32_t max_bo_size)
+{
+	struct util_capture_file_header header;
+	struct util_capture *capture;
+	uint32_t driver_len = strlen(driver);
+
+	capture = calloc(1, sizeof(*capture));
+	if (!capture)
+		return NULL;
+
+	capture->max_bo_size = max_bo_size;
+	capture->queue_tail = &capture->queue;
+	capture->seen_size = SEEN_INIT_SIZE;
+	capture->seen = calloc(capture->seen_size, sizeof(*capture->seen));
+	capture->buf = malloc(WRITE_BUF_SIZE);
+	if (!capture->seen || !capture->buf)
+		goto fail;
+
+	/* read back to compare contents with the blobs already written: */
+	capture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (capture->fd < 0) {
+		fprintf(stderr, "submit capture: can't open %s: %s\n", path,
+			strerror(errno));
+		goto fail;
+	}
+
+	memcpy(header.magic, UTIL_CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = UTIL_CAPTURE_VERSION;
+	header.driver_len = driver_len;
+	out(capture, &header, sizeof(header));
+	out(capture, driver, driver_len);
+	out_pad(capture, driver_len);
+
+	pthread_mutex_init(&capture->lock, NULL);
+	pthread_cond_init(&capture->cond, NULL);
+	if (pthread_create(&capture->thread, NULL, writer_thread, capture)) {
+		pthread_cond_destroy(&capture->cond);
+		pthread_mutex_destroy(&capture->lock);
+		close(capture->fd);
+		goto fail;
+	}
+
+	return capture;
+
+fail:
+	free(capture->buf);
+	free(capture->seen);
+	free(capture);
+	return NULL;
+}
+
+/** Writes out everything captured so far, and closes the file. */
+drm_private void
+util_capture_close(struct util_capture *capture)
+{
+	if (!capture)
+		return;
+
+	pthread_mutex_lock(&capture->lock);
+	capture->stop = 1;
+	pthread_cond_signal(&capture->cond);
+	pthread_mutex_unlock(&capture->lock);
+	pthread_join(capture->thread, NULL);
+
+	while (capture->queue) {
+		struct pending *p = capture->queue;
+
+		capture->queue = p->next;
+		free(p);
+	}
+	pthread_cond_destroy(&capture->cond);
+	pthread_mutex_destroy(&capture->lock);
+	close(capture->fd);
+	handle_map_fini(&capture->generations);
+	handle_map_fini(&capture->blobs);
+	free(capture->buf);
+	free(capture->seen);
+	free(capture);
+}
+
+static int
+is_cmd_bo(const struct util_capture_submit *submit, uint32_t idx)
+{
+	uint32_t i;
+
+	for (i = 0; i < submit->nr_cmds; i++)
+		if (submit->cmds[i].bo_idx == idx)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * Captures a submit, along with the contents of its command buffers and of
+ * its bo's that have a CPU mapping.  Should be called right before the
+ * submit ioctl, once relocs have been applied.
+ *
+ * The contents of bo's are only copied if their generation changed since
+ * they were last captured, and they are hashed and compared with the ones
+ * already written by the writer thread.
+ */
+drm_private void
+util_capture_submit(struct util_capture *capture,
+		const struct util_capture_submit *submit)
+{
+	uint32_t i, nr_bos = submit->nr_bos, nr_contents = nr_bos + submit->nr_cmds;
+	enum contents_type *types;
+	uint64_t unchanged_bytes = 0;
+	struct pending *p;
+	uint8_t *data;
+	size_t size;
+
+	size = ALIGN8(sizeof(*p)) +
+		nr_bos * sizeof(*p->bos) +
+		submit->nr_cmds * sizeof(*p->cmds) +
+		submit->nr_relocs * sizeof(*p->relocs) +
+		ALIGN8(nr_contents * sizeof(*p->contents));
+
+	types = calloc(nr_contents ? nr_contents : 1, sizeof(*types));
+
+	pthread_mutex_lock(&capture->lock);
+
+	capture->stats.submits++;
+	if (!types || capture->write_error)
+		goto drop;
+
+	for (i = 0; i < nr_bos; i++) {
+		const struct util_capture_bo *bo = &submit->bos[i];
+		uint64_t *generation = NULL;
+
+		if (!bo->map)
+			continue;
+		if (bo->size > capture->max_bo_size && !is_cmd_bo(submit, i))
+			continue;
+
+		if (bo->generation)
+			generation = handle_map_get(&capture->generations,
+						    bo->handle, 0);
+		if (generation && *generation == bo->generation) {
+			types[i] = CONTENTS_UNCHANGED;
+			unchanged_bytes += bo->size;
+		} else {
+			types[i] = CONTENTS_COPY;
+			size += ALIGN8(bo->size);
+		}
+	}
+	for (i = 0; i < submit->nr_cmds; i++) {
+		const struct util_capture_cmd *cmd = &submit->cmds[i];
+
+		if (cmd->bo_idx == UTIL_CAPTURE_NO_BO && cmd->data) {
+			types[nr_bos + i] = CONTENTS_COPY;
+			size += ALIGN8(cmd->size);
+		}
+	}
+
+	if (capture->queued + size > MAX_QUEUED)
+		goto drop;
+	p = malloc(size);
+	if (!p)
+		goto drop;
+
+	/* later submits can tell the copies are still good from now on: */
+	for (i = 0; i < nr_bos; i++) {
+		uint64_t *generation;
+
+		if (types[i] != CONTENTS_COPY)
+			continue;
+		generation = handle_map_get(&capture->generations,
+					    submit->bos[i].handle, 1);
+		if (generation)
+			*generation = submit->bos[i].generation;
+	}
+
+	capture->stats.unchanged_bytes += unchanged_bytes;
+	p->submit.seqno = capture->seqno++;
+	p->next = NULL;
+	p->ready = 0;
+	p->size = size;
+	*capture->queue_tail = p;
+	capture->queue_tail = &p->next;
+	capture->queued += size;
+
+	pthread_mutex_unlock(&capture->lock);
+
+	/* the writer thread waits for the submit to be ready, so that it
+	 * can be filled in without the lock:
+	 */
+	data = (uint8_t *)p + ALIGN8(sizeof(*p));
+	p->bos = (void *)data;
+	data += nr_bos * sizeof(*p->bos);
+	p->cmds = (void *)data;
+	data += submit->nr_cmds * sizeof(*p->cmds);
+	p->relocs = (void *)data;
+	data += submit->nr_relocs * sizeof(*p->relocs);
+	p->contents = (void *)data;
+	data += ALIGN8(nr_contents * sizeof(*p->contents));
+
+	p->submit.queue = submit->queue;
+	p->submit.nr_bos = nr_bos;
+	p->submit.nr_cmds = submit->nr_cmds;
+	p->submit.nr_relocs = submit->nr_relocs;
+	p->submit.pad = 0;
+
+	for (i = 0; i < nr_contents; i++) {
+		struct contents *c = &p->contents[i];
+		const void *src;
+
+		c->type = types[i];
+		if (i < nr_bos) {
+			const struct util_capture_bo *bo = &submit->bos[i];
+
+			p->bos[i] = (struct util_capture_file_bo){
+				.handle = bo->handle,
+				.flags = bo->flags,
+				.iova = bo->iova,
+				.size = bo->size,
+			};
+			c->size = bo->size;
+			src = bo->map;
+		} else {
+			const struct util_capture_cmd *cmd = &submit->cmds[i - nr_bos];
+
+			p->cmds[i - nr_bos] = (struct util_capture_file_cmd){
+				.type = cmd->type,
+				.bo_idx = cmd->bo_idx,
+				.offset = cmd->offset,
+				.size = cmd->size,
+			};
+			c->size = cmd->size;
+			src = cmd->data;
+		}
+
+		c->data = NULL;
+		if (c->type == CONTENTS_COPY) {
+			memcpy(data, src, c->size);
+			c->data = data;
+			data += ALIGN8(c->size);
+		}
+	}
+	memcpy(p->relocs, submit->relocs,
+	       submit->nr_relocs * sizeof(*p->relocs));
+	free(types);
+
+	pthread_mutex_lock(&capture->lock);
+	p->ready = 1;
+	pthread_cond_signal(&capture->cond);
+	pthread_mutex_unlock(&capture->lock);
+
+	return;
+
+drop:
+	capture->stats.dropped++;
+	pthread_mutex_unlock(&capture->lock);
+	free(types);
+}
+
+drm_private void
+util_capture_get_stats(struct util_capture *capture,
+		struct util_capture_stats *stats)
+{
+	pthread_mutex_lock(&capture->lock);
+	*stats = capture->stats;
+	pthread_mutex_unlock(&capture->lock);
+}
+
+/**
+ * Returns a new generation for a bo whose contents the CPU may be about to
+ * write, for util_capture_submit() to copy them again.
+ */
+drm_private uint32_t
+util_capture_next_generation(struct util_capture *capture)
+{
+	uint32_t generation;
+
+	do {
+		generation = atomic_inc_return(&capture->generation);
+	} while (!generation);
+
+	return generation;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2013 Rob Clark <robclark@freedesktop.org>
+ * Copyright (C) 2016 Etnaviv Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * \file
+ * Binary capture of command submissions, shared by the msm and etnaviv
+ * backends, for replaying them after the fact.
+ *
+ * A capture file starts with a struct util_capture_file_header and the
+ * driver name, padded to 8 bytes, followed by records: a struct
+ * util_capture_record, then its payload, padded to 8 bytes.
+ *
+ * - UTIL_CAPTURE_BLOB: a struct util_capture_file_blob, then the data.
+ *   Blob ids are numbered from 1 in the order blobs are written.  Contents
+ *   are mostly only written once, and referred to by their blob id
+ *   afterwards.
+ * - UTIL_CAPTURE_SUBMIT: a struct util_capture_file_submit, then nr_bos
+ *   struct util_capture_file_bo, nr_cmds struct util_capture_file_cmd and
+ *   nr_relocs struct util_capture_reloc.  The contents of the bo's and of
+ *   commands in user memory are the blobs with the given ids, written
+ *   before the submit.
+ *
+ * Everything is in host byte order.  The submitting thread only copies the
+ * contents that may have changed since they were last captured, as told by
+ * the generation of the bo's.  A background thread hashes them, looks for
+ * identical contents already in the file, and writes out the rest.  If it
+ * can't keep up, whole submits are dropped rather than blocking the driver.
+ */
+
+#ifndef _UTIL_SUBMIT_CAPTURE_H_
+#define _UTIL_SUBMIT_CAPTURE_H_
+
+#include <stdint.h>
+
+#include "libdrm_macros.h"
+
+#define UTIL_CAPTURE_MAGIC	"libdrmcp"
+#define UTIL_CAPTURE_VERSION	2
+
+/** bo_idx of commands in user memory, as etnaviv has */
+#define UTIL_CAPTURE_NO_BO	0xffffffff
+
+enum util_capture_record_type {
+	UTIL_CAPTURE_BLOB = 1,
+	UTIL_CAPTURE_SUBMIT = 2,
+};
+
+struct util_capture_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t driver_len;
+};
+
+struct util_capture_record {
+	uint32_t type;
+	/** payload size, without padding */
+	uint32_t size;
+};
+
+struct util_capture_file_blob {
+	uint64_t id;
+};
+
+struct util_capture_file_submit {
+	uint32_t seqno;
+	uint32_t queue;
+	uint32_t nr_bos;
+	uint32_t nr_cmds;
+	uint32_t nr_relocs;
+	uint32_t pad;
+};
+
+struct util_capture_file_bo {
+	uint32_t handle;
+	uint32_t flags;
+	uint64_t iova;
+	uint32_t size;
+	uint32_t pad;
+	/** 0 if the contents weren't captured */
+	uint64_t blob;
+};
+
+struct util_capture_file_cmd {
+	uint32_t type;
+	uint32_t bo_idx;
+	uint32_t offset;
+	uint32_t size;
+	/** contents of commands in user memory, 0 otherwise */
+	uint64_t blob;
+};
+
+struct util_capture_reloc {
+	uint32_t cmd_idx;
+	uint32_t submit_offset;
+	uint32_t reloc_idx;
+	uint32_t flags;
+	uint32_t or;
+	int32_t shift;
+	uint64_t reloc_offset;
+};
+
+/* what drivers hand to util_capture_submit(): */
+
+struct util_capture_bo {
+	uint32_t handle;
+	uint32_t flags;
+	uint64_t iova;
+	uint32_t size;
+	/**
+	 * From util_capture_next_generation() whenever the CPU may have
+	 * written the contents since, or 0 to always capture them
+	 */
+	uint32_t generation;
+	/** CPU mapping of the contents, or NULL not to capture them */
+	const void *map;
+};
+
+struct util_capture_cmd {
+	uint32_t type;
+	/** bo the commands are in, or UTIL_CAPTURE_NO_BO */
+	uint32_t bo_idx;
+	uint32_t offset;
+	uint32_t size;
+	/** the commands, if in user memory */
+	const void *data;
+};
+
+struct util_capture_submit {
+	uint32_t queue;
+	const struct util_capture_bo *bos;
+	uint32_t nr_bos;
+	const struct util_capture_cmd *cmds;
+	uint32_t nr_cmds;
+	const struct util_capture_reloc *relocs;
+	uint32_t nr_relocs;
+};
+
+struct util_capture_stats {
+	uint64_t submits;
+	/** submits dropped because too much was waiting to be written */
+	uint64_t dropped;
+	/** bytes of contents that didn't need writing again */
+	uint64_t dedup_bytes;
+	/** bytes of contents that weren't even copied, as they didn't change */
+	uint64_t unchanged_bytes;
+	uint64_t written_bytes;
+};
+
+struct util_capture;
+
+drm_private struct util_capture *util_capture_open_env(const char *env,
+		const char *driver);
+drm_private struct util_capture *util_capture_open(const char *path,
+		const char *driver, uint32_t max_bo_size);
+drm_private void util_capture_close(struct util_capture *capture);
+drm_private void util_capture_submit(struct util_capture *capture,
+		const struct util_capture_submit *submit);
+drm_private void util_capture_get_stats(struct util_capture *capture,
+		struct util_capture_stats *stats);
+drm_private uint32_t util_capture_next_generation(struct util_capture *capture);
+
+#endif /* _UTIL_SUBMIT_CAPTURE_H_ */
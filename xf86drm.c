@@ -50,6 +50,8 @@
 #define stat_t struct stat
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #ifdef MAJOR_IN_MKDEV
 #include <sys/mkdev.h>
@@ -146,9 +148,10 @@ struct drmFormatModifierInfo {
     const char *modifier_name;
 };
 
-struct drmFormatModifierVendorInfo {
-    uint8_t vendor;
-    const char *vendor_name;
+/* Slice of drm_format_modifier_table holding the modifiers of one vendor */
+struct drmFormatModifierRange {
+    uint16_t first;
+    uint16_t count;
 };
 
 #include "generated_static_table_fourcc.h"
@@ -176,12 +179,23 @@ static char *
 drmGetFormatModifierNameFromAmlogic(uint64_t modifier);
 
 static const struct drmVendorInfo modifier_format_vendor_table[] = {
-    { DRM_FORMAT_MOD_VENDOR_ARM, drmGetFormatModifierNameFromArm },
-    { DRM_FORMAT_MOD_VENDOR_NVIDIA, drmGetFormatModifierNameFromNvidia },
-    { DRM_FORMAT_MOD_VENDOR_AMD, drmGetFormatModifierNameFromAmd },
-    { DRM_FORMAT_MOD_VENDOR_AMLOGIC, drmGetFormatModifierNameFromAmlogic },
+    [DRM_FORMAT_MOD_VENDOR_ARM] = { DRM_FORMAT_MOD_VENDOR_ARM, drmGetFormatModifierNameFromArm },
+    [DRM_FORMAT_MOD_VENDOR_NVIDIA] = { DRM_FORMAT_MOD_VENDOR_NVIDIA, drmGetFormatModifierNameFromNvidia },
+    [DRM_FORMAT_MOD_VENDOR_AMD] = { DRM_FORMAT_MOD_VENDOR_AMD, drmGetFormatModifierNameFromAmd },
+    [DRM_FORMAT_MOD_VENDOR_AMLOGIC] = { DRM_FORMAT_MOD_VENDOR_AMLOGIC, drmGetFormatModifierNameFromAmlogic },
 };
 
+/* The vendor decoders above build their strings with open_memstream(), cache
+ * their results since the same modifiers tend to be queried over and over.
+ */
+#define DRM_MODIFIER_NAME_CACHE_SIZE 256
+
+static struct {
+    uint64_t modifier;
+    char *name;
+} drm_modifier_name_cache[DRM_MODIFIER_NAME_CACHE_SIZE];
+static pthread_mutex_t drm_modifier_name_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
 #ifndef AFBC_FORMAT_MOD_MODE_VALUE_MASK
 #define AFBC_FORMAT_MOD_MODE_VALUE_MASK	0x000fffffffffffffULL
 #endif
@@ -3271,6 +3285,125 @@ drm_public int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
     return 0;
 }
 
+struct _drmPrimeCache {
+    int fd;
+    void *inodes;   /* st_ino -> struct drm_prime_cache_entry */
+    void *handles;  /* GEM handle -> struct drm_prime_cache_entry */
+};
+
+struct drm_prime_cache_entry {
+    dev_t dev;
+    ino_t ino;
+    uint32_t handle;
+};
+
+drm_public drmPrimeCachePtr drmPrimeCacheCreate(int fd)
+{
+    drmPrimeCachePtr cache;
+
+    cache = drmMalloc(sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    cache->fd = fd;
+    cache->inodes = drmHashCreate();
+    cache->handles = drmHashCreate();
+    if (!cache->inodes || !cache->handles) {
+        drmPrimeCacheDestroy(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+drm_public void drmPrimeCacheDestroy(drmPrimeCachePtr cache)
+{
+    unsigned long key;
+    void *value;
+
+    if (!cache)
+        return;
+
+    if (cache->handles) {
+        if (drmHashFirst(cache->handles, &key, &value)) {
+            do {
+                drmFree(value);
+            } while (drmHashNext(cache->handles, &key, &value));
+        }
+        drmHashDestroy(cache->handles);
+    }
+    if (cache->inodes)
+        drmHashDestroy(cache->inodes);
+    drmFree(cache);
+}
+
+static void drmPrimeCacheRemoveEntry(drmPrimeCachePtr cache,
+                                     struct drm_prime_cache_entry *entry)
+{
+    drmHashDelete(cache->inodes, (unsigned long)entry->ino);
+    drmHashDelete(cache->handles, entry->handle);
+    drmFree(entry);
+}
+
+drm_public int drmPrimeCacheFDToHandle(drmPrimeCachePtr cache, int prime_fd,
+                                       uint32_t *handle)
+{
+    struct drm_prime_cache_entry *entry;
+    struct stat st;
+    void *value;
+    int ret;
+
+    if (fstat(prime_fd, &st))
+        return drmPrimeFDToHandle(cache->fd, prime_fd, handle);
+
+    if (!drmHashLookup(cache->inodes, (unsigned long)st.st_ino, &value)) {
+        entry = value;
+        if (entry->dev == st.st_dev && entry->ino == st.st_ino) {
+            *handle = entry->handle;
+            return 0;
+        }
+        /* Truncated key collision, drop the older entry. */
+        drmPrimeCacheRemoveEntry(cache, entry);
+    }
+
+    ret = drmPrimeFDToHandle(cache->fd, prime_fd, handle);
+    if (ret)
+        return ret;
+
+    /* The handle was closed behind our back and then reused by the kernel
+     * for another buffer, forget about the old buffer.
+     */
+    if (!drmHashLookup(cache->handles, *handle, &value))
+        drmPrimeCacheRemoveEntry(cache, value);
+
+    entry = drmMalloc(sizeof(*entry));
+    if (!entry)
+        return 0;
+
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->handle = *handle;
+    if (drmHashInsert(cache->inodes, (unsigned long)entry->ino, entry)) {
+        drmFree(entry);
+        return 0;
+    }
+    if (drmHashInsert(cache->handles, entry->handle, entry)) {
+        drmHashDelete(cache->inodes, (unsigned long)entry->ino);
+        drmFree(entry);
+    }
+
+    return 0;
+}
+
+drm_public void drmPrimeCacheRemoveHandle(drmPrimeCachePtr cache,
+                                          uint32_t handle)
+{
+    void *value;
+
+    if (!drmHashLookup(cache->handles, handle, &value))
+        drmPrimeCacheRemoveEntry(cache, value);
+}
+
 static char *drmGetMinorNameForFD(int fd, int type)
 {
 #ifdef __linux__
@@ -4944,12 +5077,661 @@ drm_public int drmSyncobjTransfer(int fd,
     return ret;
 }
 
+struct drm_syncobj_wait_item {
+    int fd;
+    uint32_t handle;
+    uint64_t point;
+    int sync_file;
+    bool signaled;
+};
+
+struct drm_syncobj_wait_scratch {
+    int fd;
+    uint32_t handle;
+};
+
+struct _drmSyncobjWaitSet {
+    struct drm_syncobj_wait_item *items;
+    unsigned num_items, max_items;
+
+    /* Binary syncobjs used to export timeline points, one per device. */
+    struct drm_syncobj_wait_scratch *scratch;
+    unsigned num_scratch;
+
+    struct pollfd *pfds;
+    unsigned *pfd_items;
+    uint32_t *handles;
+    uint64_t *points;
+};
+
+drm_public drmSyncobjWaitSetPtr drmSyncobjWaitSetCreate(void)
+{
+    return calloc(1, sizeof(drmSyncobjWaitSet));
+}
+
+drm_public void drmSyncobjWaitSetReset(drmSyncobjWaitSetPtr set)
+{
+    unsigned i;
+
+    for (i = 0; i < set->num_items; i++) {
+        if (set->items[i].sync_file >= 0)
+            close(set->items[i].sync_file);
+    }
+    set->num_items = 0;
+}
+
+drm_public void drmSyncobjWaitSetDestroy(drmSyncobjWaitSetPtr set)
+{
+    unsigned i;
+
+    if (!set)
+        return;
+
+    drmSyncobjWaitSetReset(set);
+    for (i = 0; i < set->num_scratch; i++)
+        drmSyncobjDestroy(set->scratch[i].fd, set->scratch[i].handle);
+
+    free(set->items);
+    free(set->scratch);
+    free(set->pfds);
+    free(set->pfd_items);
+    free(set->handles);
+    free(set->points);
+    free(set);
+}
+
+drm_public int drmSyncobjWaitSetAdd(drmSyncobjWaitSetPtr set, int fd,
+                                    uint32_t handle, uint64_t point)
+{
+    struct drm_syncobj_wait_item *item;
+
+    if (set->num_items == set->max_items) {
+        unsigned max = set->max_items ? set->max_items * 2 : 8;
+        void *items, *pfds, *pfd_items, *handles, *points;
+
+        items = realloc(set->items, max * sizeof(*set->items));
+        if (items)
+            set->items = items;
+        pfds = realloc(set->pfds, max * sizeof(*set->pfds));
+        if (pfds)
+            set->pfds = pfds;
+        pfd_items = realloc(set->pfd_items, max * sizeof(*set->pfd_items));
+        if (pfd_items)
+            set->pfd_items = pfd_items;
+        handles = realloc(set->handles, max * sizeof(*set->handles));
+        if (handles)
+            set->handles = handles;
+        points = realloc(set->points, max * sizeof(*set->points));
+        if (points)
+            set->points = points;
+        if (!items || !pfds || !pfd_items || !handles || !points)
+            return -ENOMEM;
+
+        set->max_items = max;
+    }
+
+    item = &set->items[set->num_items];
+    item->fd = fd;
+    item->handle = handle;
+    item->point = point;
+    item->sync_file = -1;
+    item->signaled = false;
+
+    return set->num_items++;
+}
+
+drm_public int drmSyncobjWaitSetIsSignaled(drmSyncobjWaitSetPtr set,
+                                           unsigned index)
+{
+    if (index >= set->num_items)
+        return 0;
+    return set->items[index].signaled;
+}
+
+static int drmSyncobjWaitSetScratch(drmSyncobjWaitSetPtr set, int fd,
+                                    uint32_t *handle)
+{
+    struct drm_syncobj_wait_scratch *scratch;
+    unsigned i;
+    int ret;
+
+    for (i = 0; i < set->num_scratch; i++) {
+        if (set->scratch[i].fd == fd) {
+            *handle = set->scratch[i].handle;
+            return 0;
+        }
+    }
+
+    scratch = realloc(set->scratch, (i + 1) * sizeof(*scratch));
+    if (!scratch)
+        return -ENOMEM;
+    set->scratch = scratch;
+
+    ret = drmSyncobjCreate(fd, 0, handle);
+    if (ret)
+        return -errno;
+
+    scratch[i].fd = fd;
+    scratch[i].handle = *handle;
+    set->num_scratch++;
+    return 0;
+}
+
+static int drmSyncobjWaitSetExport(drmSyncobjWaitSetPtr set,
+                                   struct drm_syncobj_wait_item *item)
+{
+    uint32_t handle = item->handle;
+    int ret;
+
+    /* Only the binary payload can be exported as a sync_file, so move the
+     * timeline point into a scratch syncobj first.
+     */
+    if (item->point) {
+        ret = drmSyncobjWaitSetScratch(set, item->fd, &handle);
+        if (ret)
+            return ret;
+        ret = drmSyncobjTransfer(item->fd, handle, 0,
+                                 item->handle, item->point, 0);
+        if (ret)
+            return -errno;
+    }
+
+    ret = drmSyncobjExportSyncFile(item->fd, handle, &item->sync_file);
+    if (ret)
+        return -errno;
+    return 0;
+}
+
+/* Marks the pending fences of every device that already signaled, so that
+ * no sync_file gets exported for them. A WAIT_ALL wait with a zero timeout
+ * catches the common case of everything having signaled in one ioctl per
+ * device. Otherwise non-blocking "any" waits pick the signaled fences off
+ * one at a time until one times out.
+ */
+static void drmSyncobjWaitSetPoll(drmSyncobjWaitSetPtr set)
+{
+    unsigned i, j, count;
+    uint32_t first = 0;
+    int fd;
+
+    for (i = 0; i < set->num_items; i++) {
+        fd = set->items[i].fd;
+        for (j = 0; j < i; j++) {
+            if (set->items[j].fd == fd)
+                break;
+        }
+        if (j < i)
+            continue;
+
+        count = 0;
+        for (j = i; j < set->num_items; j++) {
+            if (set->items[j].fd != fd || set->items[j].signaled ||
+                set->items[j].sync_file >= 0)
+                continue;
+            set->pfd_items[count] = j;
+            set->handles[count] = set->items[j].handle;
+            set->points[count] = set->items[j].point;
+            count++;
+        }
+        if (!count)
+            continue;
+
+        if (drmSyncobjTimelineWait(fd, set->handles, set->points, count, 0,
+                                   DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL, NULL) == 0) {
+            for (j = 0; j < count; j++)
+                set->items[set->pfd_items[j]].signaled = true;
+            continue;
+        }
+
+        while (count > 1 &&
+               drmSyncobjTimelineWait(fd, set->handles, set->points, count, 0,
+                                      0, &first) == 0 && first < count) {
+            set->items[set->pfd_items[first]].signaled = true;
+            count--;
+            set->pfd_items[first] = set->pfd_items[count];
+            set->handles[first] = set->handles[count];
+            set->points[first] = set->points[count];
+        }
+    }
+}
+
+static int drmSyncobjWaitSetDone(drmSyncobjWaitSetPtr set, unsigned flags,
+                                 uint32_t *first_signaled)
+{
+    bool wait_all = flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL;
+    bool any = false;
+    unsigned i;
+
+    for (i = 0; i < set->num_items; i++) {
+        if (set->items[i].signaled) {
+            if (!any && first_signaled)
+                *first_signaled = i;
+            any = true;
+        } else if (wait_all) {
+            return 0;
+        }
+    }
+
+    return wait_all || any;
+}
+
+drm_public int drmSyncobjWaitSetWait(drmSyncobjWaitSetPtr set,
+                                     int64_t timeout_nsec, unsigned flags,
+                                     uint32_t *first_signaled)
+{
+    struct timespec now;
+    int64_t remaining;
+    unsigned i, count;
+    int ret, timeout;
+
+    if (flags & ~DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL)
+        return -EINVAL;
+    if (!set->num_items)
+        return -EINVAL;
+
+    drmSyncobjWaitSetPoll(set);
+
+    for (i = 0; i < set->num_items; i++) {
+        if (set->items[i].signaled || set->items[i].sync_file >= 0)
+            continue;
+        ret = drmSyncobjWaitSetExport(set, &set->items[i]);
+        if (ret)
+            return ret;
+    }
+
+    while (!drmSyncobjWaitSetDone(set, flags, first_signaled)) {
+        count = 0;
+        for (i = 0; i < set->num_items; i++) {
+            if (set->items[i].signaled)
+                continue;
+            set->pfds[count].fd = set->items[i].sync_file;
+            set->pfds[count].events = POLLIN;
+            set->pfds[count].revents = 0;
+            set->pfd_items[count] = i;
+            count++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = timeout_nsec - ((int64_t)now.tv_sec * 1000000000ll +
+                                    now.tv_nsec);
+        if (remaining <= 0)
+            timeout = 0;
+        else if (remaining / 1000000 >= INT_MAX)
+            timeout = -1;
+        else
+            timeout = (remaining + 999999) / 1000000;
+
+        ret = poll(set->pfds, count, timeout);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return -errno;
+        }
+        if (ret == 0)
+            return -ETIME;
+
+        for (i = 0; i < count; i++) {
+            struct drm_syncobj_wait_item *item = &set->items[set->pfd_items[i]];
+
+            if (!(set->pfds[i].revents & (POLLIN | POLLERR | POLLNVAL)))
+                continue;
+            item->signaled = true;
+            close(item->sync_file);
+            item->sync_file = -1;
+        }
+    }
+
+    return 0;
+}
+
+struct drm_syncobj_notifier_item {
+    uint32_t handle;
+    uint64_t point;
+    uint64_t cookie;
+};
+
+struct drm_syncobj_notifier_list {
+    struct drm_syncobj_notifier_item *items;
+    unsigned count, max;
+};
+
+struct _drmSyncobjNotifier {
+    int fd;
+    int pipe[2];
+    pthread_t thread;
+    pthread_mutex_t lock;
+
+    /* Binary syncobj signaled to interrupt the helper thread's wait. */
+    uint32_t kick;
+    bool waiting, kicked, stop;
+
+    /* Registered by drmSyncobjNotifierAdd, not seen by the thread yet. */
+    struct drm_syncobj_notifier_list incoming;
+    /* Completions waiting for drmSyncobjNotifierRead. */
+    drmSyncobjCompletion *done;
+    unsigned num_done, max_done;
+};
+
+static int drmSyncobjNotifierListAppend(struct drm_syncobj_notifier_list *list,
+                                        uint32_t handle, uint64_t point,
+                                        uint64_t cookie)
+{
+    if (list->count == list->max) {
+        unsigned max = list->max ? list->max * 2 : 16;
+        void *items = realloc(list->items, max * sizeof(*list->items));
+
+        if (!items)
+            return -ENOMEM;
+        list->items = items;
+        list->max = max;
+    }
+
+    list->items[list->count].handle = handle;
+    list->items[list->count].point = point;
+    list->items[list->count].cookie = cookie;
+    list->count++;
+    return 0;
+}
+
+/* Called with the lock held. */
+static bool drmSyncobjNotifierComplete(drmSyncobjNotifierPtr notifier,
+                                       const struct drm_syncobj_notifier_item *item,
+                                       int status)
+{
+    drmSyncobjCompletion *c;
+    char byte = 0;
+
+    if (notifier->num_done == notifier->max_done) {
+        unsigned max = notifier->max_done ? notifier->max_done * 2 : 16;
+        void *done = realloc(notifier->done, max * sizeof(*notifier->done));
+
+        if (!done)
+            return false;
+        notifier->done = done;
+        notifier->max_done = max;
+    }
+
+    c = &notifier->done[notifier->num_done++];
+    c->handle = item->handle;
+    c->point = item->point;
+    c->cookie = item->cookie;
+    c->status = status;
+
+    if (notifier->num_done == 1)
+        while (write(notifier->pipe[1], &byte, 1) < 0 && errno == EINTR);
+
+    return true;
+}
+
+/* Queues the completion of pending item i and removes it from the list,
+ * moving the last item (and its handles[]/points[] slots) into its place.
+ */
+static bool drmSyncobjNotifierReapItem(drmSyncobjNotifierPtr notifier,
+                                       struct drm_syncobj_notifier_list *pending,
+                                       uint32_t *handles, uint64_t *points,
+                                       unsigned i, int status)
+{
+    unsigned last;
+    bool queued;
+
+    pthread_mutex_lock(&notifier->lock);
+    queued = drmSyncobjNotifierComplete(notifier, &pending->items[i], status);
+    pthread_mutex_unlock(&notifier->lock);
+    if (!queued)
+        return false;
+
+    last = --pending->count;
+    pending->items[i] = pending->items[last];
+    handles[i + 1] = handles[last + 1];
+    points[i + 1] = points[last + 1];
+    return true;
+}
+
+/* Removes the pending items that signaled (or are invalid) and queues their
+ * completions. handles[0] and points[0] belong to the kick syncobj.
+ *
+ * Each signaled item costs one non-blocking wait on all the remaining items,
+ * which reports the next signaled one, until a wait times out. Only when a
+ * wait fails are the items checked one at a time, to find the invalid ones.
+ */
+static void drmSyncobjNotifierReap(drmSyncobjNotifierPtr notifier,
+                                   struct drm_syncobj_notifier_list *pending,
+                                   uint32_t *handles, uint64_t *points,
+                                   int wait_ret, uint32_t first)
+{
+    unsigned i, count = pending->count;
+    int ret = wait_ret;
+
+    while (ret == 0 && first > 0 && first <= pending->count) {
+        if (!drmSyncobjNotifierReapItem(notifier, pending, handles, points,
+                                        first - 1, 0)) {
+            /* Out of memory, try again later. */
+            usleep(1000);
+            return;
+        }
+        if (!pending->count)
+            return;
+
+        ret = drmSyncobjTimelineWait(notifier->fd, handles + 1, points + 1,
+                                     pending->count, 0,
+                                     DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+                                     &first);
+        first++;
+    }
+    if (ret == 0 || ret == -ETIME)
+        return;
+
+    for (i = 0; i < pending->count;) {
+        ret = drmSyncobjTimelineWait(notifier->fd, &handles[i + 1],
+                                     &points[i + 1], 1, 0,
+                                     DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+                                     NULL);
+        if (ret == -ETIME ||
+            !drmSyncobjNotifierReapItem(notifier, pending, handles, points,
+                                        i, ret))
+            i++;
+    }
+
+    /* Nothing could be reaped although the wait failed, don't spin. */
+    if (pending->count == count)
+        usleep(1000);
+}
+
+static void *drmSyncobjNotifierThread(void *data)
+{
+    drmSyncobjNotifierPtr notifier = data;
+    struct drm_syncobj_notifier_list pending = { 0 };
+    uint32_t *handles = NULL;
+    uint64_t *points = NULL;
+    unsigned max = 0, i;
+    uint32_t first = 0;
+    int ret;
+
+    for (;;) {
+        pthread_mutex_lock(&notifier->lock);
+        notifier->waiting = false;
+        if (notifier->stop) {
+            pthread_mutex_unlock(&notifier->lock);
+            break;
+        }
+        if (notifier->kicked) {
+            drmSyncobjReset(notifier->fd, &notifier->kick, 1);
+            notifier->kicked = false;
+        }
+        for (i = 0; i < notifier->incoming.count; i++) {
+            struct drm_syncobj_notifier_item *item = &notifier->incoming.items[i];
+
+            if (drmSyncobjNotifierListAppend(&pending, item->handle,
+                                             item->point, item->cookie))
+                break;
+        }
+        memmove(notifier->incoming.items, notifier->incoming.items + i,
+                (notifier->incoming.count - i) * sizeof(*notifier->incoming.items));
+        notifier->incoming.count -= i;
+        notifier->waiting = true;
+        pthread_mutex_unlock(&notifier->lock);
+
+        if (pending.count + 1 > max) {
+            void *h = realloc(handles, (pending.max + 1) * sizeof(*handles));
+            void *p;
+
+            if (h)
+                handles = h;
+            p = realloc(points, (pending.max + 1) * sizeof(*points));
+            if (p)
+                points = p;
+            if (!h || !p) {
+                /* Out of memory, try again later. */
+                usleep(1000);
+                continue;
+            }
+            max = pending.max + 1;
+        }
+
+        handles[0] = notifier->kick;
+        points[0] = 0;
+        for (i = 0; i < pending.count; i++) {
+            handles[i + 1] = pending.items[i].handle;
+            points[i + 1] = pending.items[i].point;
+        }
+
+        ret = drmSyncobjTimelineWait(notifier->fd, handles, points,
+                                     pending.count + 1, INT64_MAX,
+                                     DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+                                     &first);
+        if (ret == 0 && first == 0)
+            continue;
+
+        drmSyncobjNotifierReap(notifier, &pending, handles, points, ret, first);
+    }
+
+    free(pending.items);
+    free(handles);
+    free(points);
+    return NULL;
+}
+
+drm_public drmSyncobjNotifierPtr drmSyncobjNotifierCreate(int fd)
+{
+    drmSyncobjNotifierPtr notifier;
+    int i;
+
+    notifier = calloc(1, sizeof(*notifier));
+    if (!notifier)
+        return NULL;
+
+    notifier->fd = fd;
+    if (pipe(notifier->pipe))
+        goto err_free;
+    for (i = 0; i < 2; i++) {
+        fcntl(notifier->pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(notifier->pipe[i], F_SETFL, O_NONBLOCK);
+    }
+
+    if (drmSyncobjCreate(fd, 0, &notifier->kick))
+        goto err_pipe;
+
+    pthread_mutex_init(&notifier->lock, NULL);
+    if (pthread_create(&notifier->thread, NULL, drmSyncobjNotifierThread,
+                       notifier))
+        goto err_syncobj;
+
+    return notifier;
+
+err_syncobj:
+    pthread_mutex_destroy(&notifier->lock);
+    drmSyncobjDestroy(fd, notifier->kick);
+err_pipe:
+    close(notifier->pipe[0]);
+    close(notifier->pipe[1]);
+err_free:
+    free(notifier);
+    return NULL;
+}
+
+/* Called with the lock held. */
+static void drmSyncobjNotifierKick(drmSyncobjNotifierPtr notifier)
+{
+    if (notifier->waiting && !notifier->kicked) {
+        drmSyncobjSignal(notifier->fd, &notifier->kick, 1);
+        notifier->kicked = true;
+    }
+}
+
+drm_public void drmSyncobjNotifierDestroy(drmSyncobjNotifierPtr notifier)
+{
+    if (!notifier)
+        return;
+
+    pthread_mutex_lock(&notifier->lock);
+    notifier->stop = true;
+    drmSyncobjNotifierKick(notifier);
+    pthread_mutex_unlock(&notifier->lock);
+    pthread_join(notifier->thread, NULL);
+
+    pthread_mutex_destroy(&notifier->lock);
+    drmSyncobjDestroy(notifier->fd, notifier->kick);
+    close(notifier->pipe[0]);
+    close(notifier->pipe[1]);
+    free(notifier->incoming.items);
+    free(notifier->done);
+    free(notifier);
+}
+
+drm_public int drmSyncobjNotifierGetFD(drmSyncobjNotifierPtr notifier)
+{
+    return notifier->pipe[0];
+}
+
+drm_public int drmSyncobjNotifierAdd(drmSyncobjNotifierPtr notifier,
+                                     uint32_t handle, uint64_t point,
+                                     uint64_t cookie)
+{
+    int ret;
+
+    pthread_mutex_lock(&notifier->lock);
+    ret = drmSyncobjNotifierListAppend(&notifier->incoming, handle, point,
+                                       cookie);
+    if (!ret)
+        drmSyncobjNotifierKick(notifier);
+    pthread_mutex_unlock(&notifier->lock);
+
+    return ret;
+}
+
+drm_public int drmSyncobjNotifierRead(drmSyncobjNotifierPtr notifier,
+                                      drmSyncobjCompletion *completions,
+                                      unsigned max_completions)
+{
+    unsigned count;
+    char buf[16];
+
+    pthread_mutex_lock(&notifier->lock);
+    count = MIN2(max_completions, notifier->num_done);
+    memcpy(completions, notifier->done, count * sizeof(*completions));
+    memmove(notifier->done, notifier->done + count,
+            (notifier->num_done - count) * sizeof(*notifier->done));
+    notifier->num_done -= count;
+
+    if (!notifier->num_done)
+        while (read(notifier->pipe[0], buf, sizeof(buf)) > 0 || errno == EINTR);
+    pthread_mutex_unlock(&notifier->lock);
+
+    return count;
+}
+
 static char *
 drmGetFormatModifierFromSimpleTokens(uint64_t modifier)
 {
+    uint8_t vendor = fourcc_mod_get_vendor(modifier);
+    const struct drmFormatModifierRange *range;
     unsigned int i;
 
-    for (i = 0; i < ARRAY_SIZE(drm_format_modifier_table); i++) {
+    if (vendor >= ARRAY_SIZE(drm_format_modifier_vendor_ranges))
+        return NULL;
+
+    range = &drm_format_modifier_vendor_ranges[vendor];
+    for (i = range->first; i < range->first + range->count; i++) {
         if (drm_format_modifier_table[i].modifier == modifier)
             return strdup(drm_format_modifier_table[i].modifier_name);
     }
@@ -4967,15 +5749,49 @@ drmGetFormatModifierFromSimpleTokens(uint64_t modifier)
 drm_public char *
 drmGetFormatModifierVendor(uint64_t modifier)
 {
-    unsigned int i;
     uint8_t vendor = fourcc_mod_get_vendor(modifier);
 
-    for (i = 0; i < ARRAY_SIZE(drm_format_modifier_vendor_table); i++) {
-        if (drm_format_modifier_vendor_table[i].vendor == vendor)
-            return strdup(drm_format_modifier_vendor_table[i].vendor_name);
+    if (vendor >= ARRAY_SIZE(drm_format_modifier_vendor_names) ||
+        !drm_format_modifier_vendor_names[vendor])
+        return NULL;
+
+    return strdup(drm_format_modifier_vendor_names[vendor]);
+}
+
+static char *
+drmGetFormatModifierFromVendor(uint64_t modifier)
+{
+    uint8_t vendor = fourcc_mod_get_vendor(modifier);
+    unsigned int idx;
+    char *name;
+
+    if (vendor >= ARRAY_SIZE(modifier_format_vendor_table) ||
+        !modifier_format_vendor_table[vendor].vendor_cb)
+        return NULL;
+
+    idx = ((modifier ^ (modifier >> 32)) * 0x9e3779b1u) >>
+          (32 - 8) & (DRM_MODIFIER_NAME_CACHE_SIZE - 1);
+
+    pthread_mutex_lock(&drm_modifier_name_cache_lock);
+    if (drm_modifier_name_cache[idx].name &&
+        drm_modifier_name_cache[idx].modifier == modifier) {
+        name = strdup(drm_modifier_name_cache[idx].name);
+        pthread_mutex_unlock(&drm_modifier_name_cache_lock);
+        return name;
     }
+    pthread_mutex_unlock(&drm_modifier_name_cache_lock);
 
-    return NULL;
+    name = modifier_format_vendor_table[vendor].vendor_cb(modifier);
+    if (!name)
+        return NULL;
+
+    pthread_mutex_lock(&drm_modifier_name_cache_lock);
+    free(drm_modifier_name_cache[idx].name);
+    drm_modifier_name_cache[idx].modifier = modifier;
+    drm_modifier_name_cache[idx].name = strdup(name);
+    pthread_mutex_unlock(&drm_modifier_name_cache_lock);
+
+    return name;
 }
 
 /** Retrieves a human-readable representation string from a format token
@@ -4992,14 +5808,7 @@ drmGetFormatModifierVendor(uint64_t modifier)
 drm_public char *
 drmGetFormatModifierName(uint64_t modifier)
 {
-    uint8_t vendorid = fourcc_mod_get_vendor(modifier);
-    char *modifier_found = NULL;
-    unsigned int i;
-
-    for (i = 0; i < ARRAY_SIZE(modifier_format_vendor_table); i++) {
-        if (modifier_format_vendor_table[i].vendor == vendorid)
-            modifier_found = modifier_format_vendor_table[i].vendor_cb(modifier);
-    }
+    char *modifier_found = drmGetFormatModifierFromVendor(modifier);
 
     if (!modifier_found)
         return drmGetFormatModifierFromSimpleTokens(modifier);
@@ -834,6 +834,25 @@ extern int drmGetNodeTypeFromFd(int fd);
 extern int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd);
 extern int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle);
 
+/* Per DRM FD cache of dma-buf imports.
+ *
+ * drmPrimeCacheFDToHandle behaves like drmPrimeFDToHandle, but remembers the
+ * inode of every dma-buf it imported, so importing the same buffer again only
+ * costs an fstat() instead of an ioctl.
+ *
+ * The cache does not own the GEM handles it returns. Callers must call
+ * drmPrimeCacheRemoveHandle before closing a handle, otherwise a later import
+ * of the same dma-buf would return the stale handle. The cache is not
+ * thread-safe, callers have to serialize accesses to it.
+ */
+typedef struct _drmPrimeCache drmPrimeCache, *drmPrimeCachePtr;
+
+extern drmPrimeCachePtr drmPrimeCacheCreate(int fd);
+extern void drmPrimeCacheDestroy(drmPrimeCachePtr cache);
+extern int drmPrimeCacheFDToHandle(drmPrimeCachePtr cache, int prime_fd,
+                                   uint32_t *handle);
+extern void drmPrimeCacheRemoveHandle(drmPrimeCachePtr cache, uint32_t handle);
+
 extern char *drmGetPrimaryDeviceNameFromFd(int fd);
 extern char *drmGetRenderDeviceNameFromFd(int fd);
 
@@ -944,6 +963,65 @@ extern int drmSyncobjTransfer(int fd,
 			      uint32_t src_handle, uint64_t src_point,
 			      uint32_t flags);
 
+/* Waits on syncobjs spread over several DRM devices.
+ *
+ * drmSyncobjWaitSetAdd returns the index of the (fd, handle, point) tuple in
+ * the set, or a negative errno. A point of 0 refers to the binary payload of
+ * the syncobj. drmSyncobjWaitSetWait first checks the fences of each device
+ * with one non-blocking wait ioctl, then converts the pending ones to
+ * sync_files and poll()s them all at once. timeout_nsec is an absolute
+ * CLOCK_MONOTONIC time and the only supported flag is
+ * DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL, all fences must already be submitted.
+ *
+ * Fences are captured the first time the set waits on them and stay cached
+ * until drmSyncobjWaitSetReset, so waiting again on the same set (e.g. after
+ * a timeout) does not re-export anything. drmSyncobjWaitSetIsSignaled tells
+ * which fences signaled. The set must be destroyed before any of the DRM FDs
+ * it references are closed.
+ */
+typedef struct _drmSyncobjWaitSet drmSyncobjWaitSet, *drmSyncobjWaitSetPtr;
+
+extern drmSyncobjWaitSetPtr drmSyncobjWaitSetCreate(void);
+extern void drmSyncobjWaitSetDestroy(drmSyncobjWaitSetPtr set);
+extern void drmSyncobjWaitSetReset(drmSyncobjWaitSetPtr set);
+extern int drmSyncobjWaitSetAdd(drmSyncobjWaitSetPtr set, int fd,
+				uint32_t handle, uint64_t point);
+extern int drmSyncobjWaitSetWait(drmSyncobjWaitSetPtr set,
+				 int64_t timeout_nsec, unsigned flags,
+				 uint32_t *first_signaled);
+extern int drmSyncobjWaitSetIsSignaled(drmSyncobjWaitSetPtr set,
+				       unsigned index);
+
+/* Asynchronous syncobj completion notifications.
+ *
+ * The notifier owns a helper thread which waits on every registered
+ * (handle, point) of the DRM FD, so that an event loop can poll() the FD
+ * returned by drmSyncobjNotifierGetFD instead of blocking a thread per job.
+ * The FD becomes readable when completions are queued, drmSyncobjNotifierRead
+ * then returns them in batches, along with the cookie passed to
+ * drmSyncobjNotifierAdd. The status is 0 when the fence signaled, or a
+ * negative errno if the syncobj could not be waited on. Fences don't need to
+ * be submitted when registered.
+ */
+typedef struct _drmSyncobjCompletion {
+    uint32_t handle;
+    int status;
+    uint64_t point;
+    uint64_t cookie;
+} drmSyncobjCompletion;
+
+typedef struct _drmSyncobjNotifier drmSyncobjNotifier, *drmSyncobjNotifierPtr;
+
+extern drmSyncobjNotifierPtr drmSyncobjNotifierCreate(int fd);
+extern void drmSyncobjNotifierDestroy(drmSyncobjNotifierPtr notifier);
+extern int drmSyncobjNotifierGetFD(drmSyncobjNotifierPtr notifier);
+extern int drmSyncobjNotifierAdd(drmSyncobjNotifierPtr notifier,
+				 uint32_t handle, uint64_t point,
+				 uint64_t cookie);
+extern int drmSyncobjNotifierRead(drmSyncobjNotifierPtr notifier,
+				  drmSyncobjCompletion *completions,
+				  unsigned max_completions);
+
 extern char *
 drmGetFormatModifierVendor(uint64_t modifier);
 
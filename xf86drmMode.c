@@ -47,6 +47,7 @@
 #include <stdbool.h>
 
 #include "libdrm_macros.h"
+#include "util_math.h"
 #include "xf86drmMode.h"
 #include "xf86drm.h"
 #include <drm.h>
@@ -608,6 +609,272 @@ drm_public drmModeConnectorPtr drmModeGetConnectorCurrent(int fd, uint32_t conne
 	return _drmModeGetConnector(fd, connector_id, 0);
 }
 
+/*
+ * Connector cache
+ *
+ * Each cached connector lives in a single allocation: the entry itself,
+ * followed by the property values, modes, property ids, encoder ids and
+ * EDID blob it points to.
+ */
+struct drm_mode_connector_entry {
+	drmModeConnector base;
+	int refcount;
+	bool stale;
+	uint32_t edid_size;
+	void *edid;
+};
+
+struct _drmModeConnectorCache {
+	int fd;
+	void *connectors; /* connector id -> struct drm_mode_connector_entry */
+	uint32_t edid_prop_id;
+};
+
+static size_t drmModeConnectorEntryLayout(struct drm_mode_connector_entry *entry,
+					  int count_props, int count_modes,
+					  int count_encoders, uint32_t edid_size)
+{
+	char *base = (char *)entry;
+	size_t offset = ALIGN(sizeof(*entry), sizeof(uint64_t));
+
+	entry->base.prop_values = (uint64_t *)(base + offset);
+	offset += count_props * sizeof(uint64_t);
+	entry->base.modes = (drmModeModeInfoPtr)(base + offset);
+	offset += count_modes * sizeof(drmModeModeInfo);
+	entry->base.props = (uint32_t *)(base + offset);
+	offset += count_props * sizeof(uint32_t);
+	entry->base.encoders = (uint32_t *)(base + offset);
+	offset += count_encoders * sizeof(uint32_t);
+	entry->edid = edid_size ? base + offset : NULL;
+	offset += edid_size;
+
+	return offset;
+}
+
+static uint32_t drmModeConnectorCacheEDIDProp(drmModeConnectorCachePtr cache,
+					      const drmModeConnector *connector)
+{
+	drmModePropertyPtr prop;
+	int i;
+
+	/* All connectors share the same EDID property. */
+	for (i = 0; !cache->edid_prop_id && i < connector->count_props; i++) {
+		prop = drmModeGetProperty(cache->fd, connector->props[i]);
+		if (!prop)
+			continue;
+		if (!strcmp(prop->name, "EDID"))
+			cache->edid_prop_id = prop->prop_id;
+		drmModeFreeProperty(prop);
+	}
+
+	for (i = 0; i < connector->count_props; i++) {
+		if (connector->props[i] == cache->edid_prop_id)
+			return connector->prop_values[i];
+	}
+
+	return 0;
+}
+
+static struct drm_mode_connector_entry *
+drmModeConnectorCacheFetch(drmModeConnectorCachePtr cache, uint32_t connector_id)
+{
+	struct drm_mode_connector_entry *entry, *tmp;
+	struct drm_mode_get_connector conn, counts;
+	struct drm_mode_get_blob blob;
+	struct drm_mode_modeinfo stack_mode;
+	uint32_t blob_id;
+	size_t size;
+
+	memclear(conn);
+	conn.connector_id = connector_id;
+
+	if (drmIoctl(cache->fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn))
+		return NULL;
+
+retry:
+	counts = conn;
+
+	size = drmModeConnectorEntryLayout(&(struct drm_mode_connector_entry){ 0 },
+					   conn.count_props, conn.count_modes,
+					   conn.count_encoders, 0);
+	entry = drmMalloc(size);
+	if (!entry)
+		return NULL;
+	drmModeConnectorEntryLayout(entry, conn.count_props, conn.count_modes,
+				    conn.count_encoders, 0);
+
+	conn.props_ptr = VOID2U64(entry->base.props);
+	conn.prop_values_ptr = VOID2U64(entry->base.prop_values);
+	conn.encoders_ptr = VOID2U64(entry->base.encoders);
+	if (conn.count_modes) {
+		conn.modes_ptr = VOID2U64(entry->base.modes);
+	} else {
+		conn.count_modes = 1;
+		conn.modes_ptr = VOID2U64(&stack_mode);
+	}
+
+	if (drmIoctl(cache->fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn)) {
+		drmFree(entry);
+		return NULL;
+	}
+
+	/* See _drmModeGetConnector(). */
+	if (counts.count_props < conn.count_props ||
+	    counts.count_modes < conn.count_modes ||
+	    counts.count_encoders < conn.count_encoders) {
+		drmFree(entry);
+		goto retry;
+	}
+	if (U642VOID(conn.modes_ptr) == &stack_mode)
+		conn.count_modes = 0;
+
+	entry->refcount = 1;
+	entry->base.connector_id = conn.connector_id;
+	entry->base.encoder_id = conn.encoder_id;
+	entry->base.connection = conn.connection;
+	entry->base.mmWidth = conn.mm_width;
+	entry->base.mmHeight = conn.mm_height;
+	/* convert subpixel from kernel to userspace */
+	entry->base.subpixel = conn.subpixel + 1;
+	entry->base.count_modes = conn.count_modes;
+	entry->base.count_props = conn.count_props;
+	entry->base.count_encoders = conn.count_encoders;
+	entry->base.connector_type = conn.connector_type;
+	entry->base.connector_type_id = conn.connector_type_id;
+
+	blob_id = drmModeConnectorCacheEDIDProp(cache, &entry->base);
+	if (!blob_id)
+		return entry;
+
+	memclear(blob);
+	blob.blob_id = blob_id;
+	if (drmIoctl(cache->fd, DRM_IOCTL_MODE_GETPROPBLOB, &blob) || !blob.length)
+		return entry;
+
+	size = drmModeConnectorEntryLayout(entry, counts.count_props,
+					   counts.count_modes,
+					   counts.count_encoders, blob.length);
+	tmp = realloc(entry, size);
+	if (!tmp)
+		return entry;
+	entry = tmp;
+	drmModeConnectorEntryLayout(entry, counts.count_props, counts.count_modes,
+				    counts.count_encoders, blob.length);
+
+	blob.data = VOID2U64(entry->edid);
+	if (!drmIoctl(cache->fd, DRM_IOCTL_MODE_GETPROPBLOB, &blob))
+		entry->edid_size = blob.length;
+	else
+		entry->edid = NULL;
+
+	return entry;
+}
+
+drm_public drmModeConnectorCachePtr drmModeConnectorCacheCreate(int fd)
+{
+	drmModeConnectorCachePtr cache;
+
+	cache = drmMalloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->fd = fd;
+	cache->connectors = drmHashCreate();
+	if (!cache->connectors) {
+		drmFree(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+drm_public void drmModeConnectorCacheDestroy(drmModeConnectorCachePtr cache)
+{
+	unsigned long key;
+	void *value;
+
+	if (!cache)
+		return;
+
+	if (drmHashFirst(cache->connectors, &key, &value)) {
+		do {
+			drmModeConnectorCacheRelease(value);
+		} while (drmHashNext(cache->connectors, &key, &value));
+	}
+	drmHashDestroy(cache->connectors);
+	drmFree(cache);
+}
+
+drm_public const drmModeConnector *
+drmModeConnectorCacheGet(drmModeConnectorCachePtr cache, uint32_t connector_id)
+{
+	struct drm_mode_connector_entry *entry = NULL;
+	void *value;
+
+	if (!drmHashLookup(cache->connectors, connector_id, &value)) {
+		entry = value;
+		if (entry->stale) {
+			drmHashDelete(cache->connectors, connector_id);
+			drmModeConnectorCacheRelease(&entry->base);
+			entry = NULL;
+		}
+	}
+
+	if (!entry) {
+		entry = drmModeConnectorCacheFetch(cache, connector_id);
+		if (!entry)
+			return NULL;
+		/* Not cached, the caller gets the only reference. */
+		if (drmHashInsert(cache->connectors, connector_id, entry))
+			return &entry->base;
+	}
+
+	entry->refcount++;
+	return &entry->base;
+}
+
+drm_public const void *
+drmModeConnectorCacheGetEDID(const drmModeConnector *connector, uint32_t *size)
+{
+	const struct drm_mode_connector_entry *entry =
+		(const struct drm_mode_connector_entry *)connector;
+
+	*size = entry->edid_size;
+	return entry->edid;
+}
+
+drm_public void drmModeConnectorCacheRelease(const drmModeConnector *connector)
+{
+	struct drm_mode_connector_entry *entry =
+		(struct drm_mode_connector_entry *)connector;
+
+	if (entry && --entry->refcount == 0)
+		drmFree(entry);
+}
+
+drm_public void drmModeConnectorCacheInvalidate(drmModeConnectorCachePtr cache,
+						uint32_t connector_id)
+{
+	struct drm_mode_connector_entry *entry;
+	unsigned long key;
+	void *value;
+
+	if (connector_id) {
+		if (!drmHashLookup(cache->connectors, connector_id, &value)) {
+			entry = value;
+			entry->stale = true;
+		}
+		return;
+	}
+
+	if (drmHashFirst(cache->connectors, &key, &value)) {
+		do {
+			entry = value;
+			entry->stale = true;
+		} while (drmHashNext(cache->connectors, &key, &value));
+	}
+}
+
 drm_public int drmModeAttachMode(int fd, uint32_t connector_id, drmModeModeInfoPtr mode_info)
 {
 	struct drm_mode_mode_cmd res;
@@ -376,6 +376,32 @@ extern drmModeConnectorPtr drmModeGetConnector(int fd,
 extern drmModeConnectorPtr drmModeGetConnectorCurrent(int fd,
 						      uint32_t connector_id);
 
+/**
+ * Per-fd connector cache.
+ *
+ * drmModeConnectorCacheGet() probes the connector like drmModeGetConnector()
+ * the first time, then returns the cached copy until the connector is
+ * invalidated, typically from a hotplug uevent handler (link-status changes
+ * are also reported through hotplug uevents). A connector id of 0 invalidates
+ * all connectors.
+ *
+ * The returned connector, including its modes, properties and EDID, is
+ * immutable and stays valid until it is released with
+ * drmModeConnectorCacheRelease(), even if the cache is refreshed or destroyed
+ * in the meantime. The cache is not thread-safe.
+ */
+typedef struct _drmModeConnectorCache drmModeConnectorCache, *drmModeConnectorCachePtr;
+
+extern drmModeConnectorCachePtr drmModeConnectorCacheCreate(int fd);
+extern void drmModeConnectorCacheDestroy(drmModeConnectorCachePtr cache);
+extern const drmModeConnector *
+drmModeConnectorCacheGet(drmModeConnectorCachePtr cache, uint32_t connector_id);
+extern const void *drmModeConnectorCacheGetEDID(const drmModeConnector *connector,
+						uint32_t *size);
+extern void drmModeConnectorCacheRelease(const drmModeConnector *connector);
+extern void drmModeConnectorCacheInvalidate(drmModeConnectorCachePtr cache,
+					    uint32_t connector_id);
+
 /**
  * Attaches the given mode to an connector.
  */